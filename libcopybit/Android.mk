@@ -27,12 +27,15 @@ ifeq ($(TARGET_USES_C2D_COMPOSITION),true)
     LOCAL_PRELINK_MODULE := false
     LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
     LOCAL_SHARED_LIBRARIES := liblog libdl libcutils libmemalloc libutils
-    LOCAL_SRC_FILES := copybit_c2d.cpp software_converter.cpp
+    LOCAL_SRC_FILES := copybit_c2d.cpp software_converter.cpp yuv_kernels.cpp
     LOCAL_MODULE := copybit.$(TARGET_BOARD_PLATFORM)
     LOCAL_C_INCLUDES += $(TARGET_OUT_INTERMEDIATES)/KERNEL_OBJ/usr/include
     LOCAL_C_INCLUDES += $(TARGET_OUT_HEADERS)/qcom/display
     LOCAL_ADDITIONAL_DEPENDENCIES += $(TARGET_OUT_INTERMEDIATES)/KERNEL_OBJ/usr
     LOCAL_CFLAGS += -DCOPYBIT_Z180=1 -DC2D_SUPPORT_DISPLAY=1
+    ifeq ($(ARCH_ARM_HAVE_NEON),true)
+        LOCAL_CFLAGS += -D__ARM_HAVE_NEON
+    endif
     LOCAL_MODULE_TAGS := optional
     include $(BUILD_SHARED_LIBRARY)
 else
@@ -55,7 +58,7 @@ else
             LOCAL_PRELINK_MODULE := false
             LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
             LOCAL_SHARED_LIBRARIES := liblog libmemalloc
-            LOCAL_SRC_FILES := software_converter.cpp copybit.cpp
+            LOCAL_SRC_FILES := software_converter.cpp yuv_kernels.cpp copybit.cpp
             LOCAL_MODULE := copybit.$(TARGET_BOARD_PLATFORM)
             LOCAL_MODULE_TAGS := optional
             LOCAL_C_INCLUDES += $(TARGET_OUT_INTERMEDIATES)/KERNEL_OBJ/usr/include
@@ -66,3 +69,21 @@ else
         endif
     endif
 endif
+
+# CPU module, for the layers the hardware module cannot blit
+include $(CLEAR_VARS)
+LOCAL_PRELINK_MODULE := false
+LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
+LOCAL_SHARED_LIBRARIES := liblog libcutils libmemalloc libutils
+LOCAL_SRC_FILES := copybit_sw.cpp sw_blit.cpp yuv_kernels.cpp
+LOCAL_MODULE := copybit_sw.$(TARGET_BOARD_PLATFORM)
+LOCAL_C_INCLUDES += $(TARGET_OUT_INTERMEDIATES)/KERNEL_OBJ/usr/include
+LOCAL_C_INCLUDES += $(TARGET_OUT_HEADERS)/qcom/display
+LOCAL_ADDITIONAL_DEPENDENCIES += $(TARGET_OUT_INTERMEDIATES)/KERNEL_OBJ/usr
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+    LOCAL_CFLAGS += -D__ARM_HAVE_NEON
+endif
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-subdir-makefiles)
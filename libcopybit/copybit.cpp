@@ -25,6 +25,7 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -37,6 +38,7 @@
 
 #include "gralloc_priv.h"
 #include "software_converter.h"
+#include "copybit_priv.h"
 
 #define DEBUG_MDP_ERRORS 1
 
@@ -52,14 +54,63 @@
 #error "Unsupported MDP version"
 #endif
 
+/* YV12 sources kept converted for the MDP */
+#define MAX_YV12_CONVERSIONS 3
+
+/* Stretches beyond MAX_SCALE_FACTOR are done in up to MAX_SCALE_PASSES
+ * passes, through intermediate buffers kept for the next stretches */
+#define MAX_SCALE_PASSES    3
+#define MAX_SCALE_BUFFERS   (MAX_SCALE_PASSES - 1)
+#define MAX_STRETCH_FACTOR  (MAX_SCALE_FACTOR * MAX_SCALE_FACTOR * MAX_SCALE_FACTOR)
+/* Intermediate buffers are allocated a bit larger, to fit the next sizes */
+#define SCALE_BUFFER_ALIGN  64
+
 /******************************************************************************/
 
+/** A YV12 source converted to YCrCb_420_SP, and the buffer holding it */
+struct yv12_conversion_t {
+    private_handle_t *buffer;  // kept for the next source of its size
+    int fd;                    // of the source
+    int offset;
+    uint32_t w;
+    uint32_t h;
+    uint32_t generation;       // of the source, 0 if the conversion is invalid
+    uint32_t lastUse;          // 0 if invalid
+};
+
+/** The source of the intermediates of the last multi-pass stretch */
+struct scale_source_t {
+    int fd;                    // of the source
+    int offset;
+    uint32_t generation;       // of the source, 0 if the intermediates are invalid
+    struct copybit_rect_t rect;
+    int format;                // of the intermediates
+    int flags;                 // of the intermediate passes
+    int passes;
+    uint32_t w[MAX_SCALE_BUFFERS];
+    uint32_t h[MAX_SCALE_BUFFERS];
+};
+
 /** State information for each device instance */
 struct copybit_context_t {
     struct copybit_device_t device;
     int     mFD;
     uint8_t mAlpha;
     int     mFlags;
+    uint32_t mGeneration;      // of the next source, COPYBIT_SOURCE_GENERATION
+    bool    mReleaseHooked;    // generations are ignored without the hook
+    pthread_mutex_t mConversionLock;
+    yv12_conversion_t mConversions[MAX_YV12_CONVERSIONS];
+    uint32_t mConversionClock;
+    private_handle_t *mScaleBuffers[MAX_SCALE_BUFFERS];
+    bool mScaleBufferClean[MAX_SCALE_BUFFERS];  // still zero, as allocated
+    scale_source_t mScaleSource;  // under mConversionLock
+};
+
+/** List of requests submitted with a single MSMFB_BLIT */
+struct copybit_blit_list_t {
+    uint32_t count;
+    struct mdp_blit_req req[12];
 };
 
 /**
@@ -319,6 +370,9 @@ static int set_parameter_copybit(
             ctx->mFlags &= ~0x7;
             ctx->mFlags |= value & 0x7;
             break;
+        case COPYBIT_SOURCE_GENERATION:
+            ctx->mGeneration = ctx->mReleaseHooked ? value : 0;
+            break;
         default:
             status = -EINVAL;
             break;
@@ -337,10 +391,10 @@ static int get(struct copybit_device_t *dev, int name)
     if (ctx) {
         switch(name) {
         case COPYBIT_MINIFICATION_LIMIT:
-            value = MAX_SCALE_FACTOR;
+            value = MAX_STRETCH_FACTOR;
             break;
         case COPYBIT_MAGNIFICATION_LIMIT:
-            value = MAX_SCALE_FACTOR;
+            value = MAX_STRETCH_FACTOR;
             break;
         case COPYBIT_SCALING_FRAC_BITS:
             value = 32;
@@ -357,6 +411,457 @@ static int get(struct copybit_device_t *dev, int name)
     return value;
 }
 
+/** check that the blit of src into dst can be done by the MDP */
+static int check_stretch(struct copybit_context_t *ctx,
+                         struct copybit_image_t const *dst,
+                         struct copybit_image_t const *src,
+                         struct copybit_rect_t const *src_rect)
+{
+    if (ctx->mAlpha < 255) {
+        switch (src->format) {
+            // we don't support plane alpha with RGBA formats
+            case HAL_PIXEL_FORMAT_RGBA_8888:
+            case HAL_PIXEL_FORMAT_BGRA_8888:
+            case HAL_PIXEL_FORMAT_RGBA_5551:
+            case HAL_PIXEL_FORMAT_RGBA_4444:
+                return -EINVAL;
+        }
+    }
+
+    if (src_rect->l < 0 || src_rect->r > src->w ||
+        src_rect->t < 0 || src_rect->b > src->h) {
+        // this is always invalid
+        return -EINVAL;
+    }
+
+    if (src->w > MAX_DIMENSION || src->h > MAX_DIMENSION)
+        return -EINVAL;
+
+    if (dst->w > MAX_DIMENSION || dst->h > MAX_DIMENSION)
+        return -EINVAL;
+
+    return 0;
+}
+
+/** queue the blits of the region, submitting the list whenever it is full */
+static int queue_blits(struct copybit_context_t *ctx,
+                       struct copybit_blit_list_t *list,
+                       struct copybit_image_t const *dst,
+                       struct copybit_image_t const *src,
+                       struct copybit_rect_t const *dst_rect,
+                       struct copybit_rect_t const *src_rect,
+                       struct copybit_region_t const *region)
+{
+    const uint32_t maxCount = sizeof(list->req)/sizeof(list->req[0]);
+    const struct copybit_rect_t bounds = { 0, 0, dst->w, dst->h };
+    struct copybit_rect_t clip;
+    int status = 0;
+    while ((status == 0) && region->next(region, &clip)) {
+        intersect(&clip, &bounds, &clip);
+        mdp_blit_req* req = &list->req[list->count];
+        int flags = 0;
+
+        private_handle_t* src_hnd = (private_handle_t*)src->handle;
+        if(src_hnd != NULL && src_hnd->flags & private_handle_t::PRIV_FLAGS_DO_NOT_FLUSH) {
+            flags |=  MDP_BLIT_NON_CACHED;
+        }
+
+        set_infos(ctx, req, flags);
+        set_image(&req->dst, dst);
+        set_image(&req->src, src);
+//#CORVUS - Parche https://github.com/mozilla-b2g/gonk-patches/commit/5dda2b19ffe5517cf5730971a3cdfc489ca5bff3
+        if (req->src.format == MDP_RGBA_8888) {
+            req->src.format = MDP_BGRA_8888;
+        }
+        else if (req->src.format == MDP_RGBX_8888) {
+            req->src.format = MDP_XRGB_8888;
+        }
+
+//#Fin parche
+        set_rects(ctx, req, dst_rect, src_rect, &clip, src->horiz_padding, src->vert_padding);
+
+        if (req->src_rect.w<=0 || req->src_rect.h<=0)
+            continue;
+
+        if (req->dst_rect.w<=0 || req->dst_rect.h<=0)
+            continue;
+
+        if (++list->count == maxCount) {
+            status = msm_copybit(ctx, list);
+            list->count = 0;
+        }
+    }
+    return status;
+}
+
+/** drop the conversions and intermediates of a source buffer being freed */
+static void on_buffer_release(void *data, const private_handle_t *hnd)
+{
+    struct copybit_context_t* ctx = (struct copybit_context_t*)data;
+    pthread_mutex_lock(&ctx->mConversionLock);
+    for (int i = 0; i < MAX_YV12_CONVERSIONS; i++) {
+        yv12_conversion_t& conv = ctx->mConversions[i];
+        if (conv.fd == hnd->fd && conv.offset == hnd->offset) {
+            conv.generation = 0;
+            conv.lastUse = 0;
+        }
+    }
+    scale_source_t& source = ctx->mScaleSource;
+    if (source.fd == hnd->fd && source.offset == hnd->offset) {
+        source.generation = 0;
+    }
+    pthread_mutex_unlock(&ctx->mConversionLock);
+}
+
+/*
+ * Get the YCrCb_420_SP conversion of a YV12 source. A source with the
+ * generation of a kept conversion is not converted again; otherwise the
+ * least recently used conversion is replaced, reusing its buffer when the
+ * size matches. gralloc calls on_buffer_release from free_buffer, so the
+ * buffers are allocated and freed without mConversionLock held.
+ */
+static private_handle_t* get_yv12_conversion(struct copybit_context_t *ctx,
+                                             struct copybit_image_t const *src)
+{
+    private_handle_t *hnd = (private_handle_t *)src->handle;
+    const uint32_t generation = ctx->mGeneration;
+
+    pthread_mutex_lock(&ctx->mConversionLock);
+    int slot = 0;
+    for (int i = 0; i < MAX_YV12_CONVERSIONS; i++) {
+        yv12_conversion_t& conv = ctx->mConversions[i];
+        bool sameSize = conv.buffer && conv.w == src->w && conv.h == src->h;
+        if (generation && sameSize && conv.generation == generation &&
+            conv.fd == hnd->fd && conv.offset == hnd->offset) {
+            conv.lastUse = ++ctx->mConversionClock;
+            pthread_mutex_unlock(&ctx->mConversionLock);
+            return conv.buffer;
+        }
+        const yv12_conversion_t& best = ctx->mConversions[slot];
+        bool bestSameSize = best.buffer && best.w == src->w && best.h == src->h;
+        if (conv.lastUse < best.lastUse ||
+            (conv.lastUse == best.lastUse && sameSize && !bestSameSize))
+            slot = i;
+    }
+    yv12_conversion_t& conv = ctx->mConversions[slot];
+    private_handle_t *buffer = conv.buffer;
+    bool sameSize = buffer && conv.w == src->w && conv.h == src->h;
+    conv.buffer = NULL;
+    conv.generation = 0;
+    conv.lastUse = 0;
+    pthread_mutex_unlock(&ctx->mConversionLock);
+
+    if (buffer && !sameSize) {
+        free_buffer(buffer);
+        buffer = NULL;
+    }
+    if (!buffer) {
+        int usage = GRALLOC_USAGE_PRIVATE_ADSP_HEAP | GRALLOC_USAGE_PRIVATE_MM_HEAP;
+        if (0 != alloc_buffer(&buffer, src->w, src->h, src->format, usage)) {
+            LOGE("Error:unable to allocate memeory for yv12 software conversion");
+            return NULL;
+        }
+    }
+    if (0 != convertYV12toYCrCb420SP(src, buffer)) {
+        LOGE("Error copybit conversion from yv12 failed");
+        free_buffer(buffer);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&ctx->mConversionLock);
+    conv.buffer = buffer;
+    conv.fd = hnd->fd;
+    conv.offset = hnd->offset;
+    conv.w = src->w;
+    conv.h = src->h;
+    conv.generation = generation;
+    conv.lastUse = ++ctx->mConversionClock;
+    pthread_mutex_unlock(&ctx->mConversionLock);
+    return buffer;
+}
+
+/** the n-th power of v */
+static uint64_t ipow(uint32_t v, int n)
+{
+    uint64_t p = 1;
+    while (n--)
+        p *= v;
+    return p;
+}
+
+/** the n-th root of v, rounded to the nearest integer */
+static uint32_t iroot(uint64_t v, int n)
+{
+    uint32_t lo = 0, hi = MAX_DIMENSION;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (ipow(mid, n) <= v)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    if (lo < MAX_DIMENSION && ipow(lo + 1, n) - v < v - ipow(lo, n))
+        lo++;
+    return lo;
+}
+
+/** whether the MDP can scale s into d in a single pass */
+static inline bool fits_scale(uint32_t s, uint32_t d)
+{
+    return d <= s * MAX_SCALE_FACTOR && s <= d * MAX_SCALE_FACTOR;
+}
+
+/*
+ * Size after pass k of n scaling s into d, from size prev after pass k-1:
+ * the ratios of the passes are equal, which spreads the filtering loss
+ * evenly between them, within what keeps d reachable in the passes left.
+ * Sizes are even when possible, as the MDP rounds odd ones.
+ */
+static uint32_t get_pass_size(uint32_t s, uint32_t d, uint32_t prev,
+                              int k, int n)
+{
+    const uint32_t left = ipow(MAX_SCALE_FACTOR, n - k);
+    const uint32_t lo = max((prev + MAX_SCALE_FACTOR - 1) / MAX_SCALE_FACTOR,
+                            (d + left - 1) / left);
+    const uint32_t hi = min(min(prev * MAX_SCALE_FACTOR, d * left),
+                            MAX_DIMENSION);
+    uint32_t size = iroot(ipow(s, n - k) * ipow(d, k), n);
+    size = min(max(size, lo), hi);
+    uint32_t even = size & ~1;
+    if (even < lo)
+        even += 2;
+    return (even && even <= hi) ? even : size;
+}
+
+/*
+ * Plan the passes of a stretch of src_rect into dst_rect: the fewest the
+ * MDP can do, each scaling within MAX_SCALE_FACTOR. The sizes of the
+ * intermediate images, before the transform, are returned in w and h.
+ *
+ * @return the number of passes, 0 if MAX_SCALE_PASSES are not enough
+ */
+static int plan_passes(struct copybit_context_t *ctx,
+                       struct copybit_rect_t const *dst_rect,
+                       struct copybit_rect_t const *src_rect,
+                       uint32_t w[MAX_SCALE_BUFFERS],
+                       uint32_t h[MAX_SCALE_BUFFERS])
+{
+    int sw = src_rect->r - src_rect->l;
+    int sh = src_rect->b - src_rect->t;
+    int dw = dst_rect->r - dst_rect->l;
+    int dh = dst_rect->b - dst_rect->t;
+    if (sw <= 0 || sh <= 0 || dw <= 0 || dh <= 0) {
+        // nothing is blitted
+        return 1;
+    }
+    if (ctx->mFlags & MDP_ROT_90) {
+        int tmp = dw;
+        dw = dh;
+        dh = tmp;
+    }
+
+    for (int n = 1; n <= MAX_SCALE_PASSES; n++) {
+        uint32_t pw = sw, ph = sh;
+        int k;
+        for (k = 1; k <= n; k++) {
+            uint32_t nw = dw, nh = dh;
+            if (k < n) {
+                nw = w[k - 1] = get_pass_size(sw, dw, pw, k, n);
+                nh = h[k - 1] = get_pass_size(sh, dh, ph, k, n);
+            }
+            if (!fits_scale(pw, nw) || !fits_scale(ph, nh))
+                break;
+            pw = nw;
+            ph = nh;
+        }
+        if (k > n)
+            return n;
+    }
+    return 0;
+}
+
+/** format of the intermediate images of the passes from src into dst */
+static int get_pass_format(int src_format, int dst_format)
+{
+    switch (src_format) {
+        // BGRA_8888 is read back as written, unlike RGBA_8888
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+        case HAL_PIXEL_FORMAT_RGBA_5551:
+        case HAL_PIXEL_FORMAT_RGBA_4444:
+            return HAL_PIXEL_FORMAT_BGRA_8888;
+    }
+    if (dst_format == HAL_PIXEL_FORMAT_RGB_565)
+        return HAL_PIXEL_FORMAT_RGB_565;
+    return HAL_PIXEL_FORMAT_RGB_888;
+}
+
+/*
+ * Get the intermediate buffer kept in slot, large enough for w x h in
+ * format. A buffer too small is replaced by one larger than both, so
+ * that layers of changing sizes soon stop reallocating. New BGRA_8888
+ * buffers are cleared, to be blended into.
+ */
+static private_handle_t* get_scale_buffer(struct copybit_context_t *ctx,
+                                          int slot, uint32_t w, uint32_t h,
+                                          int format)
+{
+    private_handle_t *buffer = ctx->mScaleBuffers[slot];
+    if (buffer && buffer->format == format &&
+        (uint32_t)buffer->width >= w && (uint32_t)buffer->height >= h) {
+        return buffer;
+    }
+
+    if (buffer) {
+        w = max(w, buffer->width);
+        h = max(h, buffer->height);
+        free_buffer(buffer);
+        ctx->mScaleBuffers[slot] = NULL;
+    }
+    w = min((w + SCALE_BUFFER_ALIGN - 1) & ~(SCALE_BUFFER_ALIGN - 1), MAX_DIMENSION);
+    h = min((h + SCALE_BUFFER_ALIGN - 1) & ~(SCALE_BUFFER_ALIGN - 1), MAX_DIMENSION);
+    int usage = GRALLOC_USAGE_PRIVATE_ADSP_HEAP | GRALLOC_USAGE_PRIVATE_MM_HEAP |
+                GRALLOC_USAGE_PRIVATE_UNCACHED;
+    if (0 != alloc_buffer(&buffer, w, h, format, usage)) {
+        LOGE("Error:unable to allocate memory for a %dx%d scaling pass", w, h);
+        return NULL;
+    }
+    if (format == HAL_PIXEL_FORMAT_BGRA_8888) {
+        memset((void *)buffer->base, 0, buffer->width * buffer->height * 4);
+    }
+    ctx->mScaleBuffers[slot] = buffer;
+    ctx->mScaleBufferClean[slot] = true;
+    return buffer;
+}
+
+/** whether two multi-pass stretches write the same intermediates */
+static bool same_scale_source(const scale_source_t& a, const scale_source_t& b)
+{
+    if (a.fd != b.fd || a.offset != b.offset || a.generation != b.generation ||
+        a.rect.l != b.rect.l || a.rect.t != b.rect.t ||
+        a.rect.r != b.rect.r || a.rect.b != b.rect.b ||
+        a.format != b.format || a.flags != b.flags || a.passes != b.passes)
+        return false;
+    for (int k = 0; k < a.passes - 1; k++) {
+        if (a.w[k] != b.w[k] || a.h[k] != b.h[k])
+            return false;
+    }
+    return true;
+}
+
+/** set the copybit image of an intermediate buffer */
+static void set_scale_image(struct copybit_image_t *img,
+                            private_handle_t *buffer, int format)
+{
+    img->w = buffer->width;
+    img->h = buffer->height;
+    img->format = format;
+    img->base = (void *)buffer->base;
+    img->handle = buffer;
+    img->horiz_padding = 0;
+    img->vert_padding = 0;
+}
+
+/*
+ * Stretch src_rect into dst_rect through the intermediate images planned
+ * by plan_passes(). The intermediates are drawn whole, with neither plane
+ * alpha, transform nor dithering: only the last pass applies them. The
+ * intermediate passes blend as premultiplied into cleared buffers, which
+ * copies the source as is. The intermediates of a source blitted again
+ * with the same generation are reused as they are.
+ */
+static int stretch_passes(struct copybit_context_t *ctx, int passes,
+                          uint32_t const w[MAX_SCALE_BUFFERS],
+                          uint32_t const h[MAX_SCALE_BUFFERS],
+                          private_handle_t const *hnd, uint32_t generation,
+                          struct copybit_image_t const *dst,
+                          struct copybit_image_t const *src,
+                          struct copybit_rect_t const *dst_rect,
+                          struct copybit_rect_t const *src_rect,
+                          struct copybit_region_t const *region)
+{
+    const int flags = ctx->mFlags;
+    const uint8_t alpha = ctx->mAlpha;
+    const int format = get_pass_format(src->format, dst->format);
+    struct copybit_image_t pass_src = *src;
+    struct copybit_rect_t pass_src_rect = *src_rect;
+    struct copybit_blit_list_t list;
+    int status = 0;
+
+    scale_source_t source;
+    memset(&source, 0, sizeof(source));
+    source.fd = hnd ? hnd->fd : -1;
+    source.offset = hnd ? hnd->offset : 0;
+    source.generation = hnd ? generation : 0;
+    source.rect = *src_rect;
+    source.format = format;
+    source.flags = (flags & ~(0x7 | MDP_DITHER)) | MDP_BLEND_FG_PREMULT;
+    source.passes = passes;
+    for (int k = 0; k < passes - 1; k++) {
+        source.w[k] = w[k];
+        source.h[k] = h[k];
+    }
+
+    pthread_mutex_lock(&ctx->mConversionLock);
+    bool kept = source.generation &&
+                same_scale_source(source, ctx->mScaleSource);
+    ctx->mScaleSource.generation = 0;
+    pthread_mutex_unlock(&ctx->mConversionLock);
+
+    if (kept) {
+        const int last = passes - 2;
+        set_scale_image(&pass_src, ctx->mScaleBuffers[last], format);
+        struct copybit_rect_t last_rect = { 0, 0, (int)w[last], (int)h[last] };
+        pass_src_rect = last_rect;
+    }
+
+    ctx->mFlags = source.flags;
+    ctx->mAlpha = MDP_ALPHA_NOP;
+    for (int k = 0; !kept && (status == 0) && k < passes - 1; k++) {
+        private_handle_t *buffer = get_scale_buffer(ctx, k, w[k], h[k], format);
+        if (!buffer) {
+            status = -ENOMEM;
+            break;
+        }
+        if (format == HAL_PIXEL_FORMAT_BGRA_8888 && !ctx->mScaleBufferClean[k]) {
+            // the source is blended, clear what the last stretch left
+            for (uint32_t y = 0; y < h[k]; y++)
+                memset((uint8_t *)buffer->base + y * buffer->width * 4, 0, w[k] * 4);
+        }
+        ctx->mScaleBufferClean[k] = false;
+
+        struct copybit_image_t pass_dst;
+        set_scale_image(&pass_dst, buffer, format);
+        struct copybit_rect_t pass_dst_rect = { 0, 0, (int)w[k], (int)h[k] };
+        copybit_iterator it(pass_dst_rect);
+
+        list.count = 0;
+        status = queue_blits(ctx, &list, &pass_dst, &pass_src, &pass_dst_rect,
+                             &pass_src_rect, &it);
+        if ((status == 0) && list.count) {
+            status = msm_copybit(ctx, &list);
+        }
+        pass_src = pass_dst;
+        pass_src_rect = pass_dst_rect;
+    }
+    ctx->mFlags = flags;
+    ctx->mAlpha = alpha;
+
+    if (status == 0) {
+        pthread_mutex_lock(&ctx->mConversionLock);
+        ctx->mScaleSource = source;
+        pthread_mutex_unlock(&ctx->mConversionLock);
+
+        list.count = 0;
+        status = queue_blits(ctx, &list, dst, &pass_src, dst_rect,
+                             &pass_src_rect, region);
+        if ((status == 0) && list.count) {
+            status = msm_copybit(ctx, &list);
+        }
+    }
+    return status;
+}
+
 /** do a stretch blit type operation */
 static int stretch_copybit(
         struct copybit_device_t *dev,
@@ -368,105 +873,105 @@ static int stretch_copybit(
 {
     struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
     int status = 0;
-    private_handle_t *yv12_handle = NULL;
     if (ctx) {
-        struct {
-            uint32_t count;
-            struct mdp_blit_req req[12];
-        } list;
-
-        if (ctx->mAlpha < 255) {
-            switch (src->format) {
-                // we don't support plane alpha with RGBA formats
-                case HAL_PIXEL_FORMAT_RGBA_8888:
-                case HAL_PIXEL_FORMAT_BGRA_8888:
-                case HAL_PIXEL_FORMAT_RGBA_5551:
-                case HAL_PIXEL_FORMAT_RGBA_4444:
-                    return -EINVAL;
-            }
-        }
+        struct copybit_blit_list_t list;
 
-        if (src_rect->l < 0 || src_rect->r > src->w ||
-            src_rect->t < 0 || src_rect->b > src->h) {
-            // this is always invalid
-            return -EINVAL;
+        status = check_stretch(ctx, dst, src, src_rect);
+        if (status) {
+            ctx->mGeneration = 0;
+            return status;
         }
 
-        if (src->w > MAX_DIMENSION || src->h > MAX_DIMENSION)
-            return -EINVAL;
-
-        if (dst->w > MAX_DIMENSION || dst->h > MAX_DIMENSION)
+        uint32_t w[MAX_SCALE_BUFFERS], h[MAX_SCALE_BUFFERS];
+        int passes = plan_passes(ctx, dst_rect, src_rect, w, h);
+        if (!passes) {
+            ctx->mGeneration = 0;
             return -EINVAL;
+        }
+        private_handle_t const *hnd = (private_handle_t const *)src->handle;
+        const uint32_t generation = ctx->mGeneration;
 
         if(src->format ==  HAL_PIXEL_FORMAT_YV12) {
-            int usage = GRALLOC_USAGE_PRIVATE_ADSP_HEAP | GRALLOC_USAGE_PRIVATE_MM_HEAP;
-            if (0 == alloc_buffer(&yv12_handle,src->w,src->h,src->format, usage)){
-                 if(0 == convertYV12toYCrCb420SP(src,yv12_handle)){
-                       (const_cast<copybit_image_t *>(src))->format = HAL_PIXEL_FORMAT_YCrCb_420_SP;
-                       (const_cast<copybit_image_t *>(src))->handle = yv12_handle;
-                       (const_cast<copybit_image_t *>(src))->base = (void *)yv12_handle->base;
-                 }
-                 else{
-                    LOGE("Error copybit conversion from yv12 failed");
-                    if(yv12_handle)
-                       free_buffer(yv12_handle);
-                    return -EINVAL;
-                 }
-           }
-           else{
-              LOGE("Error:unable to allocate memeory for yv12 software conversion");
-              return -EINVAL;
-           }
+            private_handle_t *yv12_handle = get_yv12_conversion(ctx, src);
+            if (!yv12_handle) {
+                ctx->mGeneration = 0;
+                return -EINVAL;
+            }
+            (const_cast<copybit_image_t *>(src))->format = HAL_PIXEL_FORMAT_YCrCb_420_SP;
+            (const_cast<copybit_image_t *>(src))->handle = yv12_handle;
+            (const_cast<copybit_image_t *>(src))->base = (void *)yv12_handle->base;
+        }
+        ctx->mGeneration = 0;
+        if (passes > 1) {
+            return stretch_passes(ctx, passes, w, h, hnd, generation, dst,
+                                  src, dst_rect, src_rect, region);
         }
-        const uint32_t maxCount = sizeof(list.req)/sizeof(list.req[0]);
-        const struct copybit_rect_t bounds = { 0, 0, dst->w, dst->h };
-        struct copybit_rect_t clip;
         list.count = 0;
-        status = 0;
-        while ((status == 0) && region->next(region, &clip)) {
-            intersect(&clip, &bounds, &clip);
-            mdp_blit_req* req = &list.req[list.count];
-            int flags = 0;
-
-            private_handle_t* src_hnd = (private_handle_t*)src->handle;
-            if(src_hnd != NULL && src_hnd->flags & private_handle_t::PRIV_FLAGS_DO_NOT_FLUSH) {
-                flags |=  MDP_BLIT_NON_CACHED;
-            }
- 
-            set_infos(ctx, req, flags);
-            set_image(&req->dst, dst);
-            set_image(&req->src, src);
-//#CORVUS - Parche https://github.com/mozilla-b2g/gonk-patches/commit/5dda2b19ffe5517cf5730971a3cdfc489ca5bff3
-            if (req->src.format == MDP_RGBA_8888) {
-                req->src.format = MDP_BGRA_8888;
-            }
-            else if (req->src.format == MDP_RGBX_8888) {
-                req->src.format = MDP_XRGB_8888;
-            }
+        status = queue_blits(ctx, &list, dst, src, dst_rect, src_rect, region);
+        if ((status == 0) && list.count) {
+            status = msm_copybit(ctx, &list);
+        }
+    } else {
+        status = -EINVAL;
+    }
+    return status;
+}
 
-//#Fin parche
-            set_rects(ctx, req, dst_rect, src_rect, &clip, src->horiz_padding, src->vert_padding);
+/** compose a list of layers, sharing the blit lists between them */
+static int compose_copybit(
+        struct copybit_device_t *dev,
+        struct copybit_image_t const *dst,
+        struct copybit_layer_t const *layers,
+        int count)
+{
+    struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
+    if (!ctx || !dst || (count && !layers))
+        return -EINVAL;
 
-            if (req->src_rect.w<=0 || req->src_rect.h<=0)
-                continue;
+    struct copybit_blit_list_t list;
+    list.count = 0;
+    int status = 0;
+    int composed = 0;
+    for (; (status == 0) && composed < count; composed++) {
+        const copybit_layer_t& layer = layers[composed];
+        set_parameter_copybit(dev, COPYBIT_PLANE_ALPHA, layer.plane_alpha);
+        set_parameter_copybit(dev, COPYBIT_TRANSFORM, layer.transform);
+        set_parameter_copybit(dev, COPYBIT_PREMULTIPLIED_ALPHA,
+                              layer.premultiplied);
 
-            if (req->dst_rect.w<=0 || req->dst_rect.h<=0)
-                continue;
+        // Stop at a layer the MDP cannot blit, as a failed stretch()
+        if (check_stretch(ctx, dst, layer.src, &layer.src_rect))
+            break;
 
-            if (++list.count == maxCount) {
+        uint32_t w[MAX_SCALE_BUFFERS], h[MAX_SCALE_BUFFERS];
+        int passes = plan_passes(ctx, &layer.dst_rect, &layer.src_rect, w, h);
+        if (!passes)
+            break;
+
+        if (layer.src->format == HAL_PIXEL_FORMAT_YV12 || passes > 1) {
+            // The conversion and intermediate buffers may be reused by a
+            // later layer, submit what is queued and go the long way.
+            if (list.count) {
                 status = msm_copybit(ctx, &list);
                 list.count = 0;
             }
+            if (status)
+                break;
+            copybit_image_t src = *layer.src;
+            ctx->mGeneration = ctx->mReleaseHooked ? layer.generation : 0;
+            if (stretch_copybit(dev, dst, &src, &layer.dst_rect,
+                                &layer.src_rect, layer.region))
+                break;
+            continue;
         }
-        if ((status == 0) && list.count) {
-            status = msm_copybit(ctx, &list);
-        }
-    } else {
-        status = -EINVAL;
+
+        status = queue_blits(ctx, &list, dst, layer.src, &layer.dst_rect,
+                             &layer.src_rect, layer.region);
     }
-    if(yv12_handle)
-      free_buffer(yv12_handle);
-    return status;
+    if ((status == 0) && list.count) {
+        status = msm_copybit(ctx, &list);
+    }
+    return status ? status : composed;
 }
 
 /** Perform a blit type operation */
@@ -488,6 +993,16 @@ static int close_copybit(struct hw_device_t *dev)
 {
     struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
     if (ctx) {
+        removeBufferReleaseHook(on_buffer_release, ctx);
+        for (int i = 0; i < MAX_YV12_CONVERSIONS; i++) {
+            if (ctx->mConversions[i].buffer)
+                free_buffer(ctx->mConversions[i].buffer);
+        }
+        for (int i = 0; i < MAX_SCALE_BUFFERS; i++) {
+            if (ctx->mScaleBuffers[i])
+                free_buffer(ctx->mScaleBuffers[i]);
+        }
+        pthread_mutex_destroy(&ctx->mConversionLock);
         close(ctx->mFD);
         free(ctx);
     }
@@ -511,8 +1026,16 @@ static int open_copybit(const struct hw_module_t* module, const char* name,
     ctx->device.get = get;
     ctx->device.blit = blit_copybit;
     ctx->device.stretch = stretch_copybit;
+    ctx->device.compose = compose_copybit;
     ctx->mAlpha = MDP_ALPHA_NOP;
     ctx->mFlags = 0;
+    ctx->mGeneration = 0;
+    pthread_mutex_init(&ctx->mConversionLock, NULL);
+    // A kept conversion or intermediate could otherwise be reused for the
+    // next buffer allocated at the same place, convert and scale each blit
+    ctx->mReleaseHooked = (addBufferReleaseHook(on_buffer_release, ctx) == 0);
+    LOGE_IF(!ctx->mReleaseHooked, "%s: no buffer release hook, converted "
+            "sources not kept", __FUNCTION__);
     ctx->mFD = open("/dev/graphics/fb0", O_RDWR, 0);
     
     if (ctx->mFD < 0) {
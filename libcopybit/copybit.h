@@ -30,6 +30,12 @@ __BEGIN_DECLS
  */
 #define COPYBIT_HARDWARE_MODULE_ID "copybit"
 
+/**
+ * The id of the module blitting on the CPU, for the layers the hardware
+ * module cannot blit
+ */
+#define COPYBIT_SW_HARDWARE_MODULE_ID "copybit_sw"
+
 /**
  * Name of the graphics device to open
  */
@@ -70,6 +76,13 @@ enum {
     COPYBIT_FRAMEBUFFER_WIDTH = 7,
     /* FB height */
     COPYBIT_FRAMEBUFFER_HEIGHT = 8,
+    /* Let the operations return before the hardware is done with them,
+     * see copybit_device_t::finish() */
+    COPYBIT_ASYNC_COMPLETION = 9,
+    /* Identity of the content of the source of the next blit: a source
+     * blitted again with the same handle and generation is unchanged.
+     * 0, the default, if unknown */
+    COPYBIT_SOURCE_GENERATION = 10,
 };
 
 /* values for copybit_set_parameter(COPYBIT_TRANSFORM) */
@@ -139,6 +152,26 @@ struct copybit_region_t {
     int (*next)(struct copybit_region_t const *region, struct copybit_rect_t *rect);
 };
 
+/* Layer of a composition, see copybit_device_t::compose() */
+struct copybit_layer_t {
+    /* source image */
+    struct copybit_image_t const *src;
+    /* source rectangle */
+    struct copybit_rect_t src_rect;
+    /* destination rectangle */
+    struct copybit_rect_t dst_rect;
+    /* the clip region */
+    struct copybit_region_t const *region;
+    /* plane alpha value (0 to 255), negative to copy without blending */
+    int plane_alpha;
+    /* transformation applied, COPYBIT_TRANSFORM_xxx */
+    int transform;
+    /* COPYBIT_ENABLE if the source contains premultiplied alpha */
+    int premultiplied;
+    /* identity of the content of src, see COPYBIT_SOURCE_GENERATION */
+    uint32_t generation;
+};
+
 /**
  * Every hardware module must have a data structure named HAL_MODULE_INFO_SYM
  * and the fields of this data structure must begin with hw_module_t
@@ -209,6 +242,60 @@ struct copybit_device_t {
                    struct copybit_rect_t const *dst_rect,
                    struct copybit_rect_t const *src_rect,
                    struct copybit_region_t const *region);
+
+    /**
+     * Fill a rectangle of the destination with a constant color,
+     * blended with the destination using the alpha of the color.
+     * Fully opaque and fully transparent colors are written as is,
+     * the latter clearing the rectangle.
+     * Optional, NULL if the engine cannot fill.
+     *
+     * @param dev from open
+     * @param dst is the destination image
+     * @param rect is the destination rectangle
+     * @param color is a RGBA_8888 pixel value (0xAABBGGRR)
+     *
+     * @return 0 if successful
+     */
+    int (*fill_color)(struct copybit_device_t *dev,
+                      struct copybit_image_t const *dst,
+                      struct copybit_rect_t const *rect,
+                      uint32_t color);
+
+    /**
+     * Compose a list of layers into the destination, in order, with as
+     * few hardware submissions as possible and a single wait for their
+     * completion. Each layer is drawn as by stretch() with its own
+     * plane alpha, transform and premultiplied alpha parameters, which
+     * are left undefined for later calls to stretch().
+     * Optional, NULL if the engine cannot batch.
+     *
+     * @param dev from open
+     * @param dst is the destination image
+     * @param layers is the list of layers, from bottom to top
+     * @param count is the number of layers
+     *
+     * @return the number of layers composed, or a negative error if the
+     * composition failed. When lower than count, the layer at that index
+     * was rejected, as a failed stretch() of it would be, and the layers
+     * above it are left for another call.
+     */
+    int (*compose)(struct copybit_device_t *dev,
+                   struct copybit_image_t const *dst,
+                   struct copybit_layer_t const *layers,
+                   int count);
+
+    /**
+     * Wait for the hardware to be done with the operations issued so far.
+     * With COPYBIT_ASYNC_COMPLETION enabled, the source and destination
+     * buffers must not be written, read or released before this returns.
+     * Optional, NULL if the operations always complete synchronously.
+     *
+     * @param dev from open
+     *
+     * @return 0 if successful
+     */
+    int (*finish)(struct copybit_device_t *dev);
 };
 
 
@@ -18,8 +18,10 @@
 #define LOG_TAG "copybit_c2d"
 
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -96,6 +98,23 @@ C2D_STATUS (*LINK_c2dUnMapAddr) ( void * gpuaddr);
 
 #define NUM_SURFACES 3
 
+/* number of sources compose() keeps in flight per surface type */
+#define MAX_COMPOSE_SOURCES 8
+
+/* C2D surfaces kept per surface type, and their default number */
+#define MAX_CACHED_SURFACES 8
+#define DEFAULT_RGB_SURFACES 4
+#define DEFAULT_YUV_SURFACES 2
+
+/* temp. stride conversion buffers kept per direction, and per size class */
+#define MAX_TEMP_BUFFERS 4
+#define TEMP_BUFFERS_PER_CLASS 2
+#define TEMP_BUFFER_SIZE_CLASS (64 * 1024)
+
+/* GPU mappings kept across blits, and their default size budget */
+#define MAX_GPU_MAPPINGS 64
+#define DEFAULT_GPU_MAP_BUDGET_MB 64
+
 enum {
     RGB_SURFACE,
     YUV_SURFACE_2_PLANES,
@@ -115,19 +134,55 @@ enum eC2DFlags {
 static android::sp<gralloc::IAllocController> sAlloc = 0;
 /******************************************************************************/
 
+/** C2D surface and the image it was last updated with */
+struct c2d_surface_t {
+    unsigned int id;
+    bool valid;
+    uint32 gpuaddr;
+    int base;
+    uint32_t width;
+    uint32_t height;
+    int format;
+    int flags;
+    uint32_t lastUse;
+};
+
+/** C2D surfaces of a surface type, least recently used one updated first */
+struct surface_cache_t {
+    uint32 index;
+    int size;
+    uint32_t clock;
+    c2d_surface_t surfaces[MAX_CACHED_SURFACES];
+};
+
+/** Temp. stride conversion buffers of a direction, reused across blits */
+struct temp_buffer_pool_t {
+    alloc_data buffers[MAX_TEMP_BUFFERS];
+    uint32_t lastUse[MAX_TEMP_BUFFERS];
+    uint32_t clock;
+};
+
 /** State information for each device instance */
 struct copybit_context_t {
     struct copybit_device_t device;
     unsigned int src[NUM_SURFACES];  /* src surfaces */
     unsigned int dst[NUM_SURFACES];  /* dst surfaces */
+    /* surfaces of stretch() and fill_color(), starting with src and dst */
+    surface_cache_t srcCache[NUM_SURFACES];
+    surface_cache_t dstCache[NUM_SURFACES];
+    /* src surfaces of compose(), created on first use */
+    unsigned int compose_src[NUM_SURFACES][MAX_COMPOSE_SOURCES];
     unsigned int trg_transform;      /* target transform */
     C2D_OBJECT blitState;
     void *libc2d2;
-    alloc_data temp_src_buffer;
-    alloc_data temp_dst_buffer;
+    temp_buffer_pool_t tempSrcPool;
+    temp_buffer_pool_t tempDstPool;
     int fb_width;
     int fb_height;
     bool isPremultipliedAlpha;
+    bool asyncCompletion;            /* blits return once flushed */
+    bool isTimestampPending;         /* blits flushed and not waited for */
+    c2d_ts_handle timestamp;         /* of the last flush */
 };
 
 struct blitlist{
@@ -255,6 +310,22 @@ int c2diGetBpp(int32 colorformat)
     return c2dBpp;
 }
 
+static int get_memtype(const struct private_handle_t *handle, uint32 *memtype)
+{
+    if (handle->flags & (private_handle_t::PRIV_FLAGS_USES_PMEM |
+                private_handle_t::PRIV_FLAGS_USES_PMEM_ADSP))
+        *memtype = KGSL_USER_MEM_TYPE_PMEM;
+    else if (handle->flags & private_handle_t::PRIV_FLAGS_USES_ASHMEM)
+        *memtype = KGSL_USER_MEM_TYPE_ASHMEM;
+    else if (handle->flags & private_handle_t::PRIV_FLAGS_USES_ION)
+        *memtype = KGSL_USER_MEM_TYPE_ION;
+    else {
+        LOGE("Invalid handle flags: 0x%x", handle->flags);
+        return COPYBIT_FAILURE;
+    }
+    return COPYBIT_SUCCESS;
+}
+
 static uint32 c2d_get_gpuaddr( struct private_handle_t *handle)
 {
     uint32 memtype, *gpuaddr;
@@ -263,17 +334,8 @@ static uint32 c2d_get_gpuaddr( struct private_handle_t *handle)
     if(!handle)
         return 0;
 
-    if (handle->flags & (private_handle_t::PRIV_FLAGS_USES_PMEM |
-                private_handle_t::PRIV_FLAGS_USES_PMEM_ADSP))
-        memtype = KGSL_USER_MEM_TYPE_PMEM;
-    else if (handle->flags & private_handle_t::PRIV_FLAGS_USES_ASHMEM)
-        memtype = KGSL_USER_MEM_TYPE_ASHMEM;
-    else if (handle->flags & private_handle_t::PRIV_FLAGS_USES_ION)
-        memtype = KGSL_USER_MEM_TYPE_ION;
-    else {
-        LOGE("Invalid handle flags: 0x%x", handle->flags);
+    if (get_memtype(handle, &memtype))
         return 0;
-    }
 
      rc = LINK_c2dMapAddr(handle->fd, (void*)handle->base, handle->size, handle->offset, memtype, (void**)&gpuaddr);
     if (rc == C2D_STATUS_OK) {
@@ -282,6 +344,226 @@ static uint32 c2d_get_gpuaddr( struct private_handle_t *handle)
     return 0;
 }
 
+/*
+ * Process wide cache of the GPU mappings of the blitted buffers, so that
+ * the framebuffer and the recurring app buffers stay mapped across blits.
+ * The least recently used mappings are dropped beyond the size budget,
+ * and gralloc drops the mappings of a buffer before freeing it.
+ */
+struct gpu_mapping_t {
+    int fd;
+    int offset;
+    int size;
+    uint32 memtype;
+    uint32 gpuaddr;
+    int refs;          // blits using the mapping
+    bool stale;        // buffer released while in use
+    bool busy;         // flushed blits may still access the buffer
+    c2d_ts_handle timestamp;   // of the last of these blits
+    uint32_t lastUse;
+};
+
+static pthread_mutex_t sGpuMapLock = PTHREAD_MUTEX_INITIALIZER;
+static gpu_mapping_t sGpuMaps[MAX_GPU_MAPPINGS];
+static int sNumGpuMaps = 0;
+static size_t sGpuMapBytes = 0;
+static size_t sGpuMapBudget = 0;
+static uint32_t sGpuMapClock = 0;
+static int sGpuMapUsers = 0;
+
+/* wait for the blits accessing a mapped buffer, with sGpuMapLock held */
+static void wait_gpu_mapping(gpu_mapping_t& map)
+{
+    if (map.busy) {
+        if (LINK_c2dWaitTimestamp(map.timestamp)) {
+            LOGE("%s: LINK_c2dWaitTimestamp ERROR", __FUNCTION__);
+        }
+        map.busy = false;
+    }
+}
+
+/* unmap and remove a mapping, with sGpuMapLock held */
+static void remove_gpu_mapping(int index)
+{
+    wait_gpu_mapping(sGpuMaps[index]);
+    LINK_c2dUnMapAddr((void*)sGpuMaps[index].gpuaddr);
+    sGpuMapBytes -= sGpuMaps[index].size;
+    sGpuMaps[index] = sGpuMaps[--sNumGpuMaps];
+}
+
+/* drop unused mappings, LRU first, until size more bytes fit */
+static void trim_gpu_mappings(size_t size)
+{
+    while (sNumGpuMaps == MAX_GPU_MAPPINGS ||
+           (sNumGpuMaps && sGpuMapBytes + size > sGpuMapBudget)) {
+        int lru = -1;
+        for (int i = 0; i < sNumGpuMaps; i++) {
+            if (sGpuMaps[i].refs)
+                continue;
+            if (lru < 0 || sGpuMaps[i].lastUse < sGpuMaps[lru].lastUse)
+                lru = i;
+        }
+        if (lru < 0)
+            break;
+        remove_gpu_mapping(lru);
+    }
+}
+
+/* get the GPU address of the buffer, mapping it if it is not cached */
+static uint32 acquire_gpuaddr(struct private_handle_t *handle)
+{
+    uint32 memtype;
+    if (!handle || get_memtype(handle, &memtype))
+        return 0;
+
+    pthread_mutex_lock(&sGpuMapLock);
+    for (int i = 0; i < sNumGpuMaps; i++) {
+        gpu_mapping_t& map = sGpuMaps[i];
+        if (!map.stale && map.fd == handle->fd &&
+            map.offset == handle->offset && map.size == handle->size &&
+            map.memtype == memtype) {
+            map.refs++;
+            map.lastUse = ++sGpuMapClock;
+            pthread_mutex_unlock(&sGpuMapLock);
+            return map.gpuaddr;
+        }
+    }
+
+    uint32 gpuaddr = c2d_get_gpuaddr(handle);
+    if (gpuaddr) {
+        trim_gpu_mappings(handle->size);
+        // Mappings that do not fit are released after the blit
+        if (sGpuMapBudget && sNumGpuMaps < MAX_GPU_MAPPINGS) {
+            gpu_mapping_t& map = sGpuMaps[sNumGpuMaps++];
+            map.fd = handle->fd;
+            map.offset = handle->offset;
+            map.size = handle->size;
+            map.memtype = memtype;
+            map.gpuaddr = gpuaddr;
+            map.refs = 1;
+            map.stale = false;
+            map.busy = false;
+            map.lastUse = ++sGpuMapClock;
+            sGpuMapBytes += handle->size;
+        }
+    }
+    pthread_mutex_unlock(&sGpuMapLock);
+    return gpuaddr;
+}
+
+/* done with the GPU address of a blit */
+static void release_gpuaddr(uint32 gpuaddr)
+{
+    pthread_mutex_lock(&sGpuMapLock);
+    int index = -1;
+    for (int i = 0; i < sNumGpuMaps; i++) {
+        if (sGpuMaps[i].gpuaddr == gpuaddr) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0) {
+        LINK_c2dUnMapAddr((void*)gpuaddr);
+    } else if ((--sGpuMaps[index].refs == 0) && sGpuMaps[index].stale) {
+        remove_gpu_mapping(index);
+    }
+    pthread_mutex_unlock(&sGpuMapLock);
+}
+
+/* the flushed blits with this timestamp access the mapped buffer */
+static void set_gpuaddr_timestamp(uint32 gpuaddr, c2d_ts_handle timestamp)
+{
+    pthread_mutex_lock(&sGpuMapLock);
+    for (int i = 0; i < sNumGpuMaps; i++) {
+        if (sGpuMaps[i].gpuaddr == gpuaddr) {
+            sGpuMaps[i].timestamp = timestamp;
+            sGpuMaps[i].busy = true;
+            pthread_mutex_unlock(&sGpuMapLock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&sGpuMapLock);
+
+    // Mappings that did not fit in the cache are gone after the blit
+    if (LINK_c2dWaitTimestamp(timestamp)) {
+        LOGE("%s: LINK_c2dWaitTimestamp ERROR", __FUNCTION__);
+    }
+}
+
+/* wait for the blits accessing a buffer before the CPU writes it */
+static void wait_gpu_mappings(int fd, int offset, int size)
+{
+    pthread_mutex_lock(&sGpuMapLock);
+    for (int i = 0; i < sNumGpuMaps; i++) {
+        gpu_mapping_t& map = sGpuMaps[i];
+        if (map.fd == fd && map.offset == offset && map.size == size)
+            wait_gpu_mapping(map);
+    }
+    pthread_mutex_unlock(&sGpuMapLock);
+}
+
+/* drop the mappings of a buffer about to be freed */
+static void invalidate_gpu_mappings(int fd, int offset, int size)
+{
+    pthread_mutex_lock(&sGpuMapLock);
+    for (int i = sNumGpuMaps - 1; i >= 0; i--) {
+        gpu_mapping_t& map = sGpuMaps[i];
+        if (map.fd != fd || map.offset != offset || map.size != size)
+            continue;
+        if (map.refs)
+            map.stale = true;
+        else
+            remove_gpu_mapping(i);
+    }
+    pthread_mutex_unlock(&sGpuMapLock);
+}
+
+static void on_buffer_release(void *data, const private_handle_t *hnd)
+{
+    invalidate_gpu_mappings(hnd->fd, hnd->offset, hnd->size);
+}
+
+/* start using the mapping cache, for each opened device */
+static void init_gpu_mappings()
+{
+    pthread_mutex_lock(&sGpuMapLock);
+    bool first = (sGpuMapUsers++ == 0);
+    if (first) {
+        char property[PROPERTY_VALUE_MAX];
+        int budget = DEFAULT_GPU_MAP_BUDGET_MB;
+        if (property_get("debug.copybit.gpumap_budget", property, NULL) > 0)
+            budget = atoi(property);
+        sGpuMapBudget = (size_t)((budget > 0) ? budget : 0) << 20;
+    }
+    pthread_mutex_unlock(&sGpuMapLock);
+
+    // A mapping kept past the release of its buffer would be used by the
+    // next buffer allocated at the same place, map each blit instead
+    if (first && addBufferReleaseHook(on_buffer_release, NULL)) {
+        LOGE("%s: no buffer release hook, GPU mappings not cached",
+             __FUNCTION__);
+        pthread_mutex_lock(&sGpuMapLock);
+        sGpuMapBudget = 0;
+        pthread_mutex_unlock(&sGpuMapLock);
+    }
+}
+
+/* unmap everything once the last device is closed */
+static void deinit_gpu_mappings()
+{
+    pthread_mutex_lock(&sGpuMapLock);
+    bool last = (--sGpuMapUsers == 0);
+    pthread_mutex_unlock(&sGpuMapLock);
+    if (!last)
+        return;
+
+    removeBufferReleaseHook(on_buffer_release, NULL);
+    pthread_mutex_lock(&sGpuMapLock);
+    while (sNumGpuMaps)
+        remove_gpu_mapping(sNumGpuMaps - 1);
+    pthread_mutex_unlock(&sGpuMapLock);
+}
+
 static int is_supported_rgb_format(int format)
 {
     switch(format) {
@@ -407,9 +689,9 @@ static int set_image( uint32 surfaceId, const struct copybit_image_t *rhs,
     }
 
     if (handle->gpuaddr == 0) {
-       handle->gpuaddr = c2d_get_gpuaddr(handle);
+       handle->gpuaddr = acquire_gpuaddr(handle);
        if(!handle->gpuaddr) {
-           LOGE("%s: c2d_get_gpuaddr failed", __FUNCTION__);
+           LOGE("%s: acquire_gpuaddr failed", __FUNCTION__);
            return COPYBIT_FAILURE;
        }
        *mapped = 1;
@@ -486,7 +768,7 @@ static int set_image( uint32 surfaceId, const struct copybit_image_t *rhs,
 
 error:
     if(*mapped == 1) {
-        LINK_c2dUnMapAddr( (void*) handle->gpuaddr);
+        release_gpuaddr(handle->gpuaddr);
         handle->gpuaddr = 0;
         *mapped = 0;
     }
@@ -591,10 +873,211 @@ void unset_image( uint32 surfaceId, const struct copybit_image_t *rhs,
     struct private_handle_t* handle = (struct private_handle_t*)rhs->handle;
 
     if (mmapped && handle->gpuaddr) {
-        // Unmap this gpuaddr
-        LINK_c2dUnMapAddr( (void*) handle->gpuaddr);
+        // Release this gpuaddr, it stays mapped in the cache
+        release_gpuaddr(handle->gpuaddr);
+        handle->gpuaddr = 0;
+    }
+}
+
+/* submit the blits drawn into target, waiting for them unless async */
+static void submit_blits(struct copybit_context_t *ctx, uint32 target, bool wait)
+{
+    if (wait || !ctx->asyncCompletion) {
+        if (LINK_c2dFinish(target)) {
+            LOGE("%s: LINK_c2dFinish ERROR", __FUNCTION__);
+        }
+        ctx->isTimestampPending = false;
+        return;
+    }
+
+    if (LINK_c2dFlush(target, &ctx->timestamp)) {
+        LOGE("%s: LINK_c2dFlush ERROR", __FUNCTION__);
+        if (LINK_c2dFinish(target)) {
+            LOGE("%s: LINK_c2dFinish ERROR", __FUNCTION__);
+        }
+        ctx->isTimestampPending = false;
+        return;
+    }
+    ctx->isTimestampPending = true;
+}
+
+/* unset an image of the submitted blits, remembering they may be pending */
+static void release_image(struct copybit_context_t *ctx, uint32 surfaceId,
+                          const struct copybit_image_t *rhs, uint32 mmapped)
+{
+    struct private_handle_t* handle = (struct private_handle_t*)rhs->handle;
+    if (ctx->isTimestampPending && handle->gpuaddr) {
+        set_gpuaddr_timestamp(handle->gpuaddr, ctx->timestamp);
+    }
+    unset_image(surfaceId, rhs, mmapped);
+}
+
+/** get the index of the C2D surface used for a source format */
+static int get_src_surface_index(int format, uint32 *index)
+{
+    if (is_supported_rgb_format(format) == COPYBIT_SUCCESS) {
+        *index = RGB_SURFACE;
+    } else if (is_supported_yuv_format(format) == COPYBIT_SUCCESS) {
+        int num_planes = get_num_planes(format);
+        if (num_planes == 2) {
+            *index = YUV_SURFACE_2_PLANES;
+        } else if (num_planes == 3) {
+            *index = YUV_SURFACE_3_PLANES;
+        } else {
+            return -EINVAL;
+        }
+    } else {
+        return -EINVAL;
+    }
+    return COPYBIT_SUCCESS;
+}
+
+/** create a placeholder C2D surface, updated by set_image before use */
+static int create_dummy_surface(uint32 index, unsigned int *surfaceId)
+{
+    C2D_STATUS status;
+    if (index == RGB_SURFACE) {
+        C2D_RGB_SURFACE_DEF surfDefinition = {0};
+        surfDefinition.buffer = (void*)0xdddddddd;
+        surfDefinition.phys = (void*)0xdddddddd;
+        surfDefinition.stride = 1 * 4;
+        surfDefinition.width = 1;
+        surfDefinition.height = 1;
+        surfDefinition.format = C2D_COLOR_FORMAT_8888_ARGB;
+        status = LINK_c2dCreateSurface(surfaceId, C2D_TARGET | C2D_SOURCE,
+                         (C2D_SURFACE_TYPE)(C2D_SURFACE_RGB_HOST |
+                         C2D_SURFACE_WITH_PHYS | C2D_SURFACE_WITH_PHYS_DUMMY),
+                         &surfDefinition);
+    } else {
+        C2D_YUV_SURFACE_DEF yuvSurfaceDef = {0};
+        yuvSurfaceDef.format = C2D_COLOR_FORMAT_420_NV12;
+        yuvSurfaceDef.width = 4;
+        yuvSurfaceDef.height = 4;
+        yuvSurfaceDef.plane0 = (void*)0xaaaaaaaa;
+        yuvSurfaceDef.phys0 = (void*) 0xaaaaaaaa;
+        yuvSurfaceDef.stride0 = 4;
+        yuvSurfaceDef.plane1 = (void*)0xaaaaaaaa;
+        yuvSurfaceDef.phys1 = (void*) 0xaaaaaaaa;
+        yuvSurfaceDef.stride1 = 4;
+        if (index == YUV_SURFACE_3_PLANES) {
+            yuvSurfaceDef.format = C2D_COLOR_FORMAT_420_YV12;
+            yuvSurfaceDef.plane2 = (void*)0xaaaaaaaa;
+            yuvSurfaceDef.phys2 = (void*) 0xaaaaaaaa;
+            yuvSurfaceDef.stride2 = 4;
+        }
+        status = LINK_c2dCreateSurface(surfaceId, C2D_TARGET | C2D_SOURCE,
+                         (C2D_SURFACE_TYPE)(C2D_SURFACE_YUV_HOST |
+                         C2D_SURFACE_WITH_PHYS | C2D_SURFACE_WITH_PHYS_DUMMY),
+                         &yuvSurfaceDef);
+    }
+    if (status) {
+        LOGE("%s: LINK_c2dCreateSurface error index=%d", __FUNCTION__, index);
+        *surfaceId = -1;
+        return COPYBIT_FAILURE;
+    }
+    return COPYBIT_SUCCESS;
+}
+
+/** set up a surface cache, around the surface created at open */
+static void init_surface_cache(surface_cache_t& cache, uint32 index,
+                               unsigned int surfaceId, int size)
+{
+    memset(&cache, 0, sizeof(cache));
+    cache.index = index;
+    cache.size = (size < 1) ? 1 :
+                 ((size > MAX_CACHED_SURFACES) ? MAX_CACHED_SURFACES : size);
+    for (int i = 0; i < MAX_CACHED_SURFACES; i++)
+        cache.surfaces[i].id = -1;
+    cache.surfaces[0].id = surfaceId;
+}
+
+/** destroy the surfaces the cache created */
+static void deinit_surface_cache(surface_cache_t& cache)
+{
+    for (int i = 1; i < MAX_CACHED_SURFACES; i++) {
+        if (cache.surfaces[i].id != (unsigned int)-1) {
+            LINK_c2dDestroySurface(cache.surfaces[i].id);
+            cache.surfaces[i].id = -1;
+        }
+    }
+}
+
+/*
+ * Get a surface of the cache set up for the image. A surface last updated
+ * with the same image is used as is, without a c2dUpdateSurface call,
+ * otherwise the least recently used one is updated. The stride and plane
+ * offsets follow from the size and format, so the key leaves them out.
+ */
+static int set_cached_image(surface_cache_t& cache,
+                            const struct copybit_image_t *rhs, int *cformat,
+                            uint32 *mapped, const eC2DFlags flags,
+                            uint32 *surfaceId)
+{
+    struct private_handle_t* handle = (struct private_handle_t*)rhs->handle;
+    if(handle == NULL) {
+        LOGE("%s: invalid handle", __func__);
+        return -EINVAL;
+    }
+
+    if (handle->gpuaddr == 0) {
+       handle->gpuaddr = acquire_gpuaddr(handle);
+       if(!handle->gpuaddr) {
+           LOGE("%s: acquire_gpuaddr failed", __FUNCTION__);
+           return COPYBIT_FAILURE;
+       }
+       *mapped = 1;
+    }
+
+    int lru = 0;
+    for (int i = 0; i < cache.size; i++) {
+        c2d_surface_t& surface = cache.surfaces[i];
+        if (surface.valid && surface.gpuaddr == (uint32)handle->gpuaddr &&
+            surface.base == handle->base && surface.width == rhs->w &&
+            surface.height == rhs->h && surface.format == rhs->format &&
+            surface.flags == flags) {
+            *cformat = (flags & FLAGS_YUV_DESTINATION) ?
+                       get_c2d_format_for_yuv_destination(rhs->format) :
+                       get_format(rhs->format);
+            surface.lastUse = ++cache.clock;
+            *surfaceId = surface.id;
+            return COPYBIT_SUCCESS;
+        }
+        if (cache.surfaces[lru].valid &&
+            (!surface.valid || surface.lastUse < cache.surfaces[lru].lastUse))
+            lru = i;
+    }
+
+    c2d_surface_t& surface = cache.surfaces[lru];
+    if (surface.id == (unsigned int)-1 &&
+        create_dummy_surface(cache.index, &surface.id)) {
+        goto error;
+    }
+
+    // The image is mapped already, set_image leaves the mapping alone
+    uint32 updateMapped;
+    updateMapped = 0;
+    surface.valid = false;
+    if (set_image(surface.id, rhs, cformat, &updateMapped, flags)) {
+        goto error;
+    }
+    surface.valid = true;
+    surface.gpuaddr = handle->gpuaddr;
+    surface.base = handle->base;
+    surface.width = rhs->w;
+    surface.height = rhs->h;
+    surface.format = rhs->format;
+    surface.flags = flags;
+    surface.lastUse = ++cache.clock;
+    *surfaceId = surface.id;
+    return COPYBIT_SUCCESS;
+
+error:
+    if(*mapped == 1) {
+        release_gpuaddr(handle->gpuaddr);
         handle->gpuaddr = 0;
+        *mapped = 0;
     }
+    return COPYBIT_FAILURE;
 }
 
 static int blit_to_target( uint32 surfaceId, const struct copybit_image_t *rhs)
@@ -700,8 +1183,8 @@ static void set_rects(struct copybit_context_t *ctx,
     c2dObject->config_mask |= C2D_SCISSOR_RECT_BIT;
 }
 
-/** copy the bits */
-static int msm_copybit(struct copybit_context_t *dev, blitlist *list, uint32 target)
+/** queue the objects of the list, drawn with the target transform */
+static int draw_list(blitlist *list, uint32 target, uint32 transform)
 {
     int objects;
 
@@ -709,7 +1192,7 @@ static int msm_copybit(struct copybit_context_t *dev, blitlist *list, uint32 tar
        list->blitObjects[objects].next = &(list->blitObjects[objects+1]);
     }
 
-    if(LINK_c2dDraw(target,dev->trg_transform, 0x0, 0, 0, list->blitObjects,
+    if(LINK_c2dDraw(target, transform, 0x0, 0, 0, list->blitObjects,
                     list->count)) {
        LOGE("%s: LINK_c2dDraw ERROR", __FUNCTION__);
        return COPYBIT_FAILURE;
@@ -718,6 +1201,12 @@ static int msm_copybit(struct copybit_context_t *dev, blitlist *list, uint32 tar
     return COPYBIT_SUCCESS;
 }
 
+/** copy the bits */
+static int msm_copybit(struct copybit_context_t *dev, blitlist *list, uint32 target)
+{
+    return draw_list(list, target, dev->trg_transform);
+}
+
 /*****************************************************************************/
 
 /** Set a parameter to value */
@@ -785,6 +1274,14 @@ static int set_parameter_copybit(
     case COPYBIT_FRAMEBUFFER_HEIGHT:
          ctx->fb_height = value;
          break;
+    case COPYBIT_ASYNC_COMPLETION:
+        ctx->asyncCompletion = (value == COPYBIT_ENABLE);
+        if (!ctx->asyncCompletion)
+            ctx->device.finish(dev);
+        break;
+    case COPYBIT_SOURCE_GENERATION:
+        // Sources are read in place, there is no conversion to keep
+        break;
     default:
         LOGE("%s: default case param=0x%x", __FUNCTION__, name);
         return -EINVAL;
@@ -908,8 +1405,8 @@ static size_t get_size(const bufferInfo& info)
 }
 
 /* Function to allocate memory for the temporary buffer. This memory is
- * allocated from Ashmem. It is the caller's responsibility to free this
- * memory.
+ * allocated cached from the system heap, rounded up to its size class. It
+ * is the caller's responsibility to free this memory.
  */
 static int get_temp_buffer(const bufferInfo& info, alloc_data& data)
 {
@@ -918,9 +1415,9 @@ static int get_temp_buffer(const bufferInfo& info, alloc_data& data)
     data.base = 0;
     data.fd = -1;
     data.offset = 0;
-    data.size = get_size(info);
+    data.size = ALIGN(get_size(info), TEMP_BUFFER_SIZE_CLASS);
     data.align = getpagesize();
-    data.uncached = true;
+    data.uncached = false;
     int allocFlags = GRALLOC_USAGE_PRIVATE_SYSTEM_HEAP;
 
     if (sAlloc == 0) {
@@ -946,9 +1443,67 @@ static int get_temp_buffer(const bufferInfo& info, alloc_data& data)
 static void free_temp_buffer(alloc_data &data)
 {
     if (-1 != data.fd) {
+        invalidate_gpu_mappings(data.fd, data.offset, data.size);
         sp<IMemAlloc> memalloc = sAlloc->getAllocator(data.allocType);
         memalloc->free_buffer(data.base, data.size, 0, data.fd);
+        data.fd = -1;
+    }
+}
+
+static void init_temp_buffers(temp_buffer_pool_t& pool)
+{
+    memset(&pool, 0, sizeof(pool));
+    for (int i = 0; i < MAX_TEMP_BUFFERS; i++)
+        pool.buffers[i].fd = -1;
+}
+
+static void free_temp_buffers(temp_buffer_pool_t& pool)
+{
+    for (int i = 0; i < MAX_TEMP_BUFFERS; i++)
+        free_temp_buffer(pool.buffers[i]);
+}
+
+/*
+ * Get a temp. buffer of the size class of info from the pool. The buffers
+ * of a class are handed out in turn, so that up to perClass blits in
+ * flight each have their own; a buffer is only allocated the first times
+ * a class is used, in place of the least recently used one when full.
+ */
+static alloc_data* get_pooled_temp_buffer(temp_buffer_pool_t& pool,
+                                          const bufferInfo& info,
+                                          int perClass)
+{
+    const size_t size = ALIGN(get_size(info), TEMP_BUFFER_SIZE_CLASS);
+    int inClass = 0;
+    int oldest = -1;
+    int lru = 0;
+    for (int i = 0; i < MAX_TEMP_BUFFERS; i++) {
+        alloc_data& data = pool.buffers[i];
+        if (data.fd != -1 && data.size == size) {
+            inClass++;
+            if (oldest < 0 || pool.lastUse[i] < pool.lastUse[oldest])
+                oldest = i;
+        }
+        if (pool.buffers[lru].fd != -1 &&
+            (data.fd == -1 || pool.lastUse[i] < pool.lastUse[lru]))
+            lru = i;
+    }
+
+    const bool lruInClass = (pool.buffers[lru].fd != -1) &&
+                            (pool.buffers[lru].size == size);
+    int slot = oldest;
+    if (oldest < 0 || (inClass < perClass && !lruInClass)) {
+        free_temp_buffer(pool.buffers[lru]);
+        if (COPYBIT_SUCCESS != get_temp_buffer(info, pool.buffers[lru])) {
+            pool.buffers[lru].fd = -1;
+            if (oldest < 0)
+                return NULL;
+        } else {
+            slot = lru;
+        }
     }
+    pool.lastUse[slot] = ++pool.clock;
+    return &pool.buffers[slot];
 }
 
 /* Function to perform the software color conversion. Convert the
@@ -1076,20 +1631,18 @@ static int stretch_copybit_internal(
         return COPYBIT_FAILURE;
     }
     if (needTempDestination) {
-        if (get_size(dst_info) != ctx->temp_dst_buffer.size) {
-            free_temp_buffer(ctx->temp_dst_buffer);
-            // Create a temp buffer and set that as the destination.
-            if (COPYBIT_FAILURE == get_temp_buffer(dst_info, ctx->temp_dst_buffer)) {
-                LOGE("%s: get_temp_buffer(dst) failed", __FUNCTION__);
-                delete_handle(dst_hnd);
-                return COPYBIT_FAILURE;
-            }
+        // The CPU reads the temp. destination back before the next blit
+        alloc_data* temp = get_pooled_temp_buffer(ctx->tempDstPool, dst_info, 1);
+        if (!temp) {
+            LOGE("%s: get_temp_buffer(dst) failed", __FUNCTION__);
+            delete_handle(dst_hnd);
+            return COPYBIT_FAILURE;
         }
-        dst_hnd->fd = ctx->temp_dst_buffer.fd;
-        dst_hnd->size = ctx->temp_dst_buffer.size;
-        dst_hnd->flags = ctx->temp_dst_buffer.allocType;
-        dst_hnd->base = (int)(ctx->temp_dst_buffer.base);
-        dst_hnd->offset = ctx->temp_dst_buffer.offset;
+        dst_hnd->fd = temp->fd;
+        dst_hnd->size = temp->size;
+        dst_hnd->flags = temp->allocType;
+        dst_hnd->base = (int)(temp->base);
+        dst_hnd->offset = temp->offset;
         dst_hnd->gpuaddr = 0;
         dst_image.handle = dst_hnd;
     }
@@ -1098,8 +1651,10 @@ static int stretch_copybit_internal(
     flags |= (ctx->isPremultipliedAlpha) ? FLAGS_PREMULTIPLIED_ALPHA : 0;
     flags |= (isYUVDestination) ? FLAGS_YUV_DESTINATION : 0;
 
-    status = set_image( ctx->dst[dst_surface_index], &dst_image,
-                       &cformat, &trg_mapped, (eC2DFlags)flags);
+    uint32 dstSurface;
+    status = set_cached_image(ctx->dstCache[dst_surface_index], &dst_image,
+                              &cformat, &trg_mapped, (eC2DFlags)flags,
+                              &dstSurface);
     if(status) {
         LOGE("%s: dst: set_image error", __FUNCTION__);
         delete_handle(dst_hnd);
@@ -1143,30 +1698,30 @@ static int stretch_copybit_internal(
         return COPYBIT_FAILURE;
     }
     if (needTempSource) {
-        if (get_size(src_info) != ctx->temp_src_buffer.size) {
-            free_temp_buffer(ctx->temp_src_buffer);
-            // Create a temp buffer and set that as the destination.
-            if (COPYBIT_SUCCESS != get_temp_buffer(src_info, ctx->temp_src_buffer)) {
-                LOGE("%s: get_temp_buffer(src) failed", __FUNCTION__);
-                delete_handle(dst_hnd);
-                delete_handle(src_hnd);
-                return COPYBIT_FAILURE;
-            }
+        // With asynchronous completion the GPU may still read the last one
+        alloc_data* temp = get_pooled_temp_buffer(ctx->tempSrcPool, src_info,
+                               ctx->asyncCompletion ? TEMP_BUFFERS_PER_CLASS : 1);
+        if (!temp) {
+            LOGE("%s: get_temp_buffer(src) failed", __FUNCTION__);
+            delete_handle(dst_hnd);
+            delete_handle(src_hnd);
+            return COPYBIT_FAILURE;
         }
-        src_hnd->fd = ctx->temp_src_buffer.fd;
-        src_hnd->size = ctx->temp_src_buffer.size;
-        src_hnd->flags = ctx->temp_src_buffer.allocType;
-        src_hnd->base = (int)(ctx->temp_src_buffer.base);
-        src_hnd->offset = ctx->temp_src_buffer.offset;
+        src_hnd->fd = temp->fd;
+        src_hnd->size = temp->size;
+        src_hnd->flags = temp->allocType;
+        src_hnd->base = (int)(temp->base);
+        src_hnd->offset = temp->offset;
         src_hnd->gpuaddr = 0;
         src_image.handle = src_hnd;
 
-        // Copy the source.
+        // Copy the source, once the GPU is done with the previous one
+        wait_gpu_mappings(temp->fd, temp->offset, temp->size);
         copy_image((private_handle_t *)src->handle, &src_image, CONVERT_TO_C2D_FORMAT);
 
-        // Flush the cache
+        // Flush the cache over the written range only
         sp<IMemAlloc> memalloc = sAlloc->getAllocator(src_hnd->flags);
-        if (memalloc->clean_buffer((void *)(src_hnd->base), src_hnd->size,
+        if (memalloc->clean_buffer((void *)(src_hnd->base), get_size(src_info),
                                    src_hnd->offset, src_hnd->fd)) {
             LOGE("%s: clean_buffer failed", __FUNCTION__);
             delete_handle(dst_hnd);
@@ -1175,8 +1730,10 @@ static int stretch_copybit_internal(
         }
     }
 
-    status = set_image( ctx->src[src_surface_index], &src_image,
-                       &cformat, &src_mapped, (eC2DFlags)flags);
+    uint32 srcSurface;
+    status = set_cached_image(ctx->srcCache[src_surface_index], &src_image,
+                              &cformat, &src_mapped, (eC2DFlags)flags,
+                              &srcSurface);
     if(status) {
         LOGE("%s: set_src_image error", __FUNCTION__);
         delete_handle(dst_hnd);
@@ -1189,10 +1746,8 @@ static int stretch_copybit_internal(
             ctx->blitState.config_mask &= ~C2D_ALPHA_BLEND_NONE;
             if(!(ctx->blitState.global_alpha)) {
                 // src alpha is zero
-                unset_image( ctx->src[src_surface_index],
-                            &src_image, src_mapped);
-                unset_image( ctx->dst[dst_surface_index],
-                            &dst_image, trg_mapped);
+                unset_image(srcSurface, &src_image, src_mapped);
+                unset_image(dstSurface, &dst_image, trg_mapped);
                 delete_handle(dst_hnd);
                 delete_handle(src_hnd);
                 return status;
@@ -1207,7 +1762,7 @@ static int stretch_copybit_internal(
         ctx->blitState.config_mask |= C2D_ALPHA_BLEND_NONE;
     }
 
-    ctx->blitState.surface_id = ctx->src[src_surface_index];
+    ctx->blitState.surface_id = srcSurface;
 
     while ((status == 0) && region->next(region, &clip)) {
         req = &(list.blitObjects[list.count]);
@@ -1216,29 +1771,26 @@ static int stretch_copybit_internal(
         set_rects(ctx, req, dst_rect, src_rect, &clip);
 
         if (++list.count == maxCount) {
-            status = msm_copybit(ctx, &list, ctx->dst[dst_surface_index]);
+            status = msm_copybit(ctx, &list, dstSurface);
             list.count = 0;
         }
     }
     if ((status == 0) && list.count) {
-        status = msm_copybit(ctx, &list, ctx->dst[dst_surface_index]);
+        status = msm_copybit(ctx, &list, dstSurface);
     }
 
-    if(LINK_c2dFinish(ctx->dst[dst_surface_index])) {
-        LOGE("%s: LINK_c2dFinish ERROR", __FUNCTION__);
-    }
+    // The CPU reads the temp. destination back right away
+    submit_blits(ctx, dstSurface, needTempDestination);
 
-    unset_image( ctx->src[src_surface_index], &src_image,
-                src_mapped);
-    unset_image( ctx->dst[dst_surface_index], &dst_image,
-                trg_mapped);
+    release_image(ctx, srcSurface, &src_image, src_mapped);
+    release_image(ctx, dstSurface, &dst_image, trg_mapped);
     if (needTempDestination) {
-        // copy the temp. destination without the alignment to the actual destination.
-        copy_image(dst_hnd, dst, CONVERT_TO_ANDROID_FORMAT);
-        // Invalidate the cache.
+        // Invalidate the cache over the range the GPU wrote.
         sp<IMemAlloc> memalloc = sAlloc->getAllocator(dst_hnd->flags);
-        memalloc->clean_buffer((void *)(dst_hnd->base), dst_hnd->size,
+        memalloc->clean_buffer((void *)(dst_hnd->base), get_size(dst_info),
                                dst_hnd->offset, dst_hnd->fd);
+        // copy the temp. destination without the alignment to the actual destination.
+        copy_image(dst_hnd, dst, CONVERT_TO_ANDROID_FORMAT);
     }
     delete_handle(dst_hnd);
     delete_handle(src_hnd);
@@ -1274,19 +1826,336 @@ static int blit_copybit(
     return stretch_copybit_internal(dev, dst, src, &dr, &sr, region, false);
 }
 
-//#CORVUS - Parche https://github.com/mozilla-b2g/gonk-patches/commit/5dda2b19ffe5517cf5730971a3cdfc489ca5bff3
+/* convert a RGBA_8888 pixel value to a color in the C2D target format */
+static uint32 get_c2d_color(int cformat, uint32_t color)
+{
+    uint32 r = color & 0xFF;
+    uint32 g = (color >> 8) & 0xFF;
+    uint32 b = (color >> 16) & 0xFF;
+    uint32 a = (color >> 24) & 0xFF;
+
+    if (cformat & C2D_FORMAT_SWAP_RB) {
+        uint32 tmp = r;
+        r = b;
+        b = tmp;
+    }
 
-/** Fill the rect on dst with rgba color **/
+    if ((cformat & 0xFF) == C2D_COLOR_FORMAT_565_RGB) {
+        return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+    }
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+/** Fill the rect on dst with rgba color, blended with the color alpha **/
 static int fill_color(struct copybit_device_t *dev,
                       struct copybit_image_t const *dst,
                       struct copybit_rect_t const *rect,
                       uint32_t color)
 {
-    // TODO: Impl. once c2d driver supports color fill.
-    return -EINVAL;
+    struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
+    uint32 trg_mapped = 0;
+    int cformat;
+    int status = COPYBIT_SUCCESS;
+
+    if (!ctx) {
+        LOGE("%s: null context error", __FUNCTION__);
+        return -EINVAL;
+    }
+
+    if (dst->w > MAX_DIMENSION || dst->h > MAX_DIMENSION) {
+        LOGE("%s : dst dimension error dst w %d h %d",  __FUNCTION__, dst->w, dst->h);
+        return -EINVAL;
+    }
+
+    // YUV targets would need the temp. destination copy, they never
+    // hold solid color layers
+    if (is_supported_rgb_format(dst->format) != COPYBIT_SUCCESS) {
+        LOGE("%s: Invalid dst surface format 0x%x", __FUNCTION__, dst->format);
+        return -EINVAL;
+    }
+
+    if ((rect->r <= rect->l) || (rect->b <= rect->t)) {
+        return COPYBIT_SUCCESS;
+    }
+
+    uint32 dstSurface;
+    status = set_cached_image(ctx->dstCache[RGB_SURFACE], dst, &cformat,
+                              &trg_mapped, (eC2DFlags)0, &dstSurface);
+    if (status) {
+        LOGE("%s: dst: set_image error", __FUNCTION__);
+        return COPYBIT_FAILURE;
+    }
+
+    // A zero surface_id makes C2D draw fg_color instead of a source
+    // surface, which unlike c2dFillSurface blends with the target
+    C2D_OBJECT fill;
+    memset(&fill, 0, sizeof(fill));
+    fill.surface_id = 0;
+    fill.fg_color = get_c2d_color(cformat, color);
+    fill.target_rect.x      = (rect->l)<<16;
+    fill.target_rect.y      = (rect->t)<<16;
+    fill.target_rect.width  = ((rect->r) - (rect->l))<<16;
+    fill.target_rect.height = ((rect->b) - (rect->t))<<16;
+    fill.config_mask = C2D_TARGET_RECT_BIT;
+    uint32 alpha = (color >> 24) & 0xFF;
+    if ((alpha == 0) || (alpha == 0xFF)) {
+        fill.config_mask |= C2D_ALPHA_BLEND_NONE;
+    } else {
+        // The alpha is applied once, through the global alpha
+        fill.fg_color = get_c2d_color(cformat, color | 0xFF000000);
+        fill.config_mask |= C2D_GLOBAL_ALPHA_BIT;
+        fill.global_alpha = alpha;
+    }
+
+    if (LINK_c2dDraw(dstSurface, 0, 0x0, 0, 0, &fill, 1)) {
+        LOGE("%s: LINK_c2dDraw ERROR", __FUNCTION__);
+        status = COPYBIT_FAILURE;
+    }
+
+    submit_blits(ctx, dstSurface, false);
+
+    release_image(ctx, dstSurface, dst, trg_mapped);
+    return status;
+}
+
+
+/* Sources and pending objects of a compose() call */
+struct compose_state_t {
+    uint32 target;
+    uint32 transform;
+    bool drawn;
+    blitlist list;
+    copybit_image_t images[NUM_SURFACES][MAX_COMPOSE_SOURCES];
+    uint32 mapped[NUM_SURFACES][MAX_COMPOSE_SOURCES];
+    int used[NUM_SURFACES];
+};
+
+/** queue the pending objects of the composition */
+static int compose_draw(compose_state_t& state)
+{
+    int status = COPYBIT_SUCCESS;
+    if (state.list.count) {
+        status = draw_list(&state.list, state.target, state.transform);
+        state.list.count = 0;
+        state.drawn = true;
+    }
+    return status;
+}
+
+/*
+ * Draw the pending objects and release their sources. Waits for them
+ * when the sources are reused or the target changes, otherwise only
+ * with synchronous completion.
+ */
+static int compose_finish(struct copybit_context_t *ctx,
+                          compose_state_t& state, bool wait)
+{
+    int status = compose_draw(state);
+
+    if (state.drawn)
+        submit_blits(ctx, state.target, wait);
+    state.drawn = false;
+
+    for (int i = 0; i < NUM_SURFACES; i++) {
+        for (int j = 0; j < state.used[i]; j++) {
+            release_image(ctx, ctx->compose_src[i][j], &state.images[i][j],
+                          state.mapped[i][j]);
+        }
+        state.used[i] = 0;
+    }
+    return status;
+}
+
+/** Compose the layers into dst, waiting once for all of them */
+static int compose_copybit(struct copybit_device_t *dev,
+                           struct copybit_image_t const *dst,
+                           struct copybit_layer_t const *layers,
+                           int count)
+{
+    struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
+    const uint32 maxCount = sizeof(((blitlist*)0)->blitObjects)/sizeof(C2D_OBJECT);
+    uint32 trg_mapped = 0;
+    int trg_cformat;
+    int status = COPYBIT_SUCCESS;
+    int composed = 0;
+
+    if (!ctx) {
+        LOGE("%s: null context error", __FUNCTION__);
+        return -EINVAL;
+    }
+
+    if (dst->w > MAX_DIMENSION || dst->h > MAX_DIMENSION) {
+        LOGE("%s : dst dimension error dst w %d h %d",  __FUNCTION__, dst->w, dst->h);
+        return -EINVAL;
+    }
+
+    // YUV targets need the temp. destination copy of stretch()
+    if (is_supported_rgb_format(dst->format) != COPYBIT_SUCCESS) {
+        LOGE("%s: Invalid dst surface format 0x%x", __FUNCTION__, dst->format);
+        return -EINVAL;
+    }
+
+    compose_state_t* state = (compose_state_t*)malloc(sizeof(compose_state_t));
+    if (!state) {
+        LOGE("%s: malloc failed", __FUNCTION__);
+        return COPYBIT_FAILURE;
+    }
+    memset(state, 0, sizeof(*state));
+    state->target = ctx->dst[RGB_SURFACE];
+
+    const int fb_width = ctx->fb_width;
+    const int fb_height = ctx->fb_height;
+    // Premultiplied alpha is a property of the target surface, which can
+    // only be changed once the objects drawn into it are done.
+    int trg_premultiplied = -1;
+
+    for (; (status == COPYBIT_SUCCESS) && composed < count; composed++) {
+        const copybit_layer_t& layer = layers[composed];
+        const copybit_image_t* src = layer.src;
+        uint32 index;
+
+        // Stop at a layer C2D cannot blit, as a failed stretch()
+        if (src->w > MAX_DIMENSION || src->h > MAX_DIMENSION) {
+            LOGE("%s: src dimension error", __FUNCTION__);
+            break;
+        }
+        if (get_src_surface_index(src->format, &index)) {
+            LOGE("%s: Invalid source surface format 0x%x", __FUNCTION__,
+                 src->format);
+            break;
+        }
+        if (layer.plane_alpha == 0) {
+            continue;
+        }
+
+        set_parameter_copybit(dev, COPYBIT_PLANE_ALPHA,
+                              (layer.plane_alpha < 0) ? 255 : layer.plane_alpha);
+        set_parameter_copybit(dev, COPYBIT_TRANSFORM, layer.transform);
+        if (state->list.count && (ctx->trg_transform != state->transform)) {
+            status = compose_draw(*state);
+            if (status)
+                break;
+        }
+        state->transform = ctx->trg_transform;
+
+        if (need_temp_buffer(src)) {
+            // stretch() copies the source to the temp. stride buffer and
+            // sets the target up on its own, once the pending work is done
+            status = compose_finish(ctx, *state, true);
+            if (status)
+                break;
+            set_parameter_copybit(dev, COPYBIT_PREMULTIPLIED_ALPHA,
+                                  layer.premultiplied);
+            int err = stretch_copybit_internal(dev, dst, src, &layer.dst_rect,
+                                               &layer.src_rect, layer.region,
+                                               layer.plane_alpha > 0);
+            ctx->fb_width = fb_width;
+            ctx->fb_height = fb_height;
+            trg_premultiplied = -1;
+            if (err)
+                break;
+            continue;
+        }
+
+        const int premultiplied = (layer.premultiplied == COPYBIT_ENABLE);
+        if (premultiplied != trg_premultiplied) {
+            status = compose_finish(ctx, *state, true);
+            if (status)
+                break;
+            status = set_cached_image(ctx->dstCache[RGB_SURFACE], dst,
+                     &trg_cformat, &trg_mapped,
+                     premultiplied ? FLAGS_PREMULTIPLIED_ALPHA : (eC2DFlags)0,
+                     &state->target);
+            if (status) {
+                LOGE("%s: dst: set_image error", __FUNCTION__);
+                status = COPYBIT_FAILURE;
+                break;
+            }
+            trg_premultiplied = premultiplied;
+        }
+
+        if (state->used[index] == MAX_COMPOSE_SOURCES) {
+            status = compose_finish(ctx, *state, true);
+            if (status)
+                break;
+        }
+        const int slot = state->used[index];
+        if (ctx->compose_src[index][slot] == (unsigned int)-1 &&
+            create_dummy_surface(index, &ctx->compose_src[index][slot])) {
+            status = COPYBIT_FAILURE;
+            break;
+        }
+
+        int cformat;
+        state->images[index][slot] = *src;
+        status = set_image(ctx->compose_src[index][slot], src, &cformat,
+                           &state->mapped[index][slot],
+                   premultiplied ? FLAGS_PREMULTIPLIED_ALPHA : (eC2DFlags)0);
+        if (status) {
+            LOGE("%s: set_src_image error", __FUNCTION__);
+            status = COPYBIT_FAILURE;
+            break;
+        }
+        state->used[index]++;
+
+        C2D_OBJECT object;
+        memcpy(&object, &ctx->blitState, sizeof(C2D_OBJECT));
+        object.surface_id = ctx->compose_src[index][slot];
+        if (layer.plane_alpha < 0) {
+            object.config_mask |= C2D_ALPHA_BLEND_NONE;
+        } else if (object.config_mask & C2D_GLOBAL_ALPHA_BIT) {
+            object.config_mask &= ~C2D_ALPHA_BLEND_NONE;
+        } else if (is_alpha(cformat)) {
+            object.config_mask &= ~C2D_ALPHA_BLEND_NONE;
+        } else {
+            object.config_mask |= C2D_ALPHA_BLEND_NONE;
+        }
+
+        struct copybit_rect_t clip;
+        while ((status == COPYBIT_SUCCESS) && layer.region->next(layer.region, &clip)) {
+            C2D_OBJECT *req = &(state->list.blitObjects[state->list.count]);
+            memcpy(req, &object, sizeof(C2D_OBJECT));
+            set_rects(ctx, req, &layer.dst_rect, &layer.src_rect, &clip);
+            if (++state->list.count == maxCount) {
+                status = compose_draw(*state);
+            }
+        }
+    }
+
+    int finishStatus = compose_finish(ctx, *state, false);
+    if (status == COPYBIT_SUCCESS)
+        status = finishStatus;
+    if (status == COPYBIT_SUCCESS)
+        status = composed;
+    release_image(ctx, state->target, dst, trg_mapped);
+    free(state);
+
+    ctx->isPremultipliedAlpha = false;
+    ctx->fb_width = 0;
+    ctx->fb_height = 0;
+    return status;
+}
+
+/** Wait for the flushed blits */
+static int finish_copybit(struct copybit_device_t *dev)
+{
+    struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
+    if (!ctx) {
+        LOGE("%s: null context error", __FUNCTION__);
+        return -EINVAL;
+    }
+
+    int status = COPYBIT_SUCCESS;
+    if (ctx->isTimestampPending) {
+        if (LINK_c2dWaitTimestamp(ctx->timestamp)) {
+            LOGE("%s: LINK_c2dWaitTimestamp ERROR", __FUNCTION__);
+            status = COPYBIT_FAILURE;
+        }
+        ctx->isTimestampPending = false;
+    }
+    return status;
 }
 
-//#Fin parche
 /*****************************************************************************/
 
 /** Close the copybit device */
@@ -1294,18 +2163,27 @@ static int close_copybit(struct hw_device_t *dev)
 {
     struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
     if (ctx) {
+        finish_copybit(&ctx->device);
         for(int i = 0; i <NUM_SURFACES; i++) {
             LINK_c2dDestroySurface(ctx->dst[i]);
             LINK_c2dDestroySurface(ctx->src[i]);
+            deinit_surface_cache(ctx->dstCache[i]);
+            deinit_surface_cache(ctx->srcCache[i]);
+            for (int j = 0; j < MAX_COMPOSE_SOURCES; j++) {
+                if (ctx->compose_src[i][j] != (unsigned int)-1)
+                    LINK_c2dDestroySurface(ctx->compose_src[i][j]);
+            }
         }
 
+        free_temp_buffers(ctx->tempSrcPool);
+        free_temp_buffers(ctx->tempDstPool);
+        deinit_gpu_mappings();
+
         if (ctx->libc2d2) {
            ::dlclose(ctx->libc2d2);
            LOGV("dlclose(libc2d2)");
         }
 
-        free_temp_buffer(ctx->temp_src_buffer);
-        free_temp_buffer(ctx->temp_dst_buffer);
         free(ctx);
     }
 
@@ -1334,6 +2212,8 @@ static int open_copybit(const struct hw_module_t* module, const char* name,
     for (int i=0; i< NUM_SURFACES; i++) {
         ctx->dst[i] = -1;
         ctx->src[i] = -1;
+        for (int j = 0; j < MAX_COMPOSE_SOURCES; j++)
+            ctx->compose_src[i][j] = -1;
     }
 
     ctx->libc2d2 = ::dlopen("libC2D2.so", RTLD_NOW);
@@ -1374,6 +2254,9 @@ static int open_copybit(const struct hw_module_t* module, const char* name,
     ctx->device.get = get;
     ctx->device.blit = blit_copybit;
     ctx->device.stretch = stretch_copybit;
+    ctx->device.fill_color = fill_color;
+    ctx->device.compose = compose_copybit;
+    ctx->device.finish = finish_copybit;
     ctx->blitState.config_mask = C2D_NO_BILINEAR_BIT | C2D_NO_ANTIALIASING_BIT;
     ctx->trg_transform = C2D_TARGET_ROTATE_0;
 
@@ -1455,17 +2338,29 @@ static int open_copybit(const struct hw_module_t* module, const char* name,
         goto error;
     }
 
-    ctx->temp_src_buffer.fd = -1;
-    ctx->temp_src_buffer.base = 0;
-    ctx->temp_src_buffer.size = 0;
-
-    ctx->temp_dst_buffer.fd = -1;
-    ctx->temp_dst_buffer.base = 0;
-    ctx->temp_dst_buffer.size = 0;
+    init_temp_buffers(ctx->tempSrcPool);
+    init_temp_buffers(ctx->tempDstPool);
 
     ctx->fb_width = 0;
     ctx->fb_height = 0;
     ctx->isPremultipliedAlpha = false;
+    ctx->asyncCompletion = false;
+    ctx->isTimestampPending = false;
+    init_gpu_mappings();
+
+    char property[PROPERTY_VALUE_MAX];
+    int rgbSurfaces, yuvSurfaces;
+    rgbSurfaces = DEFAULT_RGB_SURFACES;
+    if (property_get("debug.copybit.rgb_surfaces", property, NULL) > 0)
+        rgbSurfaces = atoi(property);
+    yuvSurfaces = DEFAULT_YUV_SURFACES;
+    if (property_get("debug.copybit.yuv_surfaces", property, NULL) > 0)
+        yuvSurfaces = atoi(property);
+    for (int i = 0; i < NUM_SURFACES; i++) {
+        int size = (i == RGB_SURFACE) ? rgbSurfaces : yuvSurfaces;
+        init_surface_cache(ctx->srcCache[i], i, ctx->src[i], size);
+        init_surface_cache(ctx->dstCache[i], i, ctx->dst[i], size);
+    }
 
     *device = &ctx->device.common;
     return status;
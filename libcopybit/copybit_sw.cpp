@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of Code Aurora Forum, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define LOG_TAG "copybit_sw"
+
+#include <cutils/log.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <copybit.h>
+
+#include "gralloc_priv.h"
+#include "alloc_controller.h"
+#include "memalloc.h"
+#include "sw_blit.h"
+
+using android::sp;
+using gralloc::IMemAlloc;
+using gralloc::IAllocController;
+
+/******************************************************************************/
+
+/* Scaling is only bound by the precision of the 16.16 source positions */
+#define MAX_SCALE_FACTOR    (256)
+#define MAX_DIMENSION       (8192)
+
+static sp<IAllocController> sAlloc = 0;
+
+/******************************************************************************/
+
+/** State information for each device instance */
+struct copybit_context_t {
+    struct copybit_device_t device;
+    int mAlpha;             // negative to copy without blending
+    int mTransform;         // COPYBIT_TRANSFORM_xxx
+    bool mPremultiplied;
+    bool mDither;
+};
+
+/**
+ * Common hardware methods
+ */
+
+static int open_copybit(const struct hw_module_t* module, const char* name,
+        struct hw_device_t** device);
+
+static struct hw_module_methods_t copybit_module_methods = {
+    open:  open_copybit
+};
+
+/*
+ * The COPYBIT Module
+ */
+struct copybit_module_t HAL_MODULE_INFO_SYM = {
+    common: {
+        tag: HARDWARE_MODULE_TAG,
+        version_major: 1,
+        version_minor: 0,
+        id: COPYBIT_SW_HARDWARE_MODULE_ID,
+        name: "QCT CPU COPYBIT Module",
+        author: "Code Aurora Forum",
+        methods: &copybit_module_methods
+    }
+};
+
+/******************************************************************************/
+
+/** convert COPYBIT_FORMAT to SW_FORMAT, -1 if the CPU cannot blit it */
+static int get_format(int format) {
+    switch (format) {
+    case COPYBIT_FORMAT_RGBA_8888:     return SW_FORMAT_RGBA_8888;
+    case COPYBIT_FORMAT_RGBX_8888:     return SW_FORMAT_RGBX_8888;
+    case COPYBIT_FORMAT_BGRA_8888:     return SW_FORMAT_BGRA_8888;
+    case COPYBIT_FORMAT_RGB_565:       return SW_FORMAT_RGB_565;
+    }
+    return -1;
+}
+
+/** describe a copybit image for the kernels */
+static int set_surface(sw_surface_t *surface, const struct copybit_image_t *rhs)
+{
+    const private_handle_t *hnd = (const private_handle_t *)rhs->handle;
+    surface->base = hnd ? (void *)hnd->base : rhs->base;
+    surface->width = rhs->w;
+    surface->height = rhs->h;
+    surface->stride = rhs->w;
+    surface->format = get_format(rhs->format);
+    if (!surface->base || surface->format < 0) {
+        LOGE("%s: unsupported image, format=%d base=%p", __FUNCTION__,
+             rhs->format, surface->base);
+        return -EINVAL;
+    }
+    if (rhs->w > MAX_DIMENSION || rhs->h > MAX_DIMENSION)
+        return -EINVAL;
+    return 0;
+}
+
+/**
+ * Clean and invalidate the CPU cache over a gralloc buffer: before reading
+ * what the GPU or MDP wrote, and after writing for them to read. The
+ * framebuffer and plain memory images are not cached.
+ */
+static int sync_image(const struct copybit_image_t *img)
+{
+    const private_handle_t *hnd = (const private_handle_t *)img->handle;
+    if (!hnd || (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER))
+        return 0;
+
+    sp<IMemAlloc> memalloc = sAlloc->getAllocator(hnd->flags);
+    if (memalloc == 0 || memalloc->clean_buffer((void *)hnd->base, hnd->size,
+                                                hnd->offset, hnd->fd)) {
+        LOGE("%s: clean_buffer failed, flags=0x%x", __FUNCTION__, hnd->flags);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static inline sw_rect_t to_sw_rect(const struct copybit_rect_t& rhs)
+{
+    sw_rect_t r = { rhs.l, rhs.t, rhs.r, rhs.b };
+    return r;
+}
+
+/** Set a parameter to value */
+static int set_parameter_copybit(
+        struct copybit_device_t *dev,
+        int name,
+        int value)
+{
+    struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
+    int status = 0;
+    if (ctx) {
+        switch(name) {
+        case COPYBIT_ROTATION_DEG:
+            switch (value) {
+            case 0:
+                ctx->mTransform = 0;
+                break;
+            case 90:
+                ctx->mTransform = COPYBIT_TRANSFORM_ROT_90;
+                break;
+            case 180:
+                ctx->mTransform = COPYBIT_TRANSFORM_ROT_180;
+                break;
+            case 270:
+                ctx->mTransform = COPYBIT_TRANSFORM_ROT_270;
+                break;
+            default:
+                LOGE("Invalid value for COPYBIT_ROTATION_DEG");
+                status = -EINVAL;
+                break;
+            }
+            break;
+        case COPYBIT_PLANE_ALPHA:
+            if (value < 0)      value = -1;
+            if (value >= 256)   value = 255;
+            ctx->mAlpha = value;
+            break;
+        case COPYBIT_DITHER:
+            ctx->mDither = (value == COPYBIT_ENABLE);
+            break;
+        case COPYBIT_PREMULTIPLIED_ALPHA:
+            ctx->mPremultiplied = (value == COPYBIT_ENABLE);
+            break;
+        case COPYBIT_TRANSFORM:
+            ctx->mTransform = value & 0x7;
+            break;
+        case COPYBIT_BLUR:
+        case COPYBIT_FRAMEBUFFER_WIDTH:
+        case COPYBIT_FRAMEBUFFER_HEIGHT:
+        case COPYBIT_SOURCE_GENERATION:
+            break;
+        default:
+            status = -EINVAL;
+            break;
+        }
+    } else {
+        status = -EINVAL;
+    }
+    return status;
+}
+
+/** Get a static info value */
+static int get(struct copybit_device_t *dev, int name)
+{
+    struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
+    int value;
+    if (ctx) {
+        switch(name) {
+        case COPYBIT_MINIFICATION_LIMIT:
+            value = MAX_SCALE_FACTOR;
+            break;
+        case COPYBIT_MAGNIFICATION_LIMIT:
+            value = MAX_SCALE_FACTOR;
+            break;
+        case COPYBIT_SCALING_FRAC_BITS:
+            value = 16;
+            break;
+        case COPYBIT_ROTATION_STEP_DEG:
+            value = 90;
+            break;
+        default:
+            value = -EINVAL;
+        }
+    } else {
+        value = -EINVAL;
+    }
+    return value;
+}
+
+/** do a stretch blit type operation */
+static int stretch_copybit(
+        struct copybit_device_t *dev,
+        struct copybit_image_t const *dst,
+        struct copybit_image_t const *src,
+        struct copybit_rect_t const *dst_rect,
+        struct copybit_rect_t const *src_rect,
+        struct copybit_region_t const *region)
+{
+    struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
+    if (!ctx || !dst || !src || !dst_rect || !src_rect || !region)
+        return -EINVAL;
+
+    sw_blit_t blit;
+    if (set_surface(&blit.dst, dst) || set_surface(&blit.src, src))
+        return -EINVAL;
+    blit.src_rect = to_sw_rect(*src_rect);
+    blit.dst_rect = to_sw_rect(*dst_rect);
+    blit.transform = ctx->mTransform;
+    blit.plane_alpha = ctx->mAlpha;
+    blit.premultiplied = ctx->mPremultiplied;
+    blit.dither = ctx->mDither;
+
+    // The destination is read too, for blending
+    if (sync_image(src) || sync_image(dst))
+        return -EINVAL;
+
+    struct copybit_rect_t clip;
+    int status = 0;
+    while ((status == 0) && region->next(region, &clip)) {
+        blit.clip = to_sw_rect(clip);
+        status = sw_blit(&blit);
+    }
+    if (sync_image(dst))
+        status = -EINVAL;
+    if (status)
+        LOGE("%s: failed, error=%d", __FUNCTION__, status);
+    return status;
+}
+
+/** Perform a blit type operation */
+static int blit_copybit(
+        struct copybit_device_t *dev,
+        struct copybit_image_t const *dst,
+        struct copybit_image_t const *src,
+        struct copybit_region_t const *region)
+{
+    struct copybit_rect_t dr = { 0, 0, dst->w, dst->h };
+    struct copybit_rect_t sr = { 0, 0, src->w, src->h };
+    return stretch_copybit(dev, dst, src, &dr, &sr, region);
+}
+
+/** Fill a rectangle of the destination with a color */
+static int fill_color_copybit(
+        struct copybit_device_t *dev,
+        struct copybit_image_t const *dst,
+        struct copybit_rect_t const *rect,
+        uint32_t color)
+{
+    struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
+    if (!ctx || !dst || !rect)
+        return -EINVAL;
+
+    sw_surface_t surface;
+    if (set_surface(&surface, dst))
+        return -EINVAL;
+    sw_rect_t r = to_sw_rect(*rect);
+    int status = sw_fill(&surface, &r, color, ctx->mDither);
+    if (sync_image(dst))
+        status = -EINVAL;
+    return status;
+}
+
+/** compose a list of layers, one after the other */
+static int compose_copybit(
+        struct copybit_device_t *dev,
+        struct copybit_image_t const *dst,
+        struct copybit_layer_t const *layers,
+        int count)
+{
+    struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
+    if (!ctx || !dst || (count && !layers))
+        return -EINVAL;
+
+    int composed = 0;
+    for (; composed < count; composed++) {
+        const copybit_layer_t& layer = layers[composed];
+        set_parameter_copybit(dev, COPYBIT_PLANE_ALPHA, layer.plane_alpha);
+        set_parameter_copybit(dev, COPYBIT_TRANSFORM, layer.transform);
+        set_parameter_copybit(dev, COPYBIT_PREMULTIPLIED_ALPHA,
+                              layer.premultiplied);
+        if (stretch_copybit(dev, dst, layer.src, &layer.dst_rect,
+                            &layer.src_rect, layer.region))
+            break;
+    }
+    return composed;
+}
+
+/*****************************************************************************/
+
+/** Close the copybit device */
+static int close_copybit(struct hw_device_t *dev)
+{
+    struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
+    if (ctx) {
+        free(ctx);
+    }
+    return 0;
+}
+
+/** Open a new instance of a copybit device using name */
+static int open_copybit(const struct hw_module_t* module, const char* name,
+        struct hw_device_t** device)
+{
+    copybit_context_t *ctx;
+    ctx = (copybit_context_t *)malloc(sizeof(copybit_context_t));
+    if (!ctx)
+        return -ENOMEM;
+    memset(ctx, 0, sizeof(*ctx));
+
+    if (sAlloc == 0)
+        sAlloc = IAllocController::getInstance(false);
+    if (sAlloc == 0) {
+        LOGE("%s: no allocator controller", __FUNCTION__);
+        free(ctx);
+        return -ENODEV;
+    }
+
+    ctx->device.common.tag = HARDWARE_DEVICE_TAG;
+    ctx->device.common.version = 1;
+    ctx->device.common.module = const_cast<hw_module_t*>(module);
+    ctx->device.common.close = close_copybit;
+    ctx->device.set_parameter = set_parameter_copybit;
+    ctx->device.get = get;
+    ctx->device.blit = blit_copybit;
+    ctx->device.stretch = stretch_copybit;
+    ctx->device.fill_color = fill_color_copybit;
+    ctx->device.compose = compose_copybit;
+    ctx->mAlpha = -1;
+    ctx->mTransform = 0;
+    ctx->mPremultiplied = false;
+    ctx->mDither = false;
+
+    *device = &ctx->device.common;
+    return 0;
+}
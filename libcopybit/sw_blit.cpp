@@ -0,0 +1,536 @@
+/*
+ * Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of Code Aurora Forum, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#if defined(__ARM_HAVE_NEON) || defined(__ARM_NEON__)
+#define SW_BLIT_NEON 1
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#define SW_BLIT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include "sw_blit.h"
+#include "yuv_kernels.h"
+
+// Pixels are converted and blended in runs of this many, as RGBA_8888
+#define RUN_PIXELS 128
+
+static bool sUseSimd = true;
+
+/* x / 255, rounded, for x up to 255 * 255 */
+static inline uint32_t div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline uint32_t min255(uint32_t x)
+{
+    return (x > 255) ? 255 : x;
+}
+
+#if defined(SW_BLIT_NEON)
+static inline uint8x8_t div255_u8(uint16x8_t x)
+{
+    x = vaddq_u16(x, vdupq_n_u16(128));
+    return vshrn_n_u16(vaddq_u16(x, vshrq_n_u16(x, 8)), 8);
+}
+#elif defined(SW_BLIT_SSE2)
+static inline __m128i div255_epi16(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/* broadcast the alpha of each of the two unpacked pixels */
+static inline __m128i alpha_epi16(__m128i x)
+{
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xff), 0xff);
+}
+
+static inline __m128i premultiply_epi16(__m128i x, __m128i alpha,
+                                        __m128i alphaMask)
+{
+    __m128i a = div255_epi16(_mm_mullo_epi16(alpha_epi16(x), alpha));
+    x = div255_epi16(_mm_mullo_epi16(x, a));
+    return _mm_or_si128(_mm_andnot_si128(alphaMask, x),
+                        _mm_and_si128(alphaMask, a));
+}
+
+static inline __m128i blend_epi16(__m128i d, __m128i s)
+{
+    __m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), alpha_epi16(s));
+    return _mm_add_epi16(s, div255_epi16(_mm_mullo_epi16(d, inv)));
+}
+#endif
+
+/******************************************************************************/
+
+/* Row kernels, on RGBA_8888 pixels */
+
+/* Apply the plane alpha to the pixels, premultiplying them unless they
+ * already are */
+static void premultiply_row(uint8_t *p, int n, int alpha, bool premultiplied)
+{
+    int i = 0;
+    if (sUseSimd) {
+#if defined(SW_BLIT_NEON)
+        const uint8x8_t va = vdup_n_u8(alpha);
+        for (; i + 8 <= n; i += 8) {
+            uint8x8x4_t px = vld4_u8(p + 4*i);
+            if (premultiplied) {
+                for (int c = 0; c < 4; c++)
+                    px.val[c] = div255_u8(vmull_u8(px.val[c], va));
+            } else {
+                uint8x8_t a = div255_u8(vmull_u8(px.val[3], va));
+                for (int c = 0; c < 3; c++)
+                    px.val[c] = div255_u8(vmull_u8(px.val[c], a));
+                px.val[3] = a;
+            }
+            vst4_u8(p + 4*i, px);
+        }
+#elif defined(SW_BLIT_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i va = _mm_set1_epi16(alpha);
+        const __m128i alphaMask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+        for (; i + 4 <= n; i += 4) {
+            __m128i px = _mm_loadu_si128((const __m128i *)(p + 4*i));
+            __m128i lo = _mm_unpacklo_epi8(px, zero);
+            __m128i hi = _mm_unpackhi_epi8(px, zero);
+            if (premultiplied) {
+                lo = div255_epi16(_mm_mullo_epi16(lo, va));
+                hi = div255_epi16(_mm_mullo_epi16(hi, va));
+            } else {
+                lo = premultiply_epi16(lo, va, alphaMask);
+                hi = premultiply_epi16(hi, va, alphaMask);
+            }
+            _mm_storeu_si128((__m128i *)(p + 4*i), _mm_packus_epi16(lo, hi));
+        }
+#endif
+    }
+    for (; i < n; i++) {
+        uint8_t *px = p + 4*i;
+        if (premultiplied) {
+            for (int c = 0; c < 4; c++)
+                px[c] = div255(px[c] * alpha);
+        } else {
+            uint32_t a = div255(px[3] * alpha);
+            for (int c = 0; c < 3; c++)
+                px[c] = div255(px[c] * a);
+            px[3] = a;
+        }
+    }
+}
+
+/* Blend premultiplied source pixels over the destination ones */
+static void blend_row(uint8_t *d, const uint8_t *s, int n)
+{
+    int i = 0;
+    if (sUseSimd) {
+#if defined(SW_BLIT_NEON)
+        for (; i + 8 <= n; i += 8) {
+            uint8x8x4_t vs = vld4_u8(s + 4*i);
+            uint8x8x4_t vd = vld4_u8(d + 4*i);
+            uint8x8_t inv = vmvn_u8(vs.val[3]);
+            for (int c = 0; c < 4; c++)
+                vd.val[c] = vqadd_u8(vs.val[c],
+                                     div255_u8(vmull_u8(vd.val[c], inv)));
+            vst4_u8(d + 4*i, vd);
+        }
+#elif defined(SW_BLIT_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 4 <= n; i += 4) {
+            __m128i vs = _mm_loadu_si128((const __m128i *)(s + 4*i));
+            __m128i vd = _mm_loadu_si128((const __m128i *)(d + 4*i));
+            __m128i lo = blend_epi16(_mm_unpacklo_epi8(vd, zero),
+                                     _mm_unpacklo_epi8(vs, zero));
+            __m128i hi = blend_epi16(_mm_unpackhi_epi8(vd, zero),
+                                     _mm_unpackhi_epi8(vs, zero));
+            _mm_storeu_si128((__m128i *)(d + 4*i), _mm_packus_epi16(lo, hi));
+        }
+#endif
+    }
+    for (; i < n; i++) {
+        uint32_t inv = 255 - s[4*i + 3];
+        for (int c = 0; c < 4; c++)
+            d[4*i + c] = min255(s[4*i + c] + div255(d[4*i + c] * inv));
+    }
+}
+
+/******************************************************************************/
+
+/* Pixel conversion */
+
+static const uint8_t sDitherMatrix[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+static inline int bytes_per_pixel(int format)
+{
+    return (format == SW_FORMAT_RGB_565) ? 2 : 4;
+}
+
+static inline void load_pixel(uint8_t *out, const uint8_t *in, int format)
+{
+    switch (format) {
+        case SW_FORMAT_RGBA_8888:
+            memcpy(out, in, 4);
+            break;
+        case SW_FORMAT_RGBX_8888:
+            out[0] = in[0];
+            out[1] = in[1];
+            out[2] = in[2];
+            out[3] = 255;
+            break;
+        case SW_FORMAT_BGRA_8888:
+            out[0] = in[2];
+            out[1] = in[1];
+            out[2] = in[0];
+            out[3] = in[3];
+            break;
+        case SW_FORMAT_RGB_565: {
+            uint32_t v = in[0] | (in[1] << 8);
+            uint32_t r = v >> 11, g = (v >> 5) & 0x3f, b = v & 0x1f;
+            out[0] = (r << 3) | (r >> 2);
+            out[1] = (g << 2) | (g >> 4);
+            out[2] = (b << 3) | (b >> 2);
+            out[3] = 255;
+        } break;
+    }
+}
+
+static void load_row(uint8_t *out, const uint8_t *in, int n, int format)
+{
+    if (format == SW_FORMAT_RGBA_8888) {
+        memcpy(out, in, 4 * n);
+        return;
+    }
+    int bpp = bytes_per_pixel(format);
+    for (int i = 0; i < n; i++)
+        load_pixel(out + 4*i, in + bpp*i, format);
+}
+
+/* Store n pixels starting at column x of row y, dithered to RGB_565 if
+ * asked */
+static void store_row(uint8_t *out, const uint8_t *in, int n, int format,
+                      bool dither, int x, int y)
+{
+    switch (format) {
+        case SW_FORMAT_RGBA_8888:
+            memcpy(out, in, 4 * n);
+            break;
+        case SW_FORMAT_RGBX_8888:
+            for (int i = 0; i < n; i++) {
+                memcpy(out + 4*i, in + 4*i, 3);
+                out[4*i + 3] = 255;
+            }
+            break;
+        case SW_FORMAT_BGRA_8888:
+            for (int i = 0; i < n; i++) {
+                out[4*i] = in[4*i + 2];
+                out[4*i + 1] = in[4*i + 1];
+                out[4*i + 2] = in[4*i];
+                out[4*i + 3] = in[4*i + 3];
+            }
+            break;
+        case SW_FORMAT_RGB_565: {
+            const uint8_t *matrix = sDitherMatrix[y & 3];
+            for (int i = 0; i < n; i++) {
+                const uint8_t *px = in + 4*i;
+                uint32_t r = px[0], g = px[1], b = px[2];
+                if (dither) {
+                    uint32_t d = matrix[(x + i) & 3];
+                    r = min255(r + (d >> 1));
+                    g = min255(g + (d >> 2));
+                    b = min255(b + (d >> 1));
+                }
+                uint32_t v = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+                out[2*i] = v & 0xff;
+                out[2*i + 1] = v >> 8;
+            }
+        } break;
+    }
+}
+
+static bool is_valid_surface(const sw_surface_t *s)
+{
+    return s->base && s->width > 0 && s->height > 0 &&
+           s->stride >= s->width && s->format >= SW_FORMAT_RGBA_8888 &&
+           s->format <= SW_FORMAT_RGB_565;
+}
+
+static bool is_inside(const sw_rect_t& r, const sw_surface_t *s)
+{
+    return r.l >= 0 && r.t >= 0 && r.l < r.r && r.t < r.b &&
+           r.r <= s->width && r.b <= s->height;
+}
+
+static sw_rect_t intersect(const sw_rect_t& a, const sw_rect_t& b)
+{
+    sw_rect_t r;
+    r.l = (a.l > b.l) ? a.l : b.l;
+    r.t = (a.t > b.t) ? a.t : b.t;
+    r.r = (a.r < b.r) ? a.r : b.r;
+    r.b = (a.b < b.b) ? a.b : b.b;
+    return r;
+}
+
+/******************************************************************************/
+
+/* Blit */
+
+struct blit_args_t {
+    const sw_blit_t *blit;
+    sw_rect_t area;         // destination pixels drawn
+    // source position, in 16.16 fixed point relative to the source
+    // rectangle, of the first pixel of the area and its steps
+    int32_t u0, v0;
+    int32_t dudx, dudy;
+    int32_t dvdx, dvdy;
+    bool contiguous;        // rows of the area are read 1:1 from a source row
+    bool blend;
+};
+
+static inline int clamp(int v, int min, int max)
+{
+    return (v < min) ? min : ((v > max) ? max : v);
+}
+
+static void blit_band(const void *args, int firstRow, int rows)
+{
+    const blit_args_t *a = (const blit_args_t *)args;
+    const sw_blit_t *blit = a->blit;
+    const sw_surface_t& src = blit->src;
+    const sw_surface_t& dst = blit->dst;
+    const sw_rect_t& sr = blit->src_rect;
+    const int srcBpp = bytes_per_pixel(src.format);
+    const int dstBpp = bytes_per_pixel(dst.format);
+    const int width = a->area.r - a->area.l;
+    const bool dither = blit->dither && dst.format == SW_FORMAT_RGB_565;
+    uint8_t srcRun[RUN_PIXELS * 4];
+    uint8_t dstRun[RUN_PIXELS * 4];
+
+    for (int j = firstRow; j < firstRow + rows; j++) {
+        const int y = a->area.t + j;
+        int32_t u = a->u0 + (int32_t)((int64_t)j * a->dudy);
+        int32_t v = a->v0 + (int32_t)((int64_t)j * a->dvdy);
+        uint8_t *dstRow = (uint8_t *)dst.base +
+                          ((int64_t)y * dst.stride + a->area.l) * dstBpp;
+        const uint8_t *srcRow = NULL;
+        if (a->contiguous) {
+            int sx = clamp(sr.l + (u >> 16), sr.l, sr.r - 1);
+            int sy = clamp(sr.t + (v >> 16), sr.t, sr.b - 1);
+            srcRow = (const uint8_t *)src.base +
+                     ((int64_t)sy * src.stride + sx) * srcBpp;
+        }
+
+        for (int x = 0; x < width; x += RUN_PIXELS) {
+            const int n = (width - x < RUN_PIXELS) ? width - x : RUN_PIXELS;
+            if (a->contiguous) {
+                load_row(srcRun, srcRow + x * srcBpp, n, src.format);
+            } else {
+                for (int i = 0; i < n; i++) {
+                    int sx = clamp(sr.l + (u >> 16), sr.l, sr.r - 1);
+                    int sy = clamp(sr.t + (v >> 16), sr.t, sr.b - 1);
+                    load_pixel(srcRun + 4*i, (const uint8_t *)src.base +
+                               ((int64_t)sy * src.stride + sx) * srcBpp,
+                               src.format);
+                    u += a->dudx;
+                    v += a->dvdx;
+                }
+            }
+
+            uint8_t *out = dstRow + x * dstBpp;
+            if (a->blend) {
+                premultiply_row(srcRun, n, blit->plane_alpha,
+                                blit->premultiplied);
+                load_row(dstRun, out, n, dst.format);
+                blend_row(dstRun, srcRun, n);
+                store_row(out, dstRun, n, dst.format, dither,
+                          a->area.l + x, y);
+            } else {
+                store_row(out, srcRun, n, dst.format, dither,
+                          a->area.l + x, y);
+            }
+        }
+    }
+}
+
+int sw_blit(const sw_blit_t *blit)
+{
+    if (!is_valid_surface(&blit->src) || !is_valid_surface(&blit->dst) ||
+        !is_inside(blit->src_rect, &blit->src)) {
+        return -EINVAL;
+    }
+    const sw_rect_t& dr = blit->dst_rect;
+    if (dr.l >= dr.r || dr.t >= dr.b) {
+        return -EINVAL;
+    }
+
+    sw_rect_t bounds = { 0, 0, blit->dst.width, blit->dst.height };
+    blit_args_t args;
+    args.blit = blit;
+    args.area = intersect(intersect(dr, blit->clip), bounds);
+    if (args.area.l >= args.area.r || args.area.t >= args.area.b ||
+        blit->plane_alpha == 0) {
+        return 0;
+    }
+
+    // Map the centers of the destination pixels back to the source: undo
+    // the rotation, then the flips. Positions are doubled to keep the
+    // half pixel of the centers.
+    const int64_t W = dr.r - dr.l, H = dr.b - dr.t;
+    const int64_t w = blit->src_rect.r - blit->src_rect.l;
+    const int64_t h = blit->src_rect.b - blit->src_rect.t;
+    const int64_t x2 = 2 * (args.area.l - dr.l) + 1;
+    const int64_t y2 = 2 * (args.area.t - dr.t) + 1;
+    int64_t u0, v0;
+    if (blit->transform & SW_TRANSFORM_ROT_90) {
+        u0 = ((y2 * w) << 16) / (2 * H);
+        v0 = (((2 * W - x2) * h) << 16) / (2 * W);
+        args.dudx = 0;
+        args.dudy = (w << 16) / H;
+        args.dvdx = -((h << 16) / W);
+        args.dvdy = 0;
+    } else {
+        u0 = ((x2 * w) << 16) / (2 * W);
+        v0 = ((y2 * h) << 16) / (2 * H);
+        args.dudx = (w << 16) / W;
+        args.dudy = 0;
+        args.dvdx = 0;
+        args.dvdy = (h << 16) / H;
+    }
+    if (blit->transform & SW_TRANSFORM_FLIP_H) {
+        u0 = (w << 16) - u0;
+        args.dudx = -args.dudx;
+        args.dudy = -args.dudy;
+    }
+    if (blit->transform & SW_TRANSFORM_FLIP_V) {
+        v0 = (h << 16) - v0;
+        args.dvdx = -args.dvdx;
+        args.dvdy = -args.dvdy;
+    }
+    args.u0 = (int32_t)u0;
+    args.v0 = (int32_t)v0;
+    args.contiguous = (args.dudx == (1 << 16) && args.dvdx == 0);
+
+    // Sources without alpha at full plane alpha are copied
+    bool opaque = (blit->src.format == SW_FORMAT_RGBX_8888 ||
+                   blit->src.format == SW_FORMAT_RGB_565) &&
+                  blit->plane_alpha >= 255;
+    args.blend = (blit->plane_alpha >= 0) && !opaque;
+
+    int width = args.area.r - args.area.l;
+    yuv_run_bands(blit_band, &args, args.area.b - args.area.t, width * 4);
+    return 0;
+}
+
+/******************************************************************************/
+
+/* Fill */
+
+struct fill_args_t {
+    const sw_surface_t *dst;
+    sw_rect_t area;
+    uint8_t color[4];       // premultiplied when blended
+    bool blend;
+    bool dither;
+};
+
+static void fill_band(const void *args, int firstRow, int rows)
+{
+    const fill_args_t *a = (const fill_args_t *)args;
+    const sw_surface_t *dst = a->dst;
+    const int dstBpp = bytes_per_pixel(dst->format);
+    const int width = a->area.r - a->area.l;
+    uint8_t colorRun[RUN_PIXELS * 4];
+    uint8_t dstRun[RUN_PIXELS * 4];
+
+    for (int i = 0; i < RUN_PIXELS; i++)
+        memcpy(colorRun + 4*i, a->color, 4);
+
+    for (int j = firstRow; j < firstRow + rows; j++) {
+        const int y = a->area.t + j;
+        uint8_t *dstRow = (uint8_t *)dst->base +
+                          ((int64_t)y * dst->stride + a->area.l) * dstBpp;
+        for (int x = 0; x < width; x += RUN_PIXELS) {
+            const int n = (width - x < RUN_PIXELS) ? width - x : RUN_PIXELS;
+            uint8_t *out = dstRow + x * dstBpp;
+            if (a->blend) {
+                load_row(dstRun, out, n, dst->format);
+                blend_row(dstRun, colorRun, n);
+                store_row(out, dstRun, n, dst->format, a->dither,
+                          a->area.l + x, y);
+            } else {
+                store_row(out, colorRun, n, dst->format, a->dither,
+                          a->area.l + x, y);
+            }
+        }
+    }
+}
+
+int sw_fill(const sw_surface_t *dst, const sw_rect_t *rect, uint32_t color,
+            bool dither)
+{
+    if (!is_valid_surface(dst)) {
+        return -EINVAL;
+    }
+    sw_rect_t bounds = { 0, 0, dst->width, dst->height };
+    fill_args_t args;
+    args.dst = dst;
+    args.area = intersect(*rect, bounds);
+    if (args.area.l >= args.area.r || args.area.t >= args.area.b) {
+        return 0;
+    }
+
+    for (int c = 0; c < 4; c++)
+        args.color[c] = (color >> (8 * c)) & 0xff;
+    uint32_t alpha = args.color[3];
+    args.blend = (alpha != 0 && alpha != 255);
+    if (args.blend) {
+        for (int c = 0; c < 3; c++)
+            args.color[c] = div255(args.color[c] * alpha);
+    }
+    args.dither = dither && dst->format == SW_FORMAT_RGB_565;
+
+    int width = args.area.r - args.area.l;
+    yuv_run_bands(fill_band, &args, args.area.b - args.area.t, width * 4);
+    return 0;
+}
+
+void sw_set_simd(bool enable)
+{
+    sUseSimd = enable;
+}
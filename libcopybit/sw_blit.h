@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of Code Aurora Forum, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef COPYBIT_SW_BLIT_H
+#define COPYBIT_SW_BLIT_H
+
+#include <stdint.h>
+
+/*
+ * Blit and fill kernels of the CPU copybit backend. Destination rows are
+ * split into bands run on the worker pool of the yuv kernels, and the
+ * blending is done with NEON or SSE2 when built for them. Like the yuv
+ * kernels, they only depend on libc and pthreads.
+ */
+
+/* pixel formats, in memory byte order */
+enum {
+    SW_FORMAT_RGBA_8888,
+    SW_FORMAT_RGBX_8888,
+    SW_FORMAT_BGRA_8888,
+    SW_FORMAT_RGB_565,
+};
+
+/* transform bits, the same as HAL_TRANSFORM_xxx */
+enum {
+    SW_TRANSFORM_FLIP_H = 0x01,
+    SW_TRANSFORM_FLIP_V = 0x02,
+    SW_TRANSFORM_ROT_90 = 0x04,
+};
+
+struct sw_surface_t {
+    void *base;
+    int width;
+    int height;
+    int stride;     // in pixels
+    int format;     // SW_FORMAT_xxx
+};
+
+struct sw_rect_t {
+    int l;
+    int t;
+    int r;
+    int b;
+};
+
+struct sw_blit_t {
+    sw_surface_t src;
+    sw_surface_t dst;
+    sw_rect_t src_rect;
+    sw_rect_t dst_rect;
+    sw_rect_t clip;         // part of dst_rect drawn
+    int transform;          // SW_TRANSFORM_xxx, flips applied before rotation
+    int plane_alpha;        // 0 to 255, negative to copy without blending
+    bool premultiplied;     // the source has premultiplied alpha
+    bool dither;            // dither to RGB_565 destinations
+};
+
+/*
+ * Scale, with nearest sampling, transform and blend the source rectangle
+ * into the clipped destination rectangle.
+ *
+ * @return 0 if successful, -EINVAL if the source rectangle is outside its
+ *         surface
+ */
+int sw_blit(const sw_blit_t *blit);
+
+/*
+ * Fill a rectangle with a RGBA_8888 color (0xAABBGGRR), blended with the
+ * destination using the alpha of the color. Fully opaque and fully
+ * transparent colors are written as is.
+ *
+ * @return 0 if successful, -EINVAL if the surface is invalid
+ */
+int sw_fill(const sw_surface_t *dst, const sw_rect_t *rect, uint32_t color,
+            bool dither);
+
+/*
+ * Use the scalar row kernels instead of the SIMD ones, to compare them.
+ */
+void sw_set_simd(bool enable);
+
+#endif /* COPYBIT_SW_BLIT_H */
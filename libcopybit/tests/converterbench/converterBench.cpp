@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of Code Aurora Forum, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Times the software converter kernels against the row loops they replace
+ * and checks that both give the same bytes. Runs on the device as well as
+ * on the host.
+ *
+ * usage: converterBench [iterations]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "yuv_kernels.h"
+
+#define ALIGN(x, align) (((x) + ((align)-1)) & ~((align)-1))
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* The scalar YV12 chroma interleave of convertYV12toYCrCb420SP */
+static void legacy_yv12_chroma(unsigned char *newChroma,
+                               const unsigned char *oldChroma,
+                               unsigned int width, unsigned int height,
+                               unsigned int c_width, unsigned int c_size)
+{
+    unsigned int chromaPadding = c_width - width/2;
+    if (!chromaPadding) {
+        for (unsigned int i = 0; i < c_size; i++) {
+            newChroma[i*2]   = oldChroma[i];
+            newChroma[i*2+1] = oldChroma[i+c_size];
+        }
+        return;
+    }
+    unsigned int r1 = 0, r2 = 0, i = 0, j = 0;
+    while (r1 < height/2) {
+        if (j == width) {
+            j = 0;
+            r2++;
+            continue;
+        }
+        if (j+1 == width) {
+            newChroma[r2*width + j] = oldChroma[r1*c_width+i];
+            r2++;
+            newChroma[r2*width] = oldChroma[r1*c_width+i+c_size];
+            j = 1;
+        } else {
+            newChroma[r2*width + j] = oldChroma[r1*c_width+i];
+            newChroma[r2*width + j + 1] = oldChroma[r1*c_width+i+c_size];
+            j+=2;
+        }
+        i++;
+        if (i == width/2) {
+            i = 0;
+            r1++;
+        }
+    }
+}
+
+/* The per row copy of copy_source_to_destination */
+static void legacy_copy_plane(unsigned char *dst, int dstStride,
+                              const unsigned char *src, int srcStride,
+                              int width, int rows)
+{
+    for (int i = 0; i < rows; i++) {
+        memcpy(dst, src, width);
+        src += srcStride;
+        dst += dstStride;
+    }
+}
+
+static void fill(unsigned char *buf, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        buf[i] = (unsigned char)((i * 2654435761u) >> 24);
+}
+
+/* Returns the number of mismatching bytes */
+static int bench_yv12(int width, int height, int iterations)
+{
+    const int c_width = ALIGN(width/2, 16);
+    const int c_size = c_width * height/2;
+    const int outSize = width * height / 2 + 64;
+    unsigned char *src = (unsigned char *)malloc(c_size * 2);
+    unsigned char *ref = (unsigned char *)calloc(1, outSize);
+    unsigned char *out = (unsigned char *)calloc(1, outSize);
+    fill(src, c_size * 2);
+
+    double start = now_ms();
+    for (int i = 0; i < iterations; i++)
+        legacy_yv12_chroma(ref, src, width, height, c_width, c_size);
+    double legacy = (now_ms() - start) / iterations;
+
+    double kernel[2];
+    for (int t = 0; t < 2; t++) {
+        yuv_set_max_threads(t ? YUV_MAX_THREADS : 1);
+        start = now_ms();
+        for (int i = 0; i < iterations; i++)
+            yuv_interleave_planes(out, (width/2)*2, src, src + c_size,
+                                  c_width, width/2, height/2);
+        kernel[t] = (now_ms() - start) / iterations;
+    }
+
+    int errors = 0;
+    for (int i = 0; i < outSize; i++)
+        errors += (ref[i] != out[i]);
+    printf("yv12 chroma %4dx%-4d %s: legacy %7.3f ms, 1 thread %7.3f ms, "
+           "%d threads %7.3f ms%s\n", width, height,
+           (c_width == width/2) ? "unpadded" : "padded  ", legacy, kernel[0],
+           YUV_MAX_THREADS, kernel[1], errors ? ", MISMATCH" : "");
+    free(src);
+    free(ref);
+    free(out);
+    return errors;
+}
+
+/* Returns the number of mismatching bytes */
+static int bench_restride(int width, int height, int iterations)
+{
+    const int srcStride = ALIGN(width, 32);
+    const int dstStride = ALIGN(width, 16);
+    const int rows = height + height/2;
+    unsigned char *src = (unsigned char *)malloc(srcStride * rows);
+    unsigned char *ref = (unsigned char *)calloc(1, dstStride * rows);
+    unsigned char *out = (unsigned char *)calloc(1, dstStride * rows);
+    fill(src, srcStride * rows);
+
+    double start = now_ms();
+    for (int i = 0; i < iterations; i++)
+        legacy_copy_plane(ref, dstStride, src, srcStride, width, rows);
+    double legacy = (now_ms() - start) / iterations;
+
+    double kernel[2];
+    for (int t = 0; t < 2; t++) {
+        yuv_set_max_threads(t ? YUV_MAX_THREADS : 1);
+        start = now_ms();
+        for (int i = 0; i < iterations; i++)
+            yuv_copy_plane(out, dstStride, src, srcStride, width, rows);
+        kernel[t] = (now_ms() - start) / iterations;
+    }
+
+    int errors = 0;
+    for (int i = 0; i < dstStride * rows; i++)
+        errors += (ref[i] != out[i]);
+    printf("restride    %4dx%-4d         : legacy %7.3f ms, 1 thread %7.3f ms, "
+           "%d threads %7.3f ms%s\n", width, height, legacy, kernel[0],
+           YUV_MAX_THREADS, kernel[1], errors ? ", MISMATCH" : "");
+    free(src);
+    free(ref);
+    free(out);
+    return errors;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : 50;
+    if (iterations < 1)
+        iterations = 1;
+
+    int errors = 0;
+    errors += bench_yv12(1920, 1080, iterations);
+    errors += bench_yv12(1912, 1080, iterations);
+    errors += bench_yv12(1280, 720, iterations);
+    errors += bench_yv12(1272, 720, iterations);
+    errors += bench_yv12(175, 144, iterations);
+    errors += bench_restride(1912, 1080, iterations);
+    errors += bench_restride(1272, 720, iterations);
+    return errors ? 1 : 0;
+}
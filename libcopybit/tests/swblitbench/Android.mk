@@ -0,0 +1,20 @@
+LOCAL_PATH := $(my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := swBlitBench
+LOCAL_C_INCLUDES := hardware/qcom/display/libcopybit
+LOCAL_SRC_FILES := swBlitBench.cpp ../../sw_blit.cpp ../../yuv_kernels.cpp
+LOCAL_MODULE_TAGS := optional eng
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA)/swBlitBench
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+LOCAL_CFLAGS += -D__ARM_HAVE_NEON
+endif
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := swBlitBench
+LOCAL_C_INCLUDES := hardware/qcom/display/libcopybit
+LOCAL_SRC_FILES := swBlitBench.cpp ../../sw_blit.cpp ../../yuv_kernels.cpp
+LOCAL_MODULE_TAGS := optional
+LOCAL_LDLIBS := -lpthread -lrt
+include $(BUILD_HOST_EXECUTABLE)
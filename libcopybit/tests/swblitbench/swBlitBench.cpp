@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of Code Aurora Forum, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Times the blit and fill kernels of the CPU copybit backend, scalar on
+ * one thread against SIMD on all the threads, and checks that both give
+ * the same bytes. Runs on the device as well as on the host.
+ *
+ * usage: swBlitBench [iterations]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sw_blit.h"
+#include "yuv_kernels.h"
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void fill(unsigned char *buf, size_t size, unsigned int seed)
+{
+    for (size_t i = 0; i < size; i++)
+        buf[i] = (unsigned char)(((i + seed) * 2654435761u) >> 24);
+}
+
+static int bytes_per_pixel(int format)
+{
+    return (format == SW_FORMAT_RGB_565) ? 2 : 4;
+}
+
+static const char *format_name(int format)
+{
+    switch (format) {
+        case SW_FORMAT_RGBA_8888: return "RGBA_8888";
+        case SW_FORMAT_RGBX_8888: return "RGBX_8888";
+        case SW_FORMAT_BGRA_8888: return "BGRA_8888";
+        case SW_FORMAT_RGB_565:   return "RGB_565";
+    }
+    return "?";
+}
+
+static sw_surface_t make_surface(int width, int height, int format,
+                                 unsigned int seed)
+{
+    sw_surface_t s;
+    s.width = width;
+    s.height = height;
+    s.stride = (width + 31) & ~31;
+    s.format = format;
+    size_t size = (size_t)s.stride * height * bytes_per_pixel(format);
+    s.base = malloc(size);
+    fill((unsigned char *)s.base, size, seed);
+    return s;
+}
+
+static size_t surface_size(const sw_surface_t& s)
+{
+    return (size_t)s.stride * s.height * bytes_per_pixel(s.format);
+}
+
+/* Runs the blit from the same destination contents, scalar on one thread
+ * then SIMD on all threads. Returns the number of mismatching bytes */
+static int bench_blit(const char *name, sw_blit_t blit, int iterations)
+{
+    const size_t size = surface_size(blit.dst);
+    unsigned char *initial = (unsigned char *)malloc(size);
+    unsigned char *out[2];
+    memcpy(initial, blit.dst.base, size);
+
+    double ms[2];
+    for (int t = 0; t < 2; t++) {
+        sw_set_simd(t != 0);
+        yuv_set_max_threads(t ? YUV_MAX_THREADS : 1);
+        double total = 0;
+        for (int i = 0; i < iterations; i++) {
+            memcpy(blit.dst.base, initial, size);
+            double start = now_ms();
+            sw_blit(&blit);
+            total += now_ms() - start;
+        }
+        ms[t] = total / iterations;
+        out[t] = (unsigned char *)malloc(size);
+        memcpy(out[t], blit.dst.base, size);
+    }
+
+    int errors = 0;
+    for (size_t i = 0; i < size; i++)
+        errors += (out[0][i] != out[1][i]);
+    printf("%-28s %s -> %-9s: scalar %7.3f ms, SIMD %d threads %7.3f ms%s\n",
+           name, format_name(blit.src.format), format_name(blit.dst.format),
+           ms[0], YUV_MAX_THREADS, ms[1], errors ? ", MISMATCH" : "");
+    memcpy(blit.dst.base, initial, size);
+    free(initial);
+    free(out[0]);
+    free(out[1]);
+    return errors;
+}
+
+/* Returns the number of mismatching bytes */
+static int bench_fill(sw_surface_t dst, uint32_t color, int iterations)
+{
+    const size_t size = surface_size(dst);
+    unsigned char *initial = (unsigned char *)malloc(size);
+    unsigned char *out[2];
+    memcpy(initial, dst.base, size);
+    sw_rect_t rect = { 0, 0, dst.width, dst.height };
+
+    double ms[2];
+    for (int t = 0; t < 2; t++) {
+        sw_set_simd(t != 0);
+        yuv_set_max_threads(t ? YUV_MAX_THREADS : 1);
+        double total = 0;
+        for (int i = 0; i < iterations; i++) {
+            memcpy(dst.base, initial, size);
+            double start = now_ms();
+            sw_fill(&dst, &rect, color, true);
+            total += now_ms() - start;
+        }
+        ms[t] = total / iterations;
+        out[t] = (unsigned char *)malloc(size);
+        memcpy(out[t], dst.base, size);
+    }
+
+    int errors = 0;
+    for (size_t i = 0; i < size; i++)
+        errors += (out[0][i] != out[1][i]);
+    printf("fill 0x%08x %4dx%-4d      %-9s: scalar %7.3f ms, SIMD %d threads "
+           "%7.3f ms%s\n", color, dst.width, dst.height, format_name(dst.format),
+           ms[0], YUV_MAX_THREADS, ms[1], errors ? ", MISMATCH" : "");
+    memcpy(dst.base, initial, size);
+    free(initial);
+    free(out[0]);
+    free(out[1]);
+    return errors;
+}
+
+/* Checks the transforms on a 1:1 copy against the pixel they should take.
+ * Returns the number of wrong pixels */
+static int check_transforms()
+{
+    const int w = 37, h = 23;
+    sw_surface_t src = make_surface(w, h, SW_FORMAT_RGBA_8888, 1);
+    sw_surface_t dst = make_surface(w > h ? w : h, w > h ? w : h,
+                                    SW_FORMAT_RGBA_8888, 2);
+    const uint32_t *s = (const uint32_t *)src.base;
+    const uint32_t *d = (const uint32_t *)dst.base;
+    int errors = 0;
+
+    for (int transform = 0; transform < 8; transform++) {
+        bool rot = transform & SW_TRANSFORM_ROT_90;
+        sw_blit_t blit;
+        memset(&blit, 0, sizeof(blit));
+        blit.src = src;
+        blit.dst = dst;
+        blit.src_rect = (sw_rect_t){ 0, 0, w, h };
+        blit.dst_rect = (sw_rect_t){ 0, 0, rot ? h : w, rot ? w : h };
+        blit.clip = blit.dst_rect;
+        blit.transform = transform;
+        blit.plane_alpha = -1;
+        sw_blit(&blit);
+
+        for (int y = 0; y < blit.dst_rect.b; y++) {
+            for (int x = 0; x < blit.dst_rect.r; x++) {
+                // undo the rotation (clockwise), then the flips
+                int sx = rot ? y : x;
+                int sy = rot ? h - 1 - x : y;
+                if (transform & SW_TRANSFORM_FLIP_H)
+                    sx = w - 1 - sx;
+                if (transform & SW_TRANSFORM_FLIP_V)
+                    sy = h - 1 - sy;
+                errors += (d[y * dst.stride + x] != s[sy * src.stride + sx]);
+            }
+        }
+    }
+    printf("transforms: %s\n", errors ? "MISMATCH" : "ok");
+    free(src.base);
+    free(dst.base);
+    return errors;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : 50;
+    if (iterations < 1)
+        iterations = 1;
+
+    int errors = check_transforms();
+
+    sw_surface_t rgba = make_surface(1280, 720, SW_FORMAT_RGBA_8888, 3);
+    sw_surface_t bgra = make_surface(1280, 720, SW_FORMAT_BGRA_8888, 4);
+    sw_surface_t small = make_surface(320, 180, SW_FORMAT_RGBA_8888, 5);
+    sw_surface_t fb565 = make_surface(1280, 720, SW_FORMAT_RGB_565, 6);
+    sw_surface_t fb8888 = make_surface(1280, 720, SW_FORMAT_RGBA_8888, 7);
+    sw_surface_t rgbx = make_surface(720, 1280, SW_FORMAT_RGBX_8888, 8);
+
+    sw_blit_t blit;
+    memset(&blit, 0, sizeof(blit));
+    blit.src = rgba;
+    blit.dst = fb8888;
+    blit.src_rect = (sw_rect_t){ 0, 0, 1280, 720 };
+    blit.dst_rect = blit.src_rect;
+    blit.clip = blit.dst_rect;
+    blit.plane_alpha = 255;
+    blit.premultiplied = true;
+    errors += bench_blit("premultiplied 1:1", blit, iterations);
+
+    blit.plane_alpha = 160;
+    errors += bench_blit("premultiplied plane alpha", blit, iterations);
+
+    blit.src = bgra;
+    blit.dst = fb565;
+    blit.premultiplied = false;
+    blit.dither = true;
+    errors += bench_blit("coverage, dithered", blit, iterations);
+
+    blit.src = small;
+    blit.src_rect = (sw_rect_t){ 0, 0, 320, 180 };
+    blit.dst = fb8888;
+    blit.plane_alpha = 255;
+    blit.premultiplied = true;
+    blit.dither = false;
+    errors += bench_blit("premultiplied 4x upscale", blit, iterations);
+
+    blit.src = rgbx;
+    blit.src_rect = (sw_rect_t){ 0, 0, 720, 1280 };
+    blit.transform = SW_TRANSFORM_ROT_90;
+    blit.plane_alpha = -1;
+    errors += bench_blit("copy, rotated 90", blit, iterations);
+
+    blit.src = rgba;
+    blit.src_rect = (sw_rect_t){ 0, 0, 1280, 720 };
+    blit.dst_rect = (sw_rect_t){ 0, 0, 427, 240 };
+    blit.clip = blit.dst_rect;
+    blit.transform = 0;
+    blit.plane_alpha = 255;
+    errors += bench_blit("premultiplied 3x downscale", blit, iterations);
+
+    errors += bench_fill(fb8888, 0x80406080, iterations);
+    errors += bench_fill(fb565, 0xc0406080, iterations);
+    errors += bench_fill(fb565, 0xff406080, iterations);
+
+    free(rgba.base);
+    free(bgra.base);
+    free(small.base);
+    free(fb565.base);
+    free(fb8888.base);
+    free(rgbx.base);
+    return errors ? 1 : 0;
+}
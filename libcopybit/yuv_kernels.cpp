@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of Code Aurora Forum, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__ARM_HAVE_NEON) || defined(__ARM_NEON__)
+#define YUV_KERNELS_NEON 1
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#define YUV_KERNELS_SSE2 1
+#include <emmintrin.h>
+#ifdef __AVX2__
+#define YUV_KERNELS_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+#include "yuv_kernels.h"
+
+// Bands smaller than this are not worth waking a worker for
+#define MIN_BAND_BYTES (128 * 1024)
+
+/******************************************************************************/
+
+/* Row kernels */
+
+static void interleave_row(uint8_t *dst, const uint8_t *a, const uint8_t *b,
+                           int width)
+{
+    int i = 0;
+#if defined(YUV_KERNELS_NEON)
+    for (; i + 16 <= width; i += 16) {
+        uint8x16x2_t pair;
+        pair.val[0] = vld1q_u8(a + i);
+        pair.val[1] = vld1q_u8(b + i);
+        vst2q_u8(dst + 2*i, pair);
+    }
+#elif defined(YUV_KERNELS_SSE2)
+#if defined(YUV_KERNELS_AVX2)
+    for (; i + 32 <= width; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        // unpack works within the 128-bit lanes, put them back in order
+        __m256i lo = _mm256_unpacklo_epi8(va, vb);
+        __m256i hi = _mm256_unpackhi_epi8(va, vb);
+        _mm256_storeu_si256((__m256i *)(dst + 2*i),
+                            _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + 2*i + 32),
+                            _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+#endif
+    for (; i + 16 <= width; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(dst + 2*i), _mm_unpacklo_epi8(va, vb));
+        _mm_storeu_si128((__m128i *)(dst + 2*i + 16), _mm_unpackhi_epi8(va, vb));
+    }
+#endif
+    for (; i < width; i++) {
+        dst[2*i] = a[i];
+        dst[2*i + 1] = b[i];
+    }
+}
+
+/******************************************************************************/
+
+/* Worker pool */
+
+struct band_job_t {
+    yuv_band_func_t func;
+    const void *args;
+    int rows;
+    int bandRows;
+    int bands;
+    int next;       // next band to take
+    int done;       // bands completed
+};
+
+static pthread_once_t sPoolOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t sCallLock = PTHREAD_MUTEX_INITIALIZER; // one job at a time
+static pthread_mutex_t sJobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sJobReady = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sJobDone = PTHREAD_COND_INITIALIZER;
+static band_job_t sJob;
+static unsigned int sJobSeq = 0;
+static int sNumWorkers = 0;
+static int sMaxThreads = 0;
+
+/* take and run the bands of the current job, with sJobLock held */
+static void run_bands(band_job_t& job)
+{
+    while (job.next < job.bands) {
+        int band = job.next++;
+        pthread_mutex_unlock(&sJobLock);
+        int first = band * job.bandRows;
+        int rows = job.rows - first;
+        if (rows > job.bandRows)
+            rows = job.bandRows;
+        job.func(job.args, first, rows);
+        pthread_mutex_lock(&sJobLock);
+        if (++job.done == job.bands)
+            pthread_cond_broadcast(&sJobDone);
+    }
+}
+
+static void *worker_thread(void *)
+{
+    unsigned int seen = 0;
+    pthread_mutex_lock(&sJobLock);
+    for (;;) {
+        while (sJobSeq == seen)
+            pthread_cond_wait(&sJobReady, &sJobLock);
+        seen = sJobSeq;
+        run_bands(sJob);
+    }
+    return NULL;
+}
+
+static void init_pool()
+{
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+    if (sMaxThreads == 0)
+        sMaxThreads = (cpus < YUV_MAX_THREADS) ? cpus : YUV_MAX_THREADS;
+
+    for (int i = 0; i < YUV_MAX_THREADS - 1 && i < cpus - 1; i++) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, worker_thread, NULL) == 0)
+            sNumWorkers++;
+        pthread_attr_destroy(&attr);
+    }
+}
+
+void yuv_set_max_threads(int count)
+{
+    pthread_mutex_lock(&sCallLock);
+    sMaxThreads = (count < 1) ? 1 :
+                  ((count > YUV_MAX_THREADS) ? YUV_MAX_THREADS : count);
+    pthread_mutex_unlock(&sCallLock);
+}
+
+void yuv_run_bands(yuv_band_func_t func, const void *args, int rows,
+                   int bytesPerRow)
+{
+    if (rows <= 0)
+        return;
+    pthread_once(&sPoolOnce, init_pool);
+    pthread_mutex_lock(&sCallLock);
+
+    int bands = 1;
+    if (bytesPerRow > 0)
+        bands = (int)(((int64_t)rows * bytesPerRow) / MIN_BAND_BYTES);
+    int threads = sMaxThreads;
+    if (threads > sNumWorkers + 1)
+        threads = sNumWorkers + 1;
+    if (bands > threads)
+        bands = threads;
+    if (bands > rows)
+        bands = rows;
+
+    if (bands <= 1) {
+        pthread_mutex_unlock(&sCallLock);
+        func(args, 0, rows);
+        return;
+    }
+
+    pthread_mutex_lock(&sJobLock);
+    sJob.func = func;
+    sJob.args = args;
+    sJob.rows = rows;
+    sJob.bandRows = (rows + bands - 1) / bands;
+    sJob.bands = (rows + sJob.bandRows - 1) / sJob.bandRows;
+    sJob.next = 0;
+    sJob.done = 0;
+    sJobSeq++;
+    pthread_cond_broadcast(&sJobReady);
+    run_bands(sJob);
+    while (sJob.done < sJob.bands)
+        pthread_cond_wait(&sJobDone, &sJobLock);
+    pthread_mutex_unlock(&sJobLock);
+    pthread_mutex_unlock(&sCallLock);
+}
+
+/******************************************************************************/
+
+/* Plane kernels */
+
+struct plane_args_t {
+    uint8_t *dst;
+    int dstStride;
+    const uint8_t *a;
+    const uint8_t *b;
+    int srcStride;
+    int width;
+};
+
+static void copy_band(const void *data, int firstRow, int rows)
+{
+    const plane_args_t *args = (const plane_args_t *)data;
+    uint8_t *dst = args->dst + firstRow * args->dstStride;
+    const uint8_t *src = args->a + firstRow * args->srcStride;
+    if (args->dstStride == args->width && args->srcStride == args->width) {
+        memcpy(dst, src, rows * args->width);
+        return;
+    }
+    for (int i = 0; i < rows; i++) {
+        memcpy(dst, src, args->width);
+        dst += args->dstStride;
+        src += args->srcStride;
+    }
+}
+
+void yuv_copy_plane(uint8_t *dst, int dstStride,
+                    const uint8_t *src, int srcStride,
+                    int width, int rows)
+{
+    plane_args_t args = { dst, dstStride, src, NULL, srcStride, width };
+    yuv_run_bands(copy_band, &args, rows, width);
+}
+
+static void interleave_band(const void *data, int firstRow, int rows)
+{
+    const plane_args_t *args = (const plane_args_t *)data;
+    uint8_t *dst = args->dst + firstRow * args->dstStride;
+    const uint8_t *a = args->a + firstRow * args->srcStride;
+    const uint8_t *b = args->b + firstRow * args->srcStride;
+    for (int i = 0; i < rows; i++) {
+        interleave_row(dst, a, b, args->width);
+        dst += args->dstStride;
+        a += args->srcStride;
+        b += args->srcStride;
+    }
+}
+
+void yuv_interleave_planes(uint8_t *dst, int dstStride,
+                           const uint8_t *a, const uint8_t *b, int srcStride,
+                           int width, int rows)
+{
+    plane_args_t args = { dst, dstStride, a, b, srcStride, width };
+    yuv_run_bands(interleave_band, &args, rows, 2 * width);
+}
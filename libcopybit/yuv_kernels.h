@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of Code Aurora Forum, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef COPYBIT_YUV_KERNELS_H
+#define COPYBIT_YUV_KERNELS_H
+
+#include <stdint.h>
+
+/*
+ * Plane kernels of the software converters. Each call splits its rows
+ * into bands run on a small pool of worker threads, and the rows are
+ * processed with NEON, SSE2 or AVX2 when built for them. The kernels only
+ * depend on libc and pthreads, so that they can be built for the host.
+ */
+
+/*
+ * Copy the rows of a plane between buffers of different strides.
+ *
+ * @param: destination plane and its stride in bytes
+ * @param: source plane and its stride in bytes
+ * @param: number of bytes copied per row
+ * @param: number of rows
+ */
+void yuv_copy_plane(uint8_t *dst, int dstStride,
+                    const uint8_t *src, int srcStride,
+                    int width, int rows);
+
+/*
+ * Interleave the rows of two planes into one, as a[0] b[0] a[1] b[1] ...
+ * This turns the separate chroma planes of YV12 into the CrCb plane of
+ * YCrCb_420_SP.
+ *
+ * @param: destination plane and its stride in bytes
+ * @param: source planes and their stride in bytes
+ * @param: number of samples taken per row from each source plane
+ * @param: number of rows
+ */
+void yuv_interleave_planes(uint8_t *dst, int dstStride,
+                           const uint8_t *a, const uint8_t *b, int srcStride,
+                           int width, int rows);
+
+/*
+ * Run func over rows split into bands, on the worker pool of the kernels
+ * and the calling thread. Planes under a few hundred KB are run on the
+ * calling thread alone.
+ *
+ * @param: function run on each band, given args and its rows
+ * @param: arguments passed to func
+ * @param: number of rows
+ * @param: number of bytes processed per row
+ */
+typedef void (*yuv_band_func_t)(const void *args, int firstRow, int rows);
+void yuv_run_bands(yuv_band_func_t func, const void *args, int rows,
+                   int bytesPerRow);
+
+/*
+ * Set the number of threads, the caller included, the kernels run on.
+ * Defaults to the number of online CPUs, up to YUV_MAX_THREADS.
+ */
+#define YUV_MAX_THREADS 4
+void yuv_set_max_threads(int count);
+
+#endif /* COPYBIT_YUV_KERNELS_H */
@@ -939,6 +939,11 @@ int mapFrameBufferLocked(struct private_module_t* module)
 
     module->numBuffers = info.yres_virtual / info.yres;
     module->bufferMask = 0;
+    module->fbWidth = info.xres;
+    module->fbHeight = info.yres;
+    module->fbStride = finfo.line_length / (info.bits_per_pixel >> 3);
+    module->fbBufferSize = finfo.line_length * info.yres;
+    module->fbBufferOffset = 0;
 
     void* vaddr = mmap(0, fbSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
     if (vaddr == MAP_FAILED) {
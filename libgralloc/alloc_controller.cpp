@@ -445,6 +445,7 @@ void free_buffer(private_handle_t *hnd)
     android::sp<gralloc::IAllocController> sAlloc =
         gralloc::IAllocController::getInstance(false);
     if (hnd && hnd->fd > 0) {
+        notifyBufferRelease(hnd);
         sp<IMemAlloc> memalloc = sAlloc->getAllocator(hnd->flags);
         memalloc->free_buffer((void*)hnd->base, hnd->size, hnd->offset, hnd->fd);
     }
@@ -452,3 +453,52 @@ void free_buffer(private_handle_t *hnd)
         delete hnd;
 
 }
+
+// Buffer release hooks
+#define MAX_BUFFER_RELEASE_HOOKS 4
+
+static struct {
+    buffer_release_hook_t hook;
+    void *data;
+} sReleaseHooks[MAX_BUFFER_RELEASE_HOOKS];
+static pthread_mutex_t sReleaseHookLock = PTHREAD_MUTEX_INITIALIZER;
+
+int addBufferReleaseHook(buffer_release_hook_t hook, void *data)
+{
+    int err = -ENOMEM;
+    pthread_mutex_lock(&sReleaseHookLock);
+    for (int i = 0; i < MAX_BUFFER_RELEASE_HOOKS; i++) {
+        if (!sReleaseHooks[i].hook) {
+            sReleaseHooks[i].hook = hook;
+            sReleaseHooks[i].data = data;
+            err = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sReleaseHookLock);
+    if (err)
+        LOGE("%s: no free hook slot", __FUNCTION__);
+    return err;
+}
+
+void removeBufferReleaseHook(buffer_release_hook_t hook, void *data)
+{
+    pthread_mutex_lock(&sReleaseHookLock);
+    for (int i = 0; i < MAX_BUFFER_RELEASE_HOOKS; i++) {
+        if (sReleaseHooks[i].hook == hook && sReleaseHooks[i].data == data) {
+            sReleaseHooks[i].hook = NULL;
+            sReleaseHooks[i].data = NULL;
+        }
+    }
+    pthread_mutex_unlock(&sReleaseHookLock);
+}
+
+void notifyBufferRelease(const private_handle_t *hnd)
+{
+    pthread_mutex_lock(&sReleaseHookLock);
+    for (int i = 0; i < MAX_BUFFER_RELEASE_HOOKS; i++) {
+        if (sReleaseHooks[i].hook)
+            sReleaseHooks[i].hook(sReleaseHooks[i].data, hnd);
+    }
+    pthread_mutex_unlock(&sReleaseHookLock);
+}
@@ -154,6 +154,14 @@ struct private_module_t {
 
     struct fb_var_screeninfo info;
     struct fb_fix_screeninfo finfo;
+    // Geometry of the framebuffers handed out for rendering. They can be
+    // smaller than the panel (info.xres x info.yres), and are then upscaled
+    // into the panel buffers, placed first in the fb memory, when posted.
+    uint32_t fbWidth;
+    uint32_t fbHeight;
+    uint32_t fbStride;      // In pixels
+    size_t fbBufferSize;    // Page aligned size of one framebuffer
+    size_t fbBufferOffset;  // Offset of the first framebuffer
     float xdpi;
     float ydpi;
     float fps;
@@ -59,6 +59,8 @@
 namespace ovutils = overlay2::utils;
 
 #define FB_DEBUG 0
+// Smallest size, in percent of the panel, framebuffers may be rendered at
+#define FB_MIN_SCALE 50
 
 #if defined(HDMI_DUAL_DISPLAY)
 #define EVEN_OUT(x) if (x & 0x0001) {x--;}
@@ -102,6 +104,9 @@ msm_copy_buffer(buffer_handle_t handle, int fd,
                 int width, int height, int format,
                 int x, int y, int w, int h);
 
+static void
+msm_scale_buffer(private_module_t* m, size_t srcOffset, size_t dstOffset);
+
 static int fb_setSwapInterval(struct framebuffer_device_t* dev,
             int interval)
 {
@@ -139,6 +144,7 @@ static void *disp_loop(void *ptr)
 {
     struct qbuf_t nxtBuf;
     static int cur_buf=-1;
+    int panelIdx = 0;
     private_module_t *m = reinterpret_cast<private_module_t*>(ptr);
 
     while (1) {
@@ -157,7 +163,15 @@ static void *disp_loop(void *ptr)
         // post buf out to display synchronously
         private_handle_t const* hnd = reinterpret_cast<private_handle_t const*>
                                                 (nxtBuf.buf);
-        const size_t offset = hnd->base - m->framebuffer->base;
+        size_t offset = hnd->base - m->framebuffer->base;
+        if (m->fbBufferOffset) {
+            // Upscale into the panel buffer not being scanned out, the
+            // scaled mode is only used with page flipping
+            panelIdx ^= 1;
+            size_t panelOffset = panelIdx * (m->fbBufferOffset / 2);
+            msm_scale_buffer(m, offset, panelOffset);
+            offset = panelOffset;
+        }
         m->info.activate = FB_ACTIVATE_VBL;
         m->info.yoffset = offset / m->finfo.line_length;
 
@@ -377,7 +391,10 @@ static void *hdmi_ui_loop(void *ptr)
             unsigned int width = alignedW;
             unsigned int height = hnd->height;
             unsigned int format = hnd->format;
-            unsigned int size = hnd->size/m->numBuffers;
+            // One panel buffer, the framebuffer also holds the scaled ones
+            // when rendering below the panel resolution
+            unsigned int size = roundUpToPageSize(m->finfo.line_length *
+                                                  m->info.yres);
 
             ovutils::eMdpFlags mdpFlags = ovutils::OV_MDP_FLAGS_NONE;
             // External display connected during secure video playback
@@ -840,10 +857,41 @@ int mapFrameBufferLocked(struct private_module_t* module)
     //adreno needs 4k aligned offsets. Max hole size is 4096-1
     int  size = roundUpToPageSize(info.yres * info.xres * (info.bits_per_pixel/8));
 
+    /*
+     * Optionally render at a reduced resolution, to save GPU fill rate on
+     * large panels. The MDP upscales each posted framebuffer into one of two
+     * panel sized buffers placed first in the fb memory.
+     */
+    uint32_t fbWidth = info.xres;
+    uint32_t fbHeight = info.yres;
+    size_t fbBufferOffset = 0;
+    if (property_get("debug.gralloc.fb_scale", property, NULL) > 0) {
+        int scale = atoi(property);
+        uint32_t w = (info.xres * scale / 100) & ~1;
+        uint32_t h = (info.yres * scale / 100) & ~1;
+        size_t scaledSize = roundUpToPageSize(ALIGN(w, 32) * h *
+                                              (info.bits_per_pixel/8));
+        if ((scale < FB_MIN_SCALE) || (scale >= 100)) {
+            LOGW("Out of range (%d to 99) value for debug.gralloc.fb_scale",
+                 FB_MIN_SCALE);
+        } else if (finfo.smem_len <
+                   (2 * size + NUM_FRAMEBUFFERS_MIN * scaledSize)) {
+            LOGW("Not enough framebuffer memory to render at %d%%", scale);
+        } else {
+            fbWidth = w;
+            fbHeight = h;
+            fbBufferOffset = 2 * size;
+        }
+    }
+    size_t fbBufferSize = fbBufferOffset ?
+            roundUpToPageSize(ALIGN(fbWidth, 32) * fbHeight *
+                              (info.bits_per_pixel/8)) : size;
+
     /*
      * Request NUM_BUFFERS screens (at lest 2 for page flipping)
      */
-    int numberOfBuffers = (int)(finfo.smem_len/size);
+    int numberOfBuffers = (int)((finfo.smem_len - fbBufferOffset) /
+                                fbBufferSize);
     LOGV("num supported framebuffers in kernel = %d", numberOfBuffers);
 
     if (property_get("debug.gr.numframebuffers", property, NULL) > 0) {
@@ -859,7 +907,10 @@ int mapFrameBufferLocked(struct private_module_t* module)
 
     //consider the included hole by 4k alignment
     uint32_t line_length = (info.xres * info.bits_per_pixel / 8);
-    info.yres_virtual = (size * numberOfBuffers) / line_length;
+    if (fbBufferOffset)
+        info.yres_virtual = fbBufferOffset / line_length;
+    else
+        info.yres_virtual = (size * numberOfBuffers) / line_length;
 
     uint32_t flags = PAGE_FLIP;
     if (ioctl(fd, FBIOPUT_VSCREENINFO, &info) == -1) {
@@ -876,6 +927,16 @@ int mapFrameBufferLocked(struct private_module_t* module)
                 info.yres_virtual, info.yres*2);
     }
 
+    if (fbBufferOffset && !(flags & PAGE_FLIP)) {
+        // Without a second panel buffer, the upscale would write the one
+        // being scanned out
+        LOGW("Rendering at panel resolution, without page flipping");
+        fbWidth = info.xres;
+        fbHeight = info.yres;
+        fbBufferOffset = 0;
+        fbBufferSize = size;
+    }
+
     if (ioctl(fd, FBIOGET_VSCREENINFO, &info) == -1)
         return -errno;
 
@@ -886,8 +947,8 @@ int mapFrameBufferLocked(struct private_module_t* module)
         info.height = ((info.yres * 25.4f)/160.0f + 0.5f);
     }
 
-    float xdpi = (info.xres * 25.4f) / info.width;
-    float ydpi = (info.yres * 25.4f) / info.height;
+    float xdpi = (fbWidth * 25.4f) / info.width;
+    float ydpi = (fbHeight * 25.4f) / info.height;
     //The reserved[4] field is used to store FPS by the driver.
     float fps  = info.reserved[4];
 
@@ -975,10 +1036,23 @@ int mapFrameBufferLocked(struct private_module_t* module)
      */
 
     int err;
-    module->numBuffers = info.yres_virtual / info.yres;
     module->bufferMask = 0;
-    //adreno needs page aligned offsets. Align the fbsize to pagesize.
-    size_t fbSize = roundUpToPageSize(finfo.line_length * info.yres) * module->numBuffers;
+    if (fbBufferOffset) {
+        module->numBuffers = numberOfBuffers;
+        module->fbStride = ALIGN(fbWidth, 32);
+        LOGI("rendering at %dx%d, upscaled to %dx%d", fbWidth, fbHeight,
+             info.xres, info.yres);
+    } else {
+        module->numBuffers = info.yres_virtual / info.yres;
+        module->fbStride = finfo.line_length / (info.bits_per_pixel >> 3);
+        //adreno needs page aligned offsets. Align the fbsize to pagesize.
+        fbBufferSize = roundUpToPageSize(finfo.line_length * info.yres);
+    }
+    module->fbWidth = fbWidth;
+    module->fbHeight = fbHeight;
+    module->fbBufferSize = fbBufferSize;
+    module->fbBufferOffset = fbBufferOffset;
+    size_t fbSize = fbBufferOffset + fbBufferSize * module->numBuffers;
     module->framebuffer = new private_handle_t(fd, fbSize,
                             private_handle_t::PRIV_FLAGS_USES_PMEM, BUFFER_TYPE_UI,
                             module->fbFormat, info.xres, info.yres);
@@ -1064,11 +1138,10 @@ int fb_device_open(hw_module_t const* module, const char* name,
         private_module_t* m = (private_module_t*)module;
         status = mapFrameBuffer(m);
         if (status >= 0) {
-            int stride = m->finfo.line_length / (m->info.bits_per_pixel >> 3);
             const_cast<uint32_t&>(dev->device.flags) = 0;
-            const_cast<uint32_t&>(dev->device.width) = m->info.xres;
-            const_cast<uint32_t&>(dev->device.height) = m->info.yres;
-            const_cast<int&>(dev->device.stride) = stride;
+            const_cast<uint32_t&>(dev->device.width) = m->fbWidth;
+            const_cast<uint32_t&>(dev->device.height) = m->fbHeight;
+            const_cast<int&>(dev->device.stride) = m->fbStride;
             const_cast<int&>(dev->device.format) = m->fbFormat;
             const_cast<float&>(dev->device.xdpi) = m->xdpi;
             const_cast<float&>(dev->device.ydpi) = m->ydpi;
@@ -1130,3 +1203,43 @@ msm_copy_buffer(buffer_handle_t handle, int fd,
     if (ioctl(fd, MSMFB_BLIT, &blit))
         LOGE("MSMFB_BLIT failed = %d", -errno);
 }
+
+/* Upscale a framebuffer into a panel buffer of the fb memory */
+
+static void
+msm_scale_buffer(private_module_t* m, size_t srcOffset, size_t dstOffset)
+{
+    struct {
+        unsigned int count;
+        mdp_blit_req req;
+    } blit;
+    int fd = m->framebuffer->fd;
+    int format = ovutils::getMdpFormat(m->fbFormat);
+
+    memset(&blit, 0, sizeof(blit));
+    blit.count = 1;
+
+    blit.req.flags = 0;
+    blit.req.alpha = 0xff;
+    blit.req.transp_mask = 0xffffffff;
+
+    blit.req.src.width = m->fbStride;
+    blit.req.src.height = m->fbHeight;
+    blit.req.src.format = format;
+    blit.req.src.offset = srcOffset;
+    blit.req.src.memory_id = fd;
+
+    blit.req.dst.width = m->finfo.line_length / (m->info.bits_per_pixel >> 3);
+    blit.req.dst.height = m->info.yres;
+    blit.req.dst.format = format;
+    blit.req.dst.offset = dstOffset;
+    blit.req.dst.memory_id = fd;
+
+    blit.req.src_rect.w = m->fbWidth;
+    blit.req.src_rect.h = m->fbHeight;
+    blit.req.dst_rect.w = m->info.xres;
+    blit.req.dst_rect.h = m->info.yres;
+
+    if (ioctl(fd, MSMFB_BLIT, &blit))
+        LOGE("MSMFB_BLIT failed = %d", -errno);
+}
@@ -68,7 +68,7 @@ int gpu_context_t::gralloc_alloc_framebuffer_locked(size_t size, int usage,
 
     const uint32_t bufferMask = m->bufferMask;
     const uint32_t numBuffers = m->numBuffers;
-    size_t bufferSize = m->finfo.line_length * m->info.yres;
+    size_t bufferSize = m->fbBufferSize;
 
     //adreno needs FB size to be page aligned
     bufferSize = roundUpToPageSize(bufferSize);
@@ -79,7 +79,7 @@ int gpu_context_t::gralloc_alloc_framebuffer_locked(size_t size, int usage,
         // screen when post is called.
         int newUsage = (usage & ~GRALLOC_USAGE_HW_FB) | GRALLOC_USAGE_HW_2D;
         return gralloc_alloc_buffer(bufferSize, newUsage, pHandle, BUFFER_TYPE_UI,
-                                    m->fbFormat, m->info.xres, m->info.yres);
+                                    m->fbFormat, m->fbWidth, m->fbHeight);
     }
 
     if (bufferMask >= ((1LU<<numBuffers)-1)) {
@@ -90,12 +90,12 @@ int gpu_context_t::gralloc_alloc_framebuffer_locked(size_t size, int usage,
     // create a "fake" handles for it
     // Set the PMEM flag as well, since adreno
     // treats the FB memory as pmem
-    intptr_t vaddr = intptr_t(m->framebuffer->base);
+    intptr_t vaddr = intptr_t(m->framebuffer->base) + m->fbBufferOffset;
     private_handle_t* hnd = new private_handle_t(dup(m->framebuffer->fd), bufferSize,
                                                  private_handle_t::PRIV_FLAGS_USES_PMEM |
                                                  private_handle_t::PRIV_FLAGS_FRAMEBUFFER,
-                                                 BUFFER_TYPE_UI, m->fbFormat, m->info.xres,
-                                                 m->info.yres);
+                                                 BUFFER_TYPE_UI, m->fbFormat, m->fbWidth,
+                                                 m->fbHeight);
 
     // find a free slot
     for (uint32_t i=0 ; i<numBuffers ; i++) {
@@ -246,10 +246,12 @@ int gpu_context_t::free_impl(private_handle_t const* hnd) {
     private_module_t* m = reinterpret_cast<private_module_t*>(common.module);
     if (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) {
         // free this buffer
-        const size_t bufferSize = m->finfo.line_length * m->info.yres;
-        int index = (hnd->base - m->framebuffer->base) / bufferSize;
+        const size_t bufferSize = roundUpToPageSize(m->fbBufferSize);
+        int index = (hnd->base - m->framebuffer->base - m->fbBufferOffset) /
+                    bufferSize;
         m->bufferMask &= ~(1<<index);
     } else {
+        notifyBufferRelease(hnd);
         terminateBuffer(&m->base, const_cast<private_handle_t*>(hnd));
         sp<IMemAlloc> memalloc = mAllocCtrl->getAllocator(hnd->flags);
         if (memalloc == NULL) {
@@ -62,6 +62,14 @@ int decideBufferHandlingMechanism(int format, const char *compositionUsed,
 int alloc_buffer(private_handle_t **pHnd, int w, int h, int format, int usage);
 void free_buffer(private_handle_t *hnd);
 
+// Hooks called before a buffer is freed or unregistered in this process,
+// for the users keeping state per buffer such as GPU mappings.
+// The hook must not call back into the allocator.
+typedef void (*buffer_release_hook_t)(void *data, const private_handle_t *hnd);
+int addBufferReleaseHook(buffer_release_hook_t hook, void *data);
+void removeBufferReleaseHook(buffer_release_hook_t hook, void *data);
+void notifyBufferRelease(const private_handle_t *hnd);
+
 /*****************************************************************************/
 
 class Locker {
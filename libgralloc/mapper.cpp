@@ -179,6 +179,7 @@ int gralloc_unregister_buffer(gralloc_module_t const* module,
 
     // never unmap buffers that were created in this process
     if (hnd->pid != getpid()) {
+        notifyBufferRelease(hnd);
         if (hnd->base != 0) {
             gralloc_unmap(module, handle);
         }
@@ -27,6 +27,7 @@
 #include <cutils/log.h>
 #include <cutils/atomic.h>
 #include <cutils/properties.h>
+#include <utils/Timers.h>
 
 #include <gralloc_priv.h>
 #include <fb_priv.h>
@@ -38,10 +39,11 @@
 #include <ui/android_native_buffer.h>
 #include <genlock.h>
 #include <qcom_ui.h>
-#include <utils/comptype.h>
 #include <gr.h>
 #include <utils/profiler.h>
 #include <utils/IdleInvalidator.h>
+#include <utils/RuntimeConfig.h>
+#include <utils/CommitThread.h>
 
 #include <overlayMgr.h>
 #include <overlayMgrSingleton.h>
@@ -53,12 +55,51 @@ namespace ovutils = overlay2::utils;
 #define UNLIKELY( exp )     (__builtin_expect( (exp) != 0, false ))
 
 #define DEBUG_HWC 0
+// Number of layers, from the bottom of the list, tracked across frames
+#define MAX_TRACKED_LAYERS 32
+// Frames a layer must stay unchanged before it is considered static
+#define STATIC_LAYER_MIN_FRAMES 5
+// Frames the static cache may stay unused before its buffers are freed
+#define STATIC_CACHE_IDLE_FRAMES 60
+// Buffers the HWC can hold locked for the MDP pipes
+#define MAX_RELEASE_ENTRIES 32
+// Frames a pipe may keep fetching a buffer after replacing it
+#define DEFAULT_RELEASE_DEPTH 1
+#define MAX_RELEASE_DEPTH 8
+// Weight of a new sample in the smoothed path costs, as a power of two
+#define PATH_COST_SHIFT 3
+// Frames between two probes of the path not chosen for a layer class
+#define PATH_PROBE_FRAMES 120
+// The other path must be cheaper by this percentage ...
+#define PATH_SWITCH_MARGIN 20
+// ... for this many consecutive frames to be chosen
+#define PATH_SWITCH_FRAMES 30
+// Layers composed with a single copybit compose() call
+#define MAX_COPYBIT_BATCH 16
+// Buffers kept locked until copybit is done with them
+#define MAX_COPYBIT_LOCKS 32
+// Frames whose copybit layers cover at most this many pixels are blended
+// on the CPU, cheaper than waking the copybit hardware
+#define DEFAULT_CPU_COPYBIT_AREA (128 * 128)
 
 #ifdef COMPOSITION_BYPASS
 #define MAX_BYPASS_LAYERS 3
 #define BYPASS_DEBUG 0
 #define BYPASS_INDEX_OFFSET 4
 #define DEFAULT_IDLE_TIME 2000
+// Largest layer list the bypass planner will search, one bit per layer
+#define MAX_BYPASS_PLAN_LAYERS 32
+// Layers saving the most the bypass planner picks its subsets from
+#define MAX_BYPASS_CANDIDATES 6
+// Planner cost of programming and blending one more MDP pipe, in pixels
+#define BYPASS_PIPE_COST (64 * 1024)
+// Bypassed layers that may go through the MDP rotator in one frame
+#define MAX_BYPASS_ROTATED_LAYERS 1
+// The static cache is double buffered, to rebuild it while it is scanned out
+#define NUM_STATIC_CACHE_BUFFERS 2
+// Refresh rate assumed when the framebuffer does not report one
+#define DEFAULT_REFRESH_RATE 60
+#define BANDWIDTH_DEBUG 0
 
 enum BypassState {
     BYPASS_ON,
@@ -66,9 +107,18 @@ enum BypassState {
     BYPASS_OFF_PENDING,
 };
 
-enum BypassBufferLockState {
-    BYPASS_BUFFER_UNLOCKED,
-    BYPASS_BUFFER_LOCKED,
+/*
+ * The bottom most static layers, composed once with copybit into a buffer
+ * that is fetched by the first bypass pipe instead of the layers.
+ */
+struct hwc_static_cache_t {
+    private_handle_t *buffer[NUM_STATIC_CACHE_BUFFERS];
+    int current;        // Buffer holding the composed layers
+    int numLayers;      // Layers [0, numLayers) are in the current buffer
+    native_handle_t *handles[MAX_TRACKED_LAYERS];
+    bool valid;
+    bool active;        // Used by the current frame
+    int idleFrames;     // Frames since the cache was last used
 };
 #endif
 
@@ -85,24 +135,167 @@ enum eHWCOverlayStatus {
     HWC_OVERLAY_CLOSED
 };
 
+/*
+ * Pipe configuration last committed to the MDP for a layer. When the
+ * layer feeding a pipe is unchanged from the previous frame, the
+ * setSource/setParameter/setCrop/setPosition/commit sequence is skipped
+ * and the layer goes straight to queueBuffer in hwc_set.
+ */
+struct hwc_pipe_config_t {
+    bool valid;
+    ovutils::eOverlayState state;
+    int width;
+    int height;
+    int format;
+    int bufferFlags;
+    hwc_rect_t sourceCrop;
+    hwc_rect_t displayFrame;
+    uint32_t transform;
+    int32_t blending;
+    uint32_t flags;
+    int waitFlag;
+    int isFgFlag;
+    int orientation;
+};
+
+// Layer flags that do not affect the pipe configuration
+#define HWC_PIPE_CONFIG_IGNORED_FLAGS (HWC_LAYER_NOT_UPDATING | \
+        HWC_LAYER_ASYNCHRONOUS | HWC_COMP_BYPASS | HWC_BYPASS_INDEX_MASK)
+
+/* Per layer state kept across frames */
+struct hwc_layer_track_t {
+    native_handle_t *handle;
+    int staticFrames;   // Consecutive frames without update
+    uint32_t generation; // Bumped on every buffer update
+};
+
+/* A layer as it was when the framebuffer was last composed */
+struct hwc_fb_layer_t {
+    native_handle_t *handle;
+    uint32_t generation;
+    bool isFBComposed;  // Drawn into the framebuffer
+    bool clearsFB;      // Drawn by a pipe, cleared from the framebuffer
+    uint32_t transform;
+    int32_t blending;
+    uint8_t alpha;
+    hwc_rect_t sourceCrop;
+    hwc_rect_t displayFrame;
+};
+
+/* Area of a layer drawn by a pipe, as cleared from the framebuffers */
+struct hwc_fb_clear_t {
+    hwc_rect_t rect;
+    int pendingFrames;  // Framebuffers still to be cleared
+};
+
+/* A genlocked buffer fetched by MDP pipes */
+struct hwc_release_entry_t {
+    private_handle_t *hnd;
+    uint32_t frame;     // Frame the buffer was queued in
+    uint32_t pipes;     // Pipes still fetching it, as an ovutils::eDest mask
+};
+
+/*
+ * Buffers locked by the HWC for the MDP pipes, in queueing order. A buffer
+ * is released once every pipe it was queued on has displayed a frame that
+ * is depth frames newer, or has been closed.
+ */
+struct hwc_release_queue_t {
+    hwc_release_entry_t entries[MAX_RELEASE_ENTRIES];
+    int count;
+    int depth;
+    uint32_t frame;         // Frame being set
+    uint32_t playedPipes;   // Pipes played in the frame being set
+    uint32_t pendingFrame;  // Frame queued to the commit thread
+    uint32_t pendingPipes;  // Pipes it played
+};
+
+/* Overlay pipe opened ahead of a video layer moving to the overlay */
+struct hwc_overlay_warmup_t {
+    bool active;
+    int width;
+    int height;
+    int format;
+    int size;
+    uint32_t transform;
+};
+
+/*
+ * Estimated MDP fetch bandwidth of the frame being prepared, in KB/s.
+ * Pipe configurations that would exceed the budget are refused.
+ */
+struct hwc_bandwidth_t {
+    int budget;         // 0 if there is no limit
+    int used;           // Framebuffer and pipes configured so far
+    int last;           // Bandwidth of the last prepared frame
+    int peak;
+    int64_t total;      // Sum over the prepared frames, for the average
+    uint32_t frames;
+    uint32_t refused;   // Pipe configurations refused as over budget
+};
+
+/* Paths a layer can be composed with */
+enum CompositionPath {
+    COMP_PATH_COPYBIT,
+    COMP_PATH_GPU,
+    COMP_PATH_OVERLAY,
+    COMP_PATH_MAX
+};
+
+/* Layers are given a composition path per class */
+enum LayerClass {
+    LAYER_CLASS_RGB,
+    LAYER_CLASS_YUV,
+    LAYER_CLASS_MAX
+};
+
+/* Measured cost of a path, in ns per 1024 pixels of the destination */
+struct hwc_path_cost_t {
+    int64_t cost;       // Smoothed cost, valid once samples > 0
+    uint32_t samples;
+};
+
+/*
+ * Picks between copybit and the GPU for the layers of a class from their
+ * measured cost. The path not chosen is probed every PATH_PROBE_FRAMES
+ * frames to keep its cost current.
+ */
+struct hwc_path_policy_t {
+    hwc_path_cost_t costs[LAYER_CLASS_MAX][COMP_PATH_MAX];
+    int path[LAYER_CLASS_MAX];          // Chosen path, -1 until measured
+    int cheaperFrames[LAYER_CLASS_MAX]; // Frames the other path was cheaper
+    hwc_path_cost_t swapBase; // eglSwapBuffers ns without GPU composed layers
+    uint32_t frame;
+    uint32_t switches;
+    // Time spent and area drawn in the frame being set, per class and path
+    int64_t frameTime[LAYER_CLASS_MAX][COMP_PATH_MAX];
+    int64_t frameArea[LAYER_CLASS_MAX][COMP_PATH_MAX];
+};
+
 struct hwc_context_t {
     hwc_composer_device_t device;
     /* our private state goes below here */
     overlay2::OverlayMgr* mOverlayLibObject;
-    native_handle_t *previousOverlayHandle;
-    native_handle_t *currentOverlayHandle;
+    hwc_release_queue_t releaseQueue;
+    // Waits for the external display. The context is malloc'ed, so the
+    // strong reference is taken and dropped by hand.
+    CommitThread *commitThread;
+    CommitFrame commitFrame;  // Pipes of this frame to wait for
+    bool isCommitPending;     // Frame queued, its pipes not retired
     int yuvBufferCount;
+    int numVideoPipes;  // Video layers drawn with the VG pipes
+    int videoLayerIndex[ovutils::MAX_VG_PIPES]; // List index of each video
     int numLayersNotUpdating;
     int s3dLayerFormat;
     int numHwLayers;
     bool skipComposition;
 #ifdef COMPOSITION_BYPASS
-    native_handle_t* previousBypassHandle[MAX_BYPASS_LAYERS];
-    BypassBufferLockState bypassBufferLockState[MAX_BYPASS_LAYERS];
     int layerindex[MAX_BYPASS_LAYERS];
     int nPipesUsed;
     BypassState bypassState;
     IdleInvalidator *idleInvalidator;
+    bool isIdle;    // Frame frozen in the framebuffer until a layer changes
+    hwc_static_cache_t staticCache;
 #endif
     external_display_type mHDMIEnabled; // Type of external display
     bool pendingHDMI;
@@ -111,6 +304,22 @@ struct hwc_context_t {
     int previousLayerCount;
     eHWCOverlayStatus hwcOverlayStatus;
     int swapInterval;
+    hwc_pipe_config_t pipeConfig[ovutils::MAX_PIPES]; // Per pipe layer cache
+    hwc_layer_track_t layerTrack[MAX_TRACKED_LAYERS];
+    uint32_t lastGeneration; // Generations are unique across the layers
+    int numStaticLayers; // Static layers at the bottom of the list
+    hwc_fb_layer_t fbLayers[MAX_TRACKED_LAYERS];
+    int numFBLayers;     // Layers in fbLayers, -1 if the record is invalid
+    bool isFBSkipped;    // Framebuffer post skipped as its content is unchanged
+    hwc_fb_clear_t fbClears[MAX_TRACKED_LAYERS];
+    hwc_overlay_warmup_t overlayWarmUp;
+    hwc_path_policy_t pathPolicy;
+    hwc_bandwidth_t bandwidth;
+    // Buffers read by copybit blits that may still be running
+    private_handle_t *copybitLocks[MAX_COPYBIT_LOCKS];
+    int numCopybitLocks;
+    copybit_device_t *copybit; // Engine of this frame, NULL for copybitEngine
+    int cpuCopybitArea;        // Up to which frames are blended on the CPU
 };
 
 static int hwc_device_open(const struct hw_module_t* module,
@@ -125,9 +334,11 @@ static struct hw_module_methods_t hwc_module_methods = {
 struct private_hwc_module_t {
     hwc_module_t base;
     copybit_device_t *copybitEngine;
+    copybit_device_t *swCopybitEngine; // Blits on the CPU
     framebuffer_device_t *fbDevice;
     int compositionType;
     bool isBypassEnabled; //from build.prop ro.sf.compbypass.enable
+    bool isBypassRotatorEnabled; //Rotated layers may be bypassed
 };
 
 struct private_hwc_module_t HAL_MODULE_INFO_SYM = {
@@ -143,6 +354,7 @@ struct private_hwc_module_t HAL_MODULE_INFO_SYM = {
         }
    },
    copybitEngine: NULL,
+   swCopybitEngine: NULL,
    fbDevice: NULL,
    compositionType: 0,
    isBypassEnabled: false,
@@ -171,6 +383,310 @@ static inline int max(const int& a, const int& b) {
     return (a > b) ? a : b;
 }
 
+/*
+ * The framebuffer may be rendered below the panel resolution and upscaled
+ * by the MDP when posted (debug.gralloc.fb_scale). Scales a destination in
+ * framebuffer coordinates to the panel, on which the pipes are positioned.
+ */
+static void scaleToPanel(const hwc_context_t* ctx, ovutils::Dim& dim)
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    framebuffer_device_t *fbDev = hwcModule->fbDevice;
+    ovutils::FrameBufferInfo* fbInfo = ovutils::FrameBufferInfo::getInstance();
+    int panelWidth = fbInfo->getWidth();
+    int panelHeight = fbInfo->getHeight();
+    if (!fbDev || !fbDev->width || !fbDev->height ||
+        (((int)fbDev->width == panelWidth) &&
+         ((int)fbDev->height == panelHeight)))
+        return;
+
+    int right = (dim.x + dim.w) * panelWidth / fbDev->width;
+    int bottom = (dim.y + dim.h) * panelHeight / fbDev->height;
+    dim.x = dim.x * panelWidth / fbDev->width;
+    dim.y = dim.y * panelHeight / fbDev->height;
+    dim.w = right - dim.x;
+    dim.h = bottom - dim.y;
+}
+
+static inline bool isSameRect(const hwc_rect_t& a, const hwc_rect_t& b) {
+    return (a.left == b.left) && (a.top == b.top) &&
+           (a.right == b.right) && (a.bottom == b.bottom);
+}
+
+static inline bool isOverlapping(const hwc_rect_t& a, const hwc_rect_t& b) {
+    return (a.left < b.right) && (b.left < a.right) &&
+           (a.top < b.bottom) && (b.top < a.bottom);
+}
+
+/* Drop all the cached pipe configurations, forcing a full reconfiguration
+ * of the pipes in the next prepare */
+static void invalidatePipeConfigs(hwc_context_t* ctx)
+{
+    for (int i = 0; i < ovutils::MAX_PIPES; i++) {
+        ctx->pipeConfig[i].valid = false;
+    }
+}
+
+/* Fill the pipe configuration for the layer. The buffer handle itself is not
+ * part of the key: the buffer fd and offset are set on every queueBuffer, so
+ * only the buffer geometry matters to the pipe */
+static void getPipeConfig(hwc_pipe_config_t& cfg, ovutils::eOverlayState state,
+                          const hwc_layer_t* layer, const private_handle_t* hnd,
+                          int waitFlag, int isFgFlag, int orientation)
+{
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.valid = true;
+    cfg.state = state;
+    cfg.width = hnd->width;
+    cfg.height = hnd->height;
+    cfg.format = hnd->format;
+    cfg.bufferFlags = hnd->flags & (private_handle_t::PRIV_FLAGS_SECURE_BUFFER |
+                            private_handle_t::PRIV_FLAGS_NONCONTIGUOUS_MEM);
+    cfg.sourceCrop = layer->sourceCrop;
+    cfg.displayFrame = layer->displayFrame;
+    cfg.transform = layer->transform;
+    cfg.blending = layer->blending;
+    cfg.flags = layer->flags & ~HWC_PIPE_CONFIG_IGNORED_FLAGS;
+    cfg.waitFlag = waitFlag;
+    cfg.isFgFlag = isFgFlag;
+    cfg.orientation = orientation;
+}
+
+/* Returns true if the pipe at index has already been committed with cfg */
+static bool isPipeConfigCached(const hwc_context_t* ctx, int index,
+                               const hwc_pipe_config_t& cfg)
+{
+    if (index < 0 || index >= ovutils::MAX_PIPES)
+        return false;
+
+    const hwc_pipe_config_t& cached = ctx->pipeConfig[index];
+    if (!cached.valid)
+        return false;
+
+    overlay2::Overlay& ov = ctx->mOverlayLibObject->ov();
+    if (ov.getState() != cfg.state || cached.state != cfg.state)
+        return false;
+
+    return (cached.width == cfg.width) &&
+           (cached.height == cfg.height) &&
+           (cached.format == cfg.format) &&
+           (cached.bufferFlags == cfg.bufferFlags) &&
+           isSameRect(cached.sourceCrop, cfg.sourceCrop) &&
+           isSameRect(cached.displayFrame, cfg.displayFrame) &&
+           (cached.transform == cfg.transform) &&
+           (cached.blending == cfg.blending) &&
+           (cached.flags == cfg.flags) &&
+           (cached.waitFlag == cfg.waitFlag) &&
+           (cached.isFgFlag == cfg.isFgFlag) &&
+           (cached.orientation == cfg.orientation);
+}
+
+static inline void storePipeConfig(hwc_context_t* ctx, int index,
+                                   const hwc_pipe_config_t& cfg)
+{
+    if (index >= 0 && index < ovutils::MAX_PIPES)
+        ctx->pipeConfig[index] = cfg;
+}
+
+/*
+ * Updates the per layer history with the current list. A layer is static
+ * when it keeps its buffer and is flagged as not updating. The run of
+ * layers, from the bottom, static for STATIC_LAYER_MIN_FRAMES frames or
+ * more is counted in numStaticLayers.
+ */
+static void trackLayers(hwc_context_t* ctx, const hwc_layer_list_t* list)
+{
+    bool geometryChanged = (list->flags & HWC_GEOMETRY_CHANGED);
+    bool isBottomRun = true;
+    ctx->numStaticLayers = 0;
+
+    for (int i = 0; i < MAX_TRACKED_LAYERS; i++) {
+        hwc_layer_track_t& track = ctx->layerTrack[i];
+        if (i >= (int)list->numHwLayers) {
+            track.handle = NULL;
+            track.staticFrames = 0;
+            continue;
+        }
+
+        const hwc_layer_t& layer = list->hwLayers[i];
+        if (!geometryChanged && layer.handle &&
+            (layer.handle == track.handle) &&
+            (layer.flags & HWC_LAYER_NOT_UPDATING) &&
+            !(layer.flags & HWC_SKIP_LAYER)) {
+            if (track.staticFrames < STATIC_LAYER_MIN_FRAMES)
+                track.staticFrames++;
+        } else {
+            track.staticFrames = 0;
+            track.generation = ++ctx->lastGeneration;
+        }
+        track.handle = (native_handle_t*)layer.handle;
+
+        if (isBottomRun && track.staticFrames >= STATIC_LAYER_MIN_FRAMES)
+            ctx->numStaticLayers++;
+        else
+            isBottomRun = false;
+    }
+}
+
+/*
+ * Returns the generation of the buffer of a layer, which copybit uses to
+ * tell a source it has already seen from one with new content.
+ */
+static uint32_t getLayerGeneration(const hwc_context_t* ctx,
+                                   const hwc_layer_t* layer)
+{
+    uint32_t generation = 0;
+    for (int i = 0; i < MAX_TRACKED_LAYERS; i++) {
+        const hwc_layer_track_t& track = ctx->layerTrack[i];
+        if (layer->handle && (track.handle == layer->handle) &&
+            (track.generation > generation))
+            generation = track.generation;
+    }
+    return generation;
+}
+
+static inline bool isFBComposedLayer(const hwc_layer_t* layer) {
+    return (layer->compositionType == HWC_FRAMEBUFFER) ||
+           (layer->compositionType == HWC_USE_COPYBIT);
+}
+
+static void getFBLayer(const hwc_context_t* ctx, const hwc_layer_t* layer,
+                       int index, hwc_fb_layer_t& fbLayer)
+{
+    memset(&fbLayer, 0, sizeof(fbLayer));
+    fbLayer.isFBComposed = isFBComposedLayer(layer);
+    fbLayer.clearsFB = !fbLayer.isFBComposed &&
+                       (layer->hints & HWC_HINT_CLEAR_FB);
+    fbLayer.displayFrame = layer->displayFrame;
+    if (fbLayer.isFBComposed) {
+        fbLayer.handle = (native_handle_t*)layer->handle;
+        fbLayer.generation = ctx->layerTrack[index].generation;
+        fbLayer.transform = layer->transform;
+        fbLayer.blending = layer->blending;
+        fbLayer.alpha = layer->alpha;
+        fbLayer.sourceCrop = layer->sourceCrop;
+    }
+}
+
+static bool isSameFBLayer(const hwc_fb_layer_t& a, const hwc_fb_layer_t& b)
+{
+    if ((a.isFBComposed != b.isFBComposed) || (a.clearsFB != b.clearsFB))
+        return false;
+    if ((a.isFBComposed || a.clearsFB) &&
+        !isSameRect(a.displayFrame, b.displayFrame))
+        return false;
+    if (!a.isFBComposed)
+        return true;
+    return (a.handle == b.handle) && (a.generation == b.generation) &&
+           (a.transform == b.transform) && (a.blending == b.blending) &&
+           (a.alpha == b.alpha) && isSameRect(a.sourceCrop, b.sourceCrop);
+}
+
+/*
+ * Checks if composing the framebuffer would give the same content as the
+ * last composition. This is the case when the same layers go to the
+ * framebuffer, each with the same buffer, generation and geometry, and
+ * the same areas are cleared for the layers drawn by the MDP pipes.
+ * Must be called once the composition type of every layer is known.
+ */
+static bool isFBContentUnchanged(const hwc_context_t* ctx,
+                                 const hwc_layer_list_t* list)
+{
+    if (ctx->numFBLayers != (int)list->numHwLayers)
+        return false;
+
+    if (ctx->forceComposition || (list->flags & HWC_GEOMETRY_CHANGED))
+        return false;
+
+    for (int i = 0; i < ctx->numFBLayers; i++) {
+        const hwc_layer_t* layer = &list->hwLayers[i];
+        // The content of these layers cannot be tracked
+        if ((layer->flags & HWC_SKIP_LAYER) ||
+            (isFBComposedLayer(layer) && !layer->handle)) {
+            return false;
+        }
+
+        hwc_fb_layer_t fbLayer;
+        getFBLayer(ctx, layer, i, fbLayer);
+        if (!isSameFBLayer(fbLayer, ctx->fbLayers[i]))
+            return false;
+    }
+    return true;
+}
+
+/* Records the layers of a frame whose framebuffer gets composed */
+static void storeFBContent(hwc_context_t* ctx, const hwc_layer_list_t* list)
+{
+    if (list->numHwLayers > MAX_TRACKED_LAYERS) {
+        ctx->numFBLayers = -1;
+        return;
+    }
+
+    for (size_t i = 0; i < list->numHwLayers; i++) {
+        getFBLayer(ctx, &list->hwLayers[i], i, ctx->fbLayers[i]);
+    }
+    ctx->numFBLayers = list->numHwLayers;
+}
+
+static int getNumFramebuffers(const private_hwc_module_t* hwcModule)
+{
+    if (hwcModule->fbDevice) {
+        private_module_t* m = reinterpret_cast<private_module_t*>(
+                                      hwcModule->fbDevice->common.module);
+        if (m && m->numBuffers)
+            return m->numBuffers;
+    }
+    return NUM_FRAMEBUFFERS_MAX;
+}
+
+/*
+ * The area of a layer drawn by a pipe only needs to be cleared until
+ * every framebuffer has been cleared once, as long as the layer stays in
+ * place and nothing composed into the framebuffer overlaps it. Drops the
+ * clear hint of the layers whose area is already clear.
+ * Must be called on the frames whose framebuffer gets composed.
+ */
+static void updateFBClears(hwc_context_t* ctx, hwc_layer_list_t* list)
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                              ctx->device.common.module);
+    int numFramebuffers = getNumFramebuffers(hwcModule);
+    size_t numLayers = min(list->numHwLayers, MAX_TRACKED_LAYERS);
+
+    for (size_t i = 0; i < numLayers; i++) {
+        hwc_layer_t* layer = &list->hwLayers[i];
+        hwc_fb_clear_t& clear = ctx->fbClears[i];
+        if (isFBComposedLayer(layer) || !(layer->hints & HWC_HINT_CLEAR_FB)) {
+            memset(&clear, 0, sizeof(clear));
+            continue;
+        }
+
+        // Layers drawn into the framebuffer over the area, or that were
+        // until now, leave their pixels in it
+        bool isDirty = (list->flags & HWC_GEOMETRY_CHANGED) ||
+                       !isSameRect(clear.rect, layer->displayFrame);
+        for (size_t j = 0; (j < list->numHwLayers) && !isDirty; j++) {
+            if ((j != i) && isFBComposedLayer(&list->hwLayers[j]) &&
+                isOverlapping(list->hwLayers[j].displayFrame,
+                              layer->displayFrame)) {
+                isDirty = true;
+            }
+        }
+
+        if (isDirty) {
+            clear.rect = layer->displayFrame;
+            clear.pendingFrames = numFramebuffers;
+        }
+
+        if (clear.pendingFrames > 0) {
+            clear.pendingFrames--;
+        } else {
+            layer->hints &= ~HWC_HINT_CLEAR_FB;
+        }
+    }
+}
+
 /* Determine overlay state based on decoded video info */
 static ovutils::eOverlayState getOverlayState(hwc_context_t* ctx,
                                               uint32_t bypassLayer,
@@ -244,6 +760,9 @@ static ovutils::eOverlayState getOverlayState(hwc_context_t* ctx,
                 // Primary panel type is 2D
                 state = ovutils::OV_3D_VIDEO_ON_2D_PANEL;
             }
+        } else if (ctx->numVideoPipes > 1) {
+            // Several 2D videos, one per VG pipe
+            state = ovutils::OV_2D_VIDEO_2_LAYERS_ON_PANEL;
         } else {
             // Content type is 2D
             state = ovutils::OV_2D_VIDEO_ON_PANEL;
@@ -254,6 +773,8 @@ static ovutils::eOverlayState getOverlayState(hwc_context_t* ctx,
 }
 
 /* Set overlay state */
+static void finishCommit(hwc_context_t* ctx);
+
 static void setOverlayState(hwc_context_t* ctx, ovutils::eOverlayState state)
 {
     // Sanity check
@@ -281,6 +802,15 @@ static void setOverlayState(hwc_context_t* ctx, ovutils::eOverlayState state)
         return;
     }
 
+    // The overlay is not thread safe, the commit thread must be done
+    // waiting on the pipes before they are closed or reopened
+    finishCommit(ctx);
+
+    // Pipes are reopened on a state change, so the cached configs are stale
+    if (ovMgr->ov().getState() != state) {
+        invalidatePipeConfigs(ctx);
+    }
+
     // Using perform ensures a lock on overlay is obtained before changing state
     fbDev->perform(fbDev, EVENT_OVERLAY_STATE_CHANGE, OVERLAY_STATE_CHANGE_START);
     ovMgr->setState(state);
@@ -302,11 +832,28 @@ static void timeout_handler(void *udata) {
         LOGE("%s: HWC proc not registered", __FUNCTION__);
         return;
     }
-    /* Trigger SF to redraw the current frame */
+    /* Trigger SF to redraw the current frame into the framebuffer, which
+     * then shows it alone, without any bypass pipe, until a layer changes */
     ctx->forceComposition = true;
+    ctx->isIdle = true;
     proc->invalidate(proc);
 }
 
+/* Checks if a layer was updated or the list changed since the last frame */
+static bool hasLayerChanged(const hwc_context_t* ctx,
+                            const hwc_layer_list_t* list)
+{
+    if ((list->flags & HWC_GEOMETRY_CHANGED) ||
+        (list->numHwLayers > MAX_TRACKED_LAYERS))
+        return true;
+
+    for (size_t i = 0; i < list->numHwLayers; i++) {
+        if (ctx->layerTrack[i].staticFrames == 0)
+            return true;
+    }
+    return false;
+}
+
 void setLayerbypassIndex(hwc_layer_t* layer, const int bypass_index)
 {
     layer->flags &= ~HWC_BYPASS_INDEX_MASK;
@@ -324,33 +871,6 @@ int  getLayerbypassIndex(hwc_layer_t* layer)
     return byp_index;
 }
 
-void unlockPreviousBypassBuffers(hwc_context_t* ctx) {
-    // Unlock the previous bypass buffers. We can blindly unlock the buffers
-    // here, because buffers will be in this list only if the lock was
-    // successfully acquired.
-    for(int i = 0; i < MAX_BYPASS_LAYERS; i++) {
-        private_handle_t *hnd = (private_handle_t*) ctx->previousBypassHandle[i];
-        if (!hnd)
-            continue;
-        // Validate the handle to make sure it hasn't been deallocated.
-        if (private_handle_t::validate(hnd)) {
-            LOGE("%s: Unregistering invalid gralloc handle %p.", __FUNCTION__, hnd);
-            ctx->previousBypassHandle[i] = NULL;
-            continue;
-        }
-        // Check if the handle was locked previously
-        if (private_handle_t::PRIV_FLAGS_HWC_LOCK & hnd->flags) {
-            if (GENLOCK_FAILURE == genlock_unlock_buffer(hnd)) {
-                LOGE("%s: genlock_unlock_buffer failed", __FUNCTION__);
-            } else {
-                ctx->previousBypassHandle[i] = NULL;
-                // Reset the lock flag
-                hnd->flags &= ~private_handle_t::PRIV_FLAGS_HWC_LOCK;
-            }
-        }
-    }
-}
-
 void print_info(hwc_layer_t* layer)
 {
      hwc_rect_t sourceCrop = layer->sourceCrop;
@@ -492,6 +1012,16 @@ static int prepareBypass(hwc_context_t *ctx, hwc_layer_t *layer,
         overlay2::OverlayMgr *ovMgr = ctx->mOverlayLibObject;
         overlay2::Overlay& ov = ovMgr->ov();
 
+        // Nothing to program if the pipe already shows this layer config
+        hwc_pipe_config_t cfg;
+        getPipeConfig(cfg, ov.getState(), layer, hnd, vsync_wait, isFG, 0);
+        if (isPipeConfigCached(ctx, nPipeIndex, cfg)) {
+            LOGE_IF(BYPASS_DEBUG, "%s: pipe %d config unchanged",
+                    __FUNCTION__, nPipeIndex);
+            return 0;
+        }
+        ctx->pipeConfig[nPipeIndex].valid = false;
+
         // Determine pipe to set based on pipe index
         ovutils::eDest dest = ovutils::OV_PIPE_ALL;
         if (nPipeIndex == 0) {
@@ -518,9 +1048,9 @@ static int prepareBypass(hwc_context_t *ctx, hwc_layer_t *layer,
         ovutils::PipeArgs parg(ovutils::OV_MDP_FLAGS_NONE,
                                orient,
                                info,
-                               ovutils::NO_WAIT,
+                               vsync_wait ? ovutils::WAIT : ovutils::NO_WAIT,
                                ovutils::ZORDER_0,
-                               ovutils::IS_FG_OFF,
+                               isFG ? ovutils::IS_FG_SET : ovutils::IS_FG_OFF,
                                ovutils::ROT_FLAG_DISABLED,
                                ovutils::PMEM_SRC_SMI,
                                ovutils::RECONFIG_OFF);
@@ -543,6 +1073,7 @@ static int prepareBypass(hwc_context_t *ctx, hwc_layer_t *layer,
         }
 
         ovutils::Dim dim(dst.left, dst.top, dst_w, dst_h);
+        scaleToPanel(ctx, dim);
         if (!ov.setPosition(dim, dest)) {
             LOGE("%s: setPosition failed", __FUNCTION__);
             return -1;
@@ -556,6 +1087,7 @@ static int prepareBypass(hwc_context_t *ctx, hwc_layer_t *layer,
             LOGE("%s: commit failed", __FUNCTION__);
             return -1;
         }
+        storePipeConfig(ctx, nPipeIndex, cfg);
     }
     return 0;
 }
@@ -564,8 +1096,8 @@ static int prepareBypass(hwc_context_t *ctx, hwc_layer_t *layer,
  * Checks if doing comp. bypass is possible.
  * It is possible if
  * 1. No MDP pipe is used
- * 2. Rotation is not needed
- * 3. We have atmost MAX_BYPASS_LAYERS
+ * 2. There is no video layer
+ * Which layers actually get bypassed is decided by planBypassLayers
  */
 inline static bool isBypassDoable(hwc_composer_device_t *dev, const int yuvCount,
         const hwc_layer_list_t* list) {
@@ -583,7 +1115,7 @@ inline static bool isBypassDoable(hwc_composer_device_t *dev, const int yuvCount
         return false;
     }
 
-    if(list->numHwLayers < 1) {
+    if(list->numHwLayers < 1 || list->numHwLayers > MAX_BYPASS_PLAN_LAYERS) {
         return false;
     }
 
@@ -598,154 +1130,654 @@ inline static bool isBypassDoable(hwc_composer_device_t *dev, const int yuvCount
         return false;
     }
 
-    char value[PROPERTY_VALUE_MAX];
-    if (property_get("debug.egl.swapinterval", value, "1") > 0) {
-        ctx->swapInterval = atoi(value);
+    // The framebuffer alone shows the static frame
+    if(ctx->isIdle) {
+        return false;
     }
 
-    //Bypass is not efficient if rotation or asynchronous mode is needed.
-    for(int i = 0; i < list->numHwLayers; ++i) {
-        if(list->hwLayers[i].transform & FINAL_TRANSFORM_MASK) {
-            return false;
-        }
-        if(list->hwLayers[i].flags & HWC_LAYER_ASYNCHRONOUS) {
-            if (ctx->swapInterval > 0)
-                return false;
-        }
-    }
+    RuntimeConfigSnapshot config;
+    RuntimeConfig::getInstance()->getSnapshot(config);
+    ctx->swapInterval = config.swapInterval;
 
-    return (yuvCount == 0) && (ctx->hwcOverlayStatus == HWC_OVERLAY_CLOSED)
-                                   && (list->numHwLayers <= MAX_BYPASS_LAYERS);
+    return (yuvCount == 0) && (ctx->hwcOverlayStatus == HWC_OVERLAY_CLOSED);
 }
 
-void setBypassLayerFlags(hwc_context_t* ctx, hwc_layer_list_t* list)
-{
-    for(int index = 0 ; index < MAX_BYPASS_LAYERS; index++ )
-    {
-        int layer_index = ctx->layerindex[index];
-        if(layer_index >= 0) {
-            hwc_layer_t* layer = &(list->hwLayers[layer_index]);
-
-            layer->flags |= HWC_COMP_BYPASS;
-            layer->compositionType = HWC_USE_OVERLAY;
-            layer->hints |= HWC_HINT_CLEAR_FB;
-        }
+static int getBytesPerPixel(int format) {
+    switch (format) {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+            return 4;
+        case HAL_PIXEL_FORMAT_RGB_888:
+            return 3;
+        default:
+            return 2;
     }
+}
 
-    if( list->numHwLayers > ctx->nPipesUsed ) {
-         list->flags &= ~HWC_SKIP_COMPOSITION; //Compose to FB
-    } else {
-         list->flags |= HWC_SKIP_COMPOSITION; // Dont
-    }
+/*
+ * Bandwidth in KB/s of a pipe fetching a srcW x srcH source into dstH lines
+ * of the display. A pipe fetches a source line for every dstH/srcH display
+ * line, so the fetch rate of a layer shorter than the display, or of a
+ * downscale, peaks above the average source size times the refresh rate.
+ * The rotator reads the source and writes the copy the pipe fetches.
+ */
+static int getPipeBandwidth(const hwc_context_t* ctx, int srcW, int srcH,
+                            int format, int dstH, bool isRotated)
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    framebuffer_device_t *fbDev = hwcModule->fbDevice;
+    int displayH = (fbDev && fbDev->height) ? fbDev->height : dstH;
+    int fps = (fbDev && (fbDev->fps > 0)) ? (int)fbDev->fps :
+              DEFAULT_REFRESH_RATE;
+    if ((srcW <= 0) || (srcH <= 0) || (dstH <= 0))
+        return 0;
+
+    int64_t bytes = (int64_t)srcW * srcH * getBytesPerPixel(format);
+    int64_t bandwidth = bytes * fps * max(displayH, dstH) / dstH;
+    if (isRotated)
+        bandwidth += 2 * bytes * fps;
+    return (int)(bandwidth / 1024);
 }
 
-bool setupBypass(hwc_context_t* ctx, hwc_layer_list_t* list) {
+/* Starts the bandwidth accounting of a frame with the framebuffer pipes */
+static void resetBandwidth(hwc_context_t* ctx)
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    framebuffer_device_t *fbDev = hwcModule->fbDevice;
+    hwc_bandwidth_t& bw = ctx->bandwidth;
+
+    RuntimeConfigSnapshot config;
+    RuntimeConfig::getInstance()->getSnapshot(config);
+    bw.budget = config.mdpBandwidthBudget * 1024;
+
+    // The framebuffer is always scanned out, from the panel sized buffers
+    ovutils::FrameBufferInfo* fbInfo = ovutils::FrameBufferInfo::getInstance();
+    int panelW = fbInfo->getWidth();
+    int panelH = fbInfo->getHeight();
+    int format = fbDev ? fbDev->format : HAL_PIXEL_FORMAT_RGBA_8888;
+    bw.used = getPipeBandwidth(ctx, panelW, panelH, format, panelH, false);
+#if defined HDMI_DUAL_DISPLAY
+    // The external display pipe fetches the primary framebuffer too
+    if (ctx->mHDMIEnabled != EXT_TYPE_NONE)
+        bw.used *= 2;
+#endif
+}
 
-    // Sanity checks
-    if (!ctx || !list) {
-        LOGE("%s: NULL params", __FUNCTION__);
+/* Checks if pipes of the given bandwidth fit in what is left of the budget */
+static bool isBandwidthAvailable(hwc_context_t* ctx, int bandwidth)
+{
+    hwc_bandwidth_t& bw = ctx->bandwidth;
+    if (bw.budget && (bw.used + bandwidth > bw.budget)) {
+        LOGE_IF(BANDWIDTH_DEBUG, "%s: %d KB/s over budget, %d of %d used",
+                __FUNCTION__, bandwidth, bw.used, bw.budget);
+        bw.refused++;
         return false;
     }
+    return true;
+}
 
-    int nPipeIndex, vsync_wait, isFG;
-    int numHwLayers = list->numHwLayers;
-    int nPipeAvailable = MAX_BYPASS_LAYERS;
-
-    // Determine bypass state based on number of layers and then set the state
-    ovutils::eOverlayState state = getOverlayState(ctx, numHwLayers, 0);
-    setOverlayState(ctx, state);
+/* Accounts pipes in the frame, if they fit in the budget */
+static bool reserveBandwidth(hwc_context_t* ctx, int bandwidth)
+{
+    if (!isBandwidthAvailable(ctx, bandwidth))
+        return false;
+    ctx->bandwidth.used += bandwidth;
+    return true;
+}
 
-    for (int index = 0 ; (index < numHwLayers) && nPipeAvailable; index++) {
+/* Records the bandwidth of the frame once all its pipes are configured */
+static void updateBandwidthStats(hwc_context_t* ctx)
+{
+    hwc_bandwidth_t& bw = ctx->bandwidth;
+    bw.last = bw.used;
+    bw.peak = max(bw.peak, bw.used);
+    bw.total += bw.used;
+    bw.frames++;
+    LOGE_IF(BANDWIDTH_DEBUG, "%s: frame %u uses %d KB/s of %d", __FUNCTION__,
+            bw.frames, bw.used, bw.budget);
+}
 
-        hwc_layer_t* layer = &(list->hwLayers[index]);
+/*
+ * Checks if a single layer can be fetched by a bypass pipe, and if so
+ * returns the MDP and GPU costs of the layer in gpuCost/mdpCost, and the
+ * MDP bandwidth of its pipe in bandwidth.
+ * A layer can be bypassed if
+ * 1. It has a contiguous RGB buffer
+ * 2. Rotation is not needed, or the pipe rotator is enabled
+ * 3. Asynchronous mode is not needed
+ * 4. Its scaling is within the MDP limits
+ */
+static bool getBypassLayerCost(const hwc_context_t* ctx, const hwc_layer_t* layer,
+                               int& gpuCost, int& mdpCost, int& bandwidth) {
+    private_handle_t *hnd = (private_handle_t *)layer->handle;
+    if (!hnd || (hnd->bufferType == BUFFER_TYPE_VIDEO) ||
+        (hnd->flags & private_handle_t::PRIV_FLAGS_NONCONTIGUOUS_MEM)) {
+        return false;
+    }
 
-        nPipeIndex =  MAX_BYPASS_LAYERS - nPipeAvailable;
-        //Set VSYNC wait is needed only for the last pipe queued
-        vsync_wait = (nPipeIndex == (numHwLayers-1));
-        //Set isFG to true for layer with z-order zero
-        isFG = !index;
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    bool isRotated = (layer->transform & FINAL_TRANSFORM_MASK);
+    if (isRotated && !hwcModule->isBypassRotatorEnabled) {
+        return false;
+    }
 
-        //Clear Bypass flags for the layer
-        layer->flags &= ~HWC_COMP_BYPASS;
-        layer->flags |= HWC_BYPASS_INDEX_MASK;
+    if ((layer->flags & HWC_LAYER_ASYNCHRONOUS) && (ctx->swapInterval > 0)) {
+        return false;
+    }
 
-        if( prepareBypass(ctx, layer, nPipeIndex, vsync_wait, isFG) != 0 ) {
-           LOGE_IF(BYPASS_DEBUG, "%s: layer %d failed to configure bypass for pipe index: %d",
-                                                               __FUNCTION__, index, nPipeIndex);
-           return false;
-         } else {
-           ctx->layerindex[nPipeIndex] = index;
-           setLayerbypassIndex(layer, nPipeIndex);
-           nPipeAvailable--;
-         }
+    const hwc_rect_t& crop = layer->sourceCrop;
+    const hwc_rect_t& dst = layer->displayFrame;
+    int crop_w = crop.right - crop.left;
+    int crop_h = crop.bottom - crop.top;
+    int dst_w = dst.right - dst.left;
+    int dst_h = dst.bottom - dst.top;
+    if (crop_w <= 0 || crop_h <= 0 || dst_w <= 0 || dst_h <= 0) {
+        return false;
     }
-    ctx->nPipesUsed =  MAX_BYPASS_LAYERS - nPipeAvailable;
-    return true;
-}
 
-void unsetBypassLayerFlags(hwc_layer_list_t* list) {
-    if (!list)
-        return;
+    // The pipe scales the rotator output
+    if (layer->transform & HWC_TRANSFORM_ROT_90) {
+        ovutils::swap(crop_w, crop_h);
+    }
 
-    for (int index = 0 ; index < list->numHwLayers; index++) {
-        if(list->hwLayers[index].flags & HWC_COMP_BYPASS) {
-            list->hwLayers[index].flags &= ~HWC_COMP_BYPASS;
-        }
+    if ((dst_w > crop_w * ovutils::HW_OV_MAGNIFICATION_LIMIT) ||
+        (dst_h > crop_h * ovutils::HW_OV_MAGNIFICATION_LIMIT) ||
+        (crop_w > dst_w * ovutils::HW_OV_MINIFICATION_LIMIT) ||
+        (crop_h > dst_h * ovutils::HW_OV_MINIFICATION_LIMIT)) {
+        return false;
     }
-}
 
-void unsetBypassBufferLockState(hwc_context_t* ctx) {
-    for (int i= 0; i< MAX_BYPASS_LAYERS; i++) {
-        ctx->bypassBufferLockState[i] = BYPASS_BUFFER_UNLOCKED;
+    // The GPU reads the source and writes the destination (reading it
+    // back too when blending). The MDP only fetches the source, but a
+    // downscale fetches more than it displays.
+    int bpp = getBytesPerPixel(hnd->format);
+    int srcArea = crop_w * crop_h;
+    int dstArea = dst_w * dst_h;
+    gpuCost = (srcArea * bpp) / 4 + dstArea *
+              ((layer->blending == HWC_BLENDING_NONE) ? 1 : 2);
+    mdpCost = (srcArea * bpp) / 4 + BYPASS_PIPE_COST;
+    // The rotator reads the source and writes a copy for the pipe
+    if (isRotated) {
+        mdpCost += (srcArea * bpp) / 2;
     }
+    bandwidth = getPipeBandwidth(ctx, crop_w, crop_h, hnd->format, dst_h,
+                                 isRotated);
+    return true;
 }
 
-void storeLockedBypassHandle(hwc_layer_list_t* list, hwc_context_t* ctx) {
-   if (!list)
+struct bypass_plan_t {
+    int numLayers;
+    int gpuCost[MAX_BYPASS_PLAN_LAYERS];
+    int mdpCost[MAX_BYPASS_PLAN_LAYERS];
+    int bandwidth[MAX_BYPASS_PLAN_LAYERS];
+    bool feasible[MAX_BYPASS_PLAN_LAYERS];
+    bool rotated[MAX_BYPASS_PLAN_LAYERS];
+    uint32_t overlapMask[MAX_BYPASS_PLAN_LAYERS]; // Layers above overlapping it
+    int numCandidates;
+    int candidates[MAX_BYPASS_CANDIDATES]; // Layer indices, in z-order
+    uint32_t selectedMask;
+    int fbCost;          // Cost of the FB post, saved if all layers bypass
+    int bandwidthLeft;   // Pipe bandwidth left in the budget, -1 if no limit
+    bool isBandwidthLimited; // A subset was dropped for its bandwidth
+    int bestSaving;
+    int bestBandwidth;
+    int bestCount;
+    int bestIndex[MAX_BYPASS_LAYERS];
+};
+
+/*
+ * Keeps the feasible layers saving the most as the candidates of the
+ * search, so that it walks at most C(MAX_BYPASS_CANDIDATES, k) subsets
+ * of k layers whatever the list size. Also records, for each candidate,
+ * the layers above it that it overlaps.
+ */
+static void selectBypassCandidates(const hwc_layer_list_t* list,
+                                   bypass_plan_t& plan)
+{
+    plan.numCandidates = 0;
+    for (int i = 0; i < plan.numLayers; i++) {
+        if (!plan.feasible[i])
+            continue;
+        int saving = plan.gpuCost[i] - plan.mdpCost[i];
+        int c = plan.numCandidates;
+        if (c == MAX_BYPASS_CANDIDATES) {
+            // Replace the candidate saving the least, if it saves less
+            int worst = 0;
+            for (int k = 1; k < c; k++) {
+                int w = plan.candidates[worst];
+                int j = plan.candidates[k];
+                if (plan.gpuCost[j] - plan.mdpCost[j] <
+                    plan.gpuCost[w] - plan.mdpCost[w])
+                    worst = k;
+            }
+            int w = plan.candidates[worst];
+            if (saving <= plan.gpuCost[w] - plan.mdpCost[w])
+                continue;
+            // Keep the candidates in z-order
+            for (int k = worst; k < c - 1; k++)
+                plan.candidates[k] = plan.candidates[k + 1];
+            c--;
+        }
+        plan.candidates[c] = i;
+        plan.numCandidates = c + 1;
+    }
+
+    for (int c = 0; c < plan.numCandidates; c++) {
+        int i = plan.candidates[c];
+        plan.overlapMask[i] = 0;
+        for (int j = i + 1; j < plan.numLayers; j++) {
+            if (isOverlapping(list->hwLayers[i].displayFrame,
+                              list->hwLayers[j].displayFrame))
+                plan.overlapMask[i] |= (1u << j);
+        }
+    }
+}
+
+/*
+ * Bypass pipes are blended on top of the framebuffer, so a bypassed layer
+ * must not be overlapped by any layer above it that stays on the GPU.
+ */
+static bool isZOrderValid(const bypass_plan_t& plan)
+{
+    for (int c = 0; c < plan.numCandidates; c++) {
+        int i = plan.candidates[c];
+        if ((plan.selectedMask & (1u << i)) &&
+            (plan.overlapMask[i] & ~plan.selectedMask))
+            return false;
+    }
+    return true;
+}
+
+/* Walks the candidate subsets that fit the pipes, keeping the cheapest */
+static void searchBypassPlan(bypass_plan_t& plan, int start, int count,
+                             int numRotated, int saving, int bandwidth)
+{
+    if (count > 0) {
+        int totalSaving = saving;
+        if (count == plan.numLayers)
+            totalSaving += plan.fbCost;
+        if (totalSaving > plan.bestSaving && isZOrderValid(plan)) {
+            plan.bestSaving = totalSaving;
+            plan.bestBandwidth = bandwidth;
+            plan.bestCount = 0;
+            for (int c = 0; c < plan.numCandidates; c++) {
+                int i = plan.candidates[c];
+                if (plan.selectedMask & (1u << i))
+                    plan.bestIndex[plan.bestCount++] = i;
+            }
+        }
+    }
+
+    if (count == MAX_BYPASS_LAYERS)
         return;
 
-   for(int index = 0; index < MAX_BYPASS_LAYERS; index++ ) {
-       hwc_layer_t layer = list->hwLayers[ctx->layerindex[index]];
+    for (int c = start; c < plan.numCandidates; c++) {
+        int i = plan.candidates[c];
+        // The rotator is shared by all the pipes
+        int rotated = numRotated + (plan.rotated[i] ? 1 : 0);
+        if (rotated > MAX_BYPASS_ROTATED_LAYERS)
+            continue;
+        // Pipes beyond the budget would underrun the MDP
+        int pipesBandwidth = bandwidth + plan.bandwidth[i];
+        if ((plan.bandwidthLeft >= 0) &&
+            (pipesBandwidth > plan.bandwidthLeft)) {
+            plan.isBandwidthLimited = true;
+            continue;
+        }
+        plan.selectedMask |= (1u << i);
+        searchBypassPlan(plan, c + 1, count + 1, rotated,
+                         saving + plan.gpuCost[i] - plan.mdpCost[i],
+                         pipesBandwidth);
+        plan.selectedMask &= ~(1u << i);
+    }
+}
 
-       if (layer.flags & HWC_COMP_BYPASS) {
-            private_handle_t *hnd = (private_handle_t*)layer.handle;
+/*
+ * Splits the layer list between the bypass pipes and the GPU composed
+ * framebuffer. The split saving the most pixel traffic over full GPU
+ * composition wins. The indices of the bypassed layers are returned in
+ * z-order in layerIndex.
+ *
+ * Only subsets of the MAX_BYPASS_CANDIDATES layers saving the most are
+ * considered, and not those whose pipes exceed the bandwidth budget.
+ *
+ * Returns the number of layers to bypass, 0 if bypass is not worth it.
+ */
+static int planBypassLayers(hwc_context_t* ctx, const hwc_layer_list_t* list,
+                            int layerIndex[MAX_BYPASS_LAYERS])
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    framebuffer_device_t *fbDev = hwcModule->fbDevice;
 
-            if (ctx->bypassBufferLockState[index] == BYPASS_BUFFER_LOCKED) {
-               ctx->previousBypassHandle[index] = (native_handle_t*)layer.handle;
-               hnd->flags |= private_handle_t::PRIV_FLAGS_HWC_LOCK;
-           } else {
-              ctx->previousBypassHandle[index] = NULL;
-           }
-       }
-   }
+    bypass_plan_t plan;
+    memset(&plan, 0, sizeof(plan));
+    plan.numLayers = list->numHwLayers;
+    plan.fbCost = fbDev->width * fbDev->height;
+    const hwc_bandwidth_t& bw = ctx->bandwidth;
+    plan.bandwidthLeft = bw.budget ? max(bw.budget - bw.used, 0) : -1;
+
+    for (int i = 0; i < plan.numLayers; i++) {
+        plan.feasible[i] = getBypassLayerCost(ctx, &list->hwLayers[i],
+                                              plan.gpuCost[i], plan.mdpCost[i],
+                                              plan.bandwidth[i]);
+        plan.rotated[i] = (list->hwLayers[i].transform & FINAL_TRANSFORM_MASK);
+    }
+
+    selectBypassCandidates(list, plan);
+    searchBypassPlan(plan, 0, 0, 0, 0, 0);
+
+    for (int i = 0; i < plan.bestCount; i++) {
+        layerIndex[i] = plan.bestIndex[i];
+    }
+    if (plan.isBandwidthLimited)
+        ctx->bandwidth.refused++;
+    if (plan.bestCount)
+        reserveBandwidth(ctx, plan.bestBandwidth);
+
+    LOGE_IF(BYPASS_DEBUG, "%s: %d of %d layers bypassed, saving %d",
+            __FUNCTION__, plan.bestCount, plan.numLayers, plan.bestSaving);
+    return plan.bestCount;
 }
 
-void closeExtraPipes(hwc_context_t* ctx) {
+void setBypassLayerFlags(hwc_context_t* ctx, hwc_layer_list_t* list)
+{
+    // Drop the flags left over from the previous plan
+    for (size_t i = 0; i < list->numHwLayers; i++) {
+        list->hwLayers[i].flags &= ~HWC_COMP_BYPASS;
+    }
 
-    int pipes_used = ctx->nPipesUsed;
+    for(int index = 0 ; index < MAX_BYPASS_LAYERS; index++ )
+    {
+        int layer_index = ctx->layerindex[index];
+        if(layer_index >= 0) {
+            hwc_layer_t* layer = &(list->hwLayers[layer_index]);
 
-    //Unused pipes must be of higher z-order
-    for (int i =  pipes_used ; i < MAX_BYPASS_LAYERS; i++) {
-        private_handle_t *hnd = (private_handle_t*) ctx->previousBypassHandle[i];
-        if (hnd) {
-            if (!private_handle_t::validate(hnd)) {
-                if (GENLOCK_FAILURE == genlock_unlock_buffer(hnd)) {
-                    LOGE("%s: genlock_unlock_buffer failed", __FUNCTION__);
-                } else {
-                    ctx->previousBypassHandle[i] = NULL;
-                    ctx->bypassBufferLockState[i] = BYPASS_BUFFER_UNLOCKED;
-                    hnd->flags &= ~private_handle_t::PRIV_FLAGS_HWC_LOCK;
-                }
-            } else {
-                LOGE("%s: Unregistering invalid gralloc handle %p.",
-                    __FUNCTION__, hnd);
-                ctx->previousBypassHandle[i] = NULL;
-            }
+            layer->flags |= HWC_COMP_BYPASS;
+            layer->compositionType = HWC_USE_OVERLAY;
+            // A blended pipe shows the GPU composed layers below it
+            if (layer->blending == HWC_BLENDING_NONE)
+                layer->hints |= HWC_HINT_CLEAR_FB;
+            else
+                layer->hints &= ~HWC_HINT_CLEAR_FB;
         }
-        ctx->mOvUI[i]->closeChannel();
+    }
+
+    int numLayersBypassed = ctx->nPipesUsed;
+    if (ctx->staticCache.active) {
+        // The cached layers are all fetched by pipe 0
+        for (int i = 0; i < ctx->staticCache.numLayers; i++) {
+            list->hwLayers[i].compositionType = HWC_USE_OVERLAY;
+            list->hwLayers[i].hints &= ~HWC_HINT_CLEAR_FB;
+        }
+        numLayersBypassed += ctx->staticCache.numLayers - 1;
+    }
+
+    if( (int)list->numHwLayers > numLayersBypassed ) {
+         list->flags &= ~HWC_SKIP_COMPOSITION; //Compose to FB
+    } else {
+         list->flags |= HWC_SKIP_COMPOSITION; // Dont
+    }
+}
+
+bool setupBypass(hwc_context_t* ctx, hwc_layer_list_t* list) {
+
+    // Sanity checks
+    if (!ctx || !list) {
+        LOGE("%s: NULL params", __FUNCTION__);
+        return false;
+    }
+
+    int layerIndex[MAX_BYPASS_LAYERS];
+    int numBypassLayers = planBypassLayers(ctx, list, layerIndex);
+    if (numBypassLayers <= 0) {
+        return false;
+    }
+
+    // When some layers stay on the GPU, the framebuffer is the background
+    // of the pipes and the framebuffer post waits for vsync.
+    bool isFBComposed = (numBypassLayers < (int)list->numHwLayers);
+
+    // Determine bypass state based on number of layers and then set the state
+    ovutils::eOverlayState state = getOverlayState(ctx, numBypassLayers, 0);
+    setOverlayState(ctx, state);
+
+    for (int nPipeIndex = 0; nPipeIndex < numBypassLayers; nPipeIndex++) {
+        int index = layerIndex[nPipeIndex];
+        hwc_layer_t* layer = &(list->hwLayers[index]);
+
+        //Set VSYNC wait is needed only for the last pipe queued
+        int vsync_wait = !isFBComposed && (nPipeIndex == (numBypassLayers-1));
+        //Set isFG to true for the bottom most pipe, unless FB is under it
+        int isFG = !isFBComposed && !nPipeIndex;
+
+        //Clear Bypass flags for the layer
+        layer->flags &= ~HWC_COMP_BYPASS;
+        layer->flags |= HWC_BYPASS_INDEX_MASK;
+
+        if( prepareBypass(ctx, layer, nPipeIndex, vsync_wait, isFG) != 0 ) {
+           LOGE_IF(BYPASS_DEBUG, "%s: layer %d failed to configure bypass for pipe index: %d",
+                                                               __FUNCTION__, index, nPipeIndex);
+           return false;
+        }
+        ctx->layerindex[nPipeIndex] = index;
+        setLayerbypassIndex(layer, nPipeIndex);
+    }
+    for (int i = numBypassLayers; i < MAX_BYPASS_LAYERS; i++) {
         ctx->layerindex[i] = -1;
     }
+    ctx->nPipesUsed = numBypassLayers;
+    return true;
+}
+
+/* Allocates the static cache buffers, matching the framebuffer */
+static bool allocStaticCache(hwc_context_t* ctx)
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    framebuffer_device_t *fbDev = hwcModule->fbDevice;
+    hwc_static_cache_t& cache = ctx->staticCache;
+
+    int usage = GRALLOC_USAGE_PRIVATE_ADSP_HEAP |
+                GRALLOC_USAGE_PRIVATE_MM_HEAP |
+                GRALLOC_USAGE_PRIVATE_UNCACHED;
+    for (int i = 0; i < NUM_STATIC_CACHE_BUFFERS; i++) {
+        if (cache.buffer[i])
+            continue;
+        if (alloc_buffer(&cache.buffer[i], fbDev->width, fbDev->height,
+                         fbDev->format, usage)) {
+            LOGE("%s: failed to allocate static cache buffer", __FUNCTION__);
+            cache.buffer[i] = NULL;
+            return false;
+        }
+        // The MDP can only fetch physically contiguous memory
+        if (cache.buffer[i]->flags & private_handle_t::PRIV_FLAGS_NONCONTIGUOUS_MEM) {
+            LOGE("%s: static cache buffer is not contiguous", __FUNCTION__);
+            free_buffer(cache.buffer[i]);
+            cache.buffer[i] = NULL;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void freeStaticCache(hwc_context_t* ctx)
+{
+    hwc_static_cache_t& cache = ctx->staticCache;
+    for (int i = 0; i < NUM_STATIC_CACHE_BUFFERS; i++) {
+        if (cache.buffer[i]) {
+            free_buffer(cache.buffer[i]);
+            cache.buffer[i] = NULL;
+        }
+    }
+    cache.valid = false;
+    cache.active = false;
+    cache.numLayers = 0;
+    cache.idleFrames = 0;
+}
+
+/* Checks if the cache holds the layers [0, numLayers) of the list */
+static bool isStaticCacheValid(const hwc_context_t* ctx,
+                               const hwc_layer_list_t* list, int numLayers)
+{
+    const hwc_static_cache_t& cache = ctx->staticCache;
+    if (!cache.valid || (cache.numLayers != numLayers))
+        return false;
+
+    for (int i = 0; i < numLayers; i++) {
+        if (cache.handles[i] != list->hwLayers[i].handle)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Drops the cache once one of its layers is no longer static, and frees its
+ * buffers once it has not been used for STATIC_CACHE_IDLE_FRAMES frames.
+ * By then the pipe fetching them has long been given another buffer.
+ */
+static void updateStaticCacheState(hwc_context_t* ctx)
+{
+    hwc_static_cache_t& cache = ctx->staticCache;
+    if (cache.active) {
+        cache.idleFrames = 0;
+    } else if (cache.buffer[0] &&
+               (++cache.idleFrames >= STATIC_CACHE_IDLE_FRAMES)) {
+        LOGE_IF(BYPASS_DEBUG, "%s: freeing the idle static cache",
+                __FUNCTION__);
+        finishCommit(ctx);
+        freeStaticCache(ctx);
+    }
+    cache.active = false;
+    if (ctx->numStaticLayers < cache.numLayers) {
+        cache.valid = false;
+        cache.numLayers = 0;
+    }
+}
+
+/* A full screen layer presenting the current static cache buffer */
+static void getStaticCacheLayer(const hwc_context_t* ctx, hwc_layer_t& layer)
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    framebuffer_device_t *fbDev = hwcModule->fbDevice;
+    const hwc_static_cache_t& cache = ctx->staticCache;
+
+    memset(&layer, 0, sizeof(layer));
+    layer.compositionType = HWC_USE_OVERLAY;
+    layer.handle = (native_handle_t*)cache.buffer[cache.current];
+    layer.blending = HWC_BLENDING_NONE;
+    layer.sourceCrop.right = fbDev->width;
+    layer.sourceCrop.bottom = fbDev->height;
+    layer.displayFrame = layer.sourceCrop;
 }
+
+/*
+ * Bypasses a frame where the bottom layers have been static for a while
+ * and only a few layers on top of them update. The static layers are
+ * composed once with copybit into the static cache, fetched by pipe 0,
+ * and every updating layer gets one of the remaining pipes.
+ */
+bool setupStaticCacheBypass(hwc_context_t* ctx, hwc_layer_list_t* list) {
+
+    // Sanity checks
+    if (!ctx || !list) {
+        LOGE("%s: NULL params", __FUNCTION__);
+        return false;
+    }
+
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    hwc_static_cache_t& cache = ctx->staticCache;
+    int numCached = ctx->numStaticLayers;
+    int numUpdating = list->numHwLayers - numCached;
+
+    // A single static layer is better fetched directly by its own pipe
+    if (numCached < 2 || numUpdating > (MAX_BYPASS_LAYERS - 1) ||
+        !hwcModule->copybitEngine) {
+        return false;
+    }
+
+    // The cache pipe fetches a full framebuffer
+    framebuffer_device_t *fbDev = hwcModule->fbDevice;
+    int pipesBandwidth = getPipeBandwidth(ctx, fbDev->width, fbDev->height,
+                                          fbDev->format, fbDev->height, false);
+    for (int i = numCached; i < (int)list->numHwLayers; i++) {
+        int gpuCost, mdpCost, bandwidth;
+        if (!getBypassLayerCost(ctx, &list->hwLayers[i], gpuCost, mdpCost,
+                                bandwidth)) {
+            return false;
+        }
+        pipesBandwidth += bandwidth;
+    }
+
+    if (!isBandwidthAvailable(ctx, pipesBandwidth) || !allocStaticCache(ctx)) {
+        return false;
+    }
+
+    int numPipes = numUpdating + 1;
+    ovutils::eOverlayState state = getOverlayState(ctx, numPipes, 0);
+    setOverlayState(ctx, state);
+
+    // The cache is opaque and covers the screen, so it is the bottom pipe
+    hwc_layer_t cacheLayer;
+    getStaticCacheLayer(ctx, cacheLayer);
+    if (prepareBypass(ctx, &cacheLayer, 0, (numPipes == 1), true) != 0) {
+        LOGE_IF(BYPASS_DEBUG, "%s: failed to configure the static cache pipe",
+                __FUNCTION__);
+        return false;
+    }
+    ctx->layerindex[0] = -1;
+
+    for (int nPipeIndex = 1; nPipeIndex < numPipes; nPipeIndex++) {
+        int index = numCached + nPipeIndex - 1;
+        hwc_layer_t* layer = &(list->hwLayers[index]);
+        int vsync_wait = (nPipeIndex == (numPipes - 1));
+
+        layer->flags &= ~HWC_COMP_BYPASS;
+        layer->flags |= HWC_BYPASS_INDEX_MASK;
+
+        if (prepareBypass(ctx, layer, nPipeIndex, vsync_wait, false) != 0) {
+            LOGE_IF(BYPASS_DEBUG, "%s: layer %d failed to configure bypass for pipe index: %d",
+                    __FUNCTION__, index, nPipeIndex);
+            return false;
+        }
+        ctx->layerindex[nPipeIndex] = index;
+        setLayerbypassIndex(layer, nPipeIndex);
+    }
+    for (int i = numPipes; i < MAX_BYPASS_LAYERS; i++) {
+        ctx->layerindex[i] = -1;
+    }
+
+    // The cache is composed in hwc_set when it does not hold these layers
+    if (!isStaticCacheValid(ctx, list, numCached)) {
+        cache.valid = false;
+        cache.numLayers = numCached;
+    }
+    cache.active = true;
+    ctx->nPipesUsed = numPipes;
+    ctx->bandwidth.used += pipesBandwidth;
+
+    LOGE_IF(BYPASS_DEBUG, "%s: %d static layers cached, %d layers bypassed",
+            __FUNCTION__, numCached, numUpdating);
+    return true;
+}
+
+void unsetBypassLayerFlags(hwc_layer_list_t* list) {
+    if (!list)
+        return;
+
+    for (int index = 0 ; index < list->numHwLayers; index++) {
+        if(list->hwLayers[index].flags & HWC_COMP_BYPASS) {
+            list->hwLayers[index].flags &= ~HWC_COMP_BYPASS;
+        }
+    }
+}
+
 #endif  //COMPOSITION_BYPASS
 
 // Returns true if external panel is connected
@@ -766,9 +1798,48 @@ static inline bool isYuvBuffer(const private_handle_t* hnd) {
     return (hnd && (hnd->bufferType == BUFFER_TYPE_VIDEO));
 }
 
-//Return true if buffer is marked locked
-static inline bool isBufferLocked(const private_handle_t* hnd) {
-    return (hnd && (private_handle_t::PRIV_FLAGS_HWC_LOCK & hnd->flags));
+// Returns true if the layer shows a single color: dim layers are flagged
+// HWC_COLOR_FILL by SurfaceFlinger and have no buffer, color layers have a
+// 1x1 RGB one. SKIP layers are always drawn by SurfaceFlinger.
+static inline bool isSolidColorLayer(const hwc_layer_t* layer) {
+    if (isSkipLayer(layer))
+        return false;
+    private_handle_t *hnd = (private_handle_t *)layer->handle;
+    if (!hnd)
+        return (layer->flags & HWC_COLOR_FILL) != 0;
+    if ((hnd->width != 1) || (hnd->height != 1))
+        return false;
+    switch (hnd->format) {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+        case HAL_PIXEL_FORMAT_RGB_565:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Returns true if solid color layers can be filled in by copybit
+static inline bool canFillSolidColor(const private_hwc_module_t* hwcModule) {
+    return (hwcModule->copybitEngine && hwcModule->copybitEngine->fill_color &&
+            (hwcModule->compositionType & (COMPOSITION_TYPE_C2D |
+                                           COMPOSITION_TYPE_MDP |
+                                           COMPOSITION_TYPE_CPU |
+                                           COMPOSITION_TYPE_DYN)));
+}
+
+// Returns true if the format can be blitted by the CPU copybit engine
+static inline bool isCPUCopybitFormat(int format) {
+    switch (format) {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+        case HAL_PIXEL_FORMAT_RGB_565:
+            return true;
+        default:
+            return false;
+    }
 }
 
 static int getLayerS3DFormat (hwc_layer_t &layer) {
@@ -835,18 +1906,113 @@ static int hwc_closeOverlayChannels(hwc_context_t* ctx) {
     return 0;
 }
 
+/*
+ * Opens and starts the VG pipe and its rotator session for a video layer
+ * that is still composed by the GPU, e.g. while it animates into place.
+ * Nothing is committed or played, so the pipe does not show up until
+ * prepareOverlay configures it, which then only has to update the pipe.
+ */
+static void warmUpOverlay(hwc_context_t *ctx, const hwc_layer_t *layer)
+{
+    private_handle_t *hnd = (private_handle_t *)layer->handle;
+    if (!hnd || !isYuvBuffer(hnd) || (ctx->yuvBufferCount != 1))
+        return;
+
+    // Only when the overlay is idle, and not for external or S3D content
+    if ((ctx->hwcOverlayStatus != HWC_OVERLAY_CLOSED) ||
+        (ctx->mHDMIEnabled != EXT_TYPE_NONE) || ctx->s3dLayerFormat)
+        return;
+
+    overlay2::Overlay& ov = ctx->mOverlayLibObject->ov();
+    hwc_overlay_warmup_t& warmUp = ctx->overlayWarmUp;
+    uint32_t transform = layer->transform & FINAL_TRANSFORM_MASK;
+    if (warmUp.active) {
+        if ((warmUp.width == hnd->width) && (warmUp.height == hnd->height) &&
+            (warmUp.format == hnd->format) && (warmUp.size == hnd->size) &&
+            (warmUp.transform == transform))
+            return;
+    } else if (ov.getState() != ovutils::OV_CLOSED) {
+        return;
+    }
+
+    ovutils::Whf info(hnd->width, hnd->height, hnd->format, hnd->size);
+    ovutils::eOverlayState state = getOverlayState(ctx, 0, info.format);
+    if (state != ovutils::OV_2D_VIDEO_ON_PANEL)
+        return;
+    setOverlayState(ctx, state);
+
+    ovutils::eMdpFlags mdpFlags = ovutils::OV_MDP_FLAGS_NONE;
+    if (hnd->flags & private_handle_t::PRIV_FLAGS_SECURE_BUFFER) {
+        ovutils::setMdpFlags(mdpFlags, ovutils::OV_MDP_SECURE_OVERLAY_SESSION);
+    }
+    ovutils::eTransform orient = static_cast<ovutils::eTransform>(transform);
+    ovutils::eIsFg isFgFlag = ovutils::IS_FG_OFF;
+    if (ctx->numHwLayers == 1) {
+        isFgFlag = ovutils::IS_FG_SET;
+    }
+
+    // Same source and transform as prepareOverlay will set, which starts
+    // the rotator session and maps its buffers
+    ovutils::PipeArgs parg(mdpFlags,
+                           orient,
+                           info,
+                           ovutils::NO_WAIT,
+                           ovutils::ZORDER_0,
+                           isFgFlag,
+                           ovutils::ROT_FLAG_DISABLED,
+                           ovutils::PMEM_SRC_SMI,
+                           ovutils::RECONFIG_OFF);
+    ovutils::PipeArgs pargs[ovutils::MAX_PIPES] = { parg, parg, parg };
+    const ovutils::Params prms (ovutils::OVERLAY_TRANSFORM, orient);
+    if (!ov.setSource(pargs, ovutils::OV_PIPE_ALL) ||
+        !ov.setParameter(prms, ovutils::OV_PIPE_ALL)) {
+        LOGE("%s: failed to warm up the overlay", __FUNCTION__);
+        warmUp.active = false;
+        setOverlayState(ctx, ovutils::OV_CLOSED);
+        return;
+    }
+
+    LOGE_IF(DEBUG_HWC, "%s: overlay warmed up for %dx%d", __FUNCTION__,
+            hnd->width, hnd->height);
+    warmUp.active = true;
+    warmUp.width = hnd->width;
+    warmUp.height = hnd->height;
+    warmUp.format = hnd->format;
+    warmUp.size = hnd->size;
+    warmUp.transform = transform;
+}
+
+/*
+ * Ends the overlay warm-up. The pipe is closed unless the video layer
+ * has been moved to the overlay, in which case it keeps the pipe.
+ */
+static void endOverlayWarmUp(hwc_context_t *ctx)
+{
+    if (!ctx->overlayWarmUp.active)
+        return;
+
+    ctx->overlayWarmUp.active = false;
+    if (ctx->hwcOverlayStatus != HWC_OVERLAY_OPEN) {
+        LOGE_IF(DEBUG_HWC, "%s: discarding overlay warm-up", __FUNCTION__);
+        setOverlayState(ctx, ovutils::OV_CLOSED);
+    }
+}
+
 /*
  * Configures mdp pipes
  */
 static int prepareOverlay(hwc_context_t *ctx,
-                          hwc_layer_t *layer) {
+                          hwc_layer_t *layer,
+                          int pipeIndex) {
     ovutils::Timer t("prepareOverlay");
     int ret = 0;
 
 #ifdef COMPOSITION_BYPASS
     if (ctx && (ctx->bypassState != BYPASS_OFF)) {
         ctx->nPipesUsed = 0;
-        closeExtraPipes(ctx);
+        for (int i = 0; i < MAX_BYPASS_LAYERS; i++) {
+            ctx->layerindex[i] = -1;
+        }
         ctx->bypassState = BYPASS_OFF;
     }
 #endif
@@ -864,8 +2030,74 @@ static int prepareOverlay(hwc_context_t *ctx,
         overlay2::Overlay& ov = ovLibObject->ov();
         ovutils::Whf info(hnd->width, hnd->height, hnd->format, hnd->size);
 
-        // Set overlay state
         ovutils::eOverlayState state = getOverlayState(ctx, 0, info.format);
+
+        ovutils::eMdpFlags mdpFlags = ovutils::OV_MDP_FLAGS_NONE;
+        if (hnd->flags & private_handle_t::PRIV_FLAGS_SECURE_BUFFER) {
+            ovutils::setMdpFlags(mdpFlags, ovutils::OV_MDP_SECURE_OVERLAY_SESSION);
+        }
+
+        // FIXME: Use source orientation for TV when source is portrait
+        int transform = layer->transform & FINAL_TRANSFORM_MASK;
+        ovutils::eTransform orient =
+            static_cast<ovutils::eTransform>(transform);
+
+        // Only the last video pipe played waits for vsync
+        ovutils::eWait waitFlag = ovutils::NO_WAIT;
+        if ((ctx->skipComposition == true) &&
+            (pipeIndex >= ctx->numVideoPipes - 1)) {
+            waitFlag = ovutils::WAIT;
+        }
+
+        ovutils::eIsFg isFgFlag = ovutils::IS_FG_OFF;
+        if (ctx->numHwLayers == 1) {
+            isFgFlag = ovutils::IS_FG_SET;
+        }
+
+        int orientation = 0;
+#if defined HDMI_DUAL_DISPLAY
+        // Get the device orientation
+        if (hwcModule) {
+            framebuffer_device_t *fbDev = reinterpret_cast<framebuffer_device_t*>
+                                                            (hwcModule->fbDevice);
+            if (fbDev) {
+                private_module_t* m = reinterpret_cast<private_module_t*>(
+                                                         fbDev->common.module);
+                if (m)
+                    orientation = m->orientation;
+            }
+        }
+#endif
+
+        // A video pipe over the bandwidth budget would underrun the MDP,
+        // the video is composed with copybit or the GPU instead
+        const hwc_rect_t& crop = layer->sourceCrop;
+        int bandwidth = getPipeBandwidth(ctx, crop.right - crop.left,
+                                         crop.bottom - crop.top, hnd->format,
+                                         layer->displayFrame.bottom -
+                                         layer->displayFrame.top,
+                                         (transform != 0));
+#if defined HDMI_DUAL_DISPLAY
+        // The video is shown on the external display by a second pipe
+        if (ctx->mHDMIEnabled != EXT_TYPE_NONE)
+            bandwidth *= 2;
+#endif
+        if (!reserveBandwidth(ctx, bandwidth)) {
+            ctx->pipeConfig[pipeIndex].valid = false;
+            if (ctx->hwcOverlayStatus == HWC_OVERLAY_OPEN)
+                ctx->hwcOverlayStatus = HWC_OVERLAY_PREPARE_TO_CLOSE;
+            return -1;
+        }
+
+        // Video frames of the same geometry only need a queueBuffer
+        hwc_pipe_config_t cfg;
+        getPipeConfig(cfg, state, layer, hnd, waitFlag, isFgFlag, orientation);
+        if (isPipeConfigCached(ctx, pipeIndex, cfg)) {
+            return 0;
+        }
+        ctx->pipeConfig[pipeIndex].valid = false;
+
+        // Set overlay state
         setOverlayState(ctx, state);
 
         ovutils::eDest dest = ovutils::OV_PIPE_ALL;
@@ -875,6 +2107,9 @@ static int prepareOverlay(hwc_context_t *ctx,
         if (state == ovutils::OV_2D_TRUE_UI_MIRROR) {
             dest = static_cast<ovutils::eDest>(
                 ovutils::OV_PIPE0 | ovutils::OV_PIPE1);
+        } else if (state == ovutils::OV_2D_VIDEO_2_LAYERS_ON_PANEL) {
+            // Each video has its own VG pipe
+            dest = (pipeIndex == 0) ? ovutils::OV_PIPE0 : ovutils::OV_PIPE1;
         }
 
         // that will make sure reconf is reset at that point
@@ -888,26 +2123,6 @@ static int prepareOverlay(hwc_context_t *ctx,
         // commit - commit changes to mdp driver
         // queueBuffer - not here, happens when draw is called
 
-        ovutils::eMdpFlags mdpFlags = ovutils::OV_MDP_FLAGS_NONE;
-        if (hnd->flags & private_handle_t::PRIV_FLAGS_SECURE_BUFFER) {
-            ovutils::setMdpFlags(mdpFlags, ovutils::OV_MDP_SECURE_OVERLAY_SESSION);
-        }
-
-        // FIXME: Use source orientation for TV when source is portrait
-        int transform = layer->transform & FINAL_TRANSFORM_MASK;
-        ovutils::eTransform orient =
-            static_cast<ovutils::eTransform>(transform);
-
-        ovutils::eWait waitFlag = ovutils::NO_WAIT;
-        if (ctx->skipComposition == true) {
-            waitFlag = ovutils::WAIT;
-        }
-
-        ovutils::eIsFg isFgFlag = ovutils::IS_FG_OFF;
-        if (ctx->numHwLayers == 1) {
-            isFgFlag = ovutils::IS_FG_SET;
-        }
-
         ovutils::PipeArgs parg(mdpFlags,
                                orient,
                                info,
@@ -942,20 +2157,6 @@ static int prepareOverlay(hwc_context_t *ctx,
             return -1;
         }
 
-        int orientation = 0;
-#if defined HDMI_DUAL_DISPLAY
-        // Get the device orientation
-        if (hwcModule) {
-            framebuffer_device_t *fbDev = reinterpret_cast<framebuffer_device_t*>
-                                                            (hwcModule->fbDevice);
-            if (fbDev) {
-                private_module_t* m = reinterpret_cast<private_module_t*>(
-                                                         fbDev->common.module);
-                if (m)
-                    orientation = m->orientation;
-            }
-        }
-#endif
         ovutils::Dim dim;
         if (layer->flags & HWC_USE_ORIGINAL_RESOLUTION) {
             framebuffer_device_t* fbDev = hwcModule->fbDevice;
@@ -972,38 +2173,205 @@ static int prepareOverlay(hwc_context_t *ctx,
             dim.h = (displayFrame.bottom - displayFrame.top);
             dim.o = orientation;
         }
+        scaleToPanel(ctx, dim);
+
+        ret = ov.setPosition(dim, dest);
+        if (!ret) {
+            LOGE("%s: setPosition failed", __FUNCTION__);
+            return -1;
+        }
+        if (!ov.commit(dest)) {
+            LOGE("%s: commit fails", __FUNCTION__);
+            return -1;
+        }
+        storePipeConfig(ctx, pipeIndex, cfg);
+    }
+    return 0;
+}
+
+/* Returns the pipes used by an overlay state */
+static uint32_t getStatePipes(ovutils::eOverlayState state)
+{
+    switch (state) {
+        case ovutils::OV_CLOSED:
+        case ovutils::OV_UI_MIRROR:
+            return 0;
+        case ovutils::OV_2D_VIDEO_ON_PANEL:
+        case ovutils::OV_3D_VIDEO_ON_2D_PANEL:
+        case ovutils::OV_BYPASS_1_LAYER:
+            return ovutils::OV_PIPE0;
+        case ovutils::OV_2D_VIDEO_ON_PANEL_TV:
+        case ovutils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+        case ovutils::OV_3D_VIDEO_ON_3D_PANEL:
+        case ovutils::OV_3D_VIDEO_ON_3D_TV:
+        case ovutils::OV_3D_VIDEO_ON_2D_PANEL_2D_TV:
+        case ovutils::OV_BYPASS_2_LAYER:
+            return ovutils::OV_PIPE0 | ovutils::OV_PIPE1;
+        default:
+            return ovutils::OV_PIPE_ALL;
+    }
+}
+
+static bool isQueuedForRelease(const hwc_release_queue_t& queue,
+                               const private_handle_t* hnd)
+{
+    for (int i = 0; i < queue.count; i++) {
+        if (queue.entries[i].hnd == hnd)
+            return true;
+    }
+    return false;
+}
+
+/* Removes the entry at index from the queue and unlocks its buffer */
+static void releaseBuffer(hwc_release_queue_t& queue, int index)
+{
+    private_handle_t *hnd = queue.entries[index].hnd;
+    queue.count--;
+    for (int i = index; i < queue.count; i++) {
+        queue.entries[i] = queue.entries[i + 1];
+    }
+
+    // Validate the handle to make sure it hasn't been deallocated.
+    if (private_handle_t::validate(hnd)) {
+        LOGE("%s: Unregistering invalid gralloc handle %p.", __FUNCTION__, hnd);
+        return;
+    }
+    if (GENLOCK_FAILURE == genlock_unlock_buffer(hnd)) {
+        LOGE("%s: genlock_unlock_buffer failed", __FUNCTION__);
+    }
+    // The same buffer may still be queued on another pipe or frame
+    if (!isQueuedForRelease(queue, hnd)) {
+        hnd->flags &= ~private_handle_t::PRIV_FLAGS_HWC_LOCK;
+    }
+}
+
+/*
+ * Tracks a buffer locked for reading and queued on the pipes in the frame
+ * being set, until the pipes retire it.
+ */
+static void queueRelease(hwc_context_t* ctx, private_handle_t* hnd,
+                         uint32_t pipes)
+{
+    hwc_release_queue_t& queue = ctx->releaseQueue;
+    if (queue.count == MAX_RELEASE_ENTRIES) {
+        LOGE("%s: release queue full, releasing %p early", __FUNCTION__,
+             queue.entries[0].hnd);
+        releaseBuffer(queue, 0);
+    }
+
+    hwc_release_entry_t& entry = queue.entries[queue.count++];
+    entry.hnd = hnd;
+    entry.frame = queue.frame;
+    entry.pipes = pipes;
+    hnd->flags |= private_handle_t::PRIV_FLAGS_HWC_LOCK;
+}
 
-        ret = ov.setPosition(dim, dest);
-        if (!ret) {
-            LOGE("%s: setPosition failed", __FUNCTION__);
-            return -1;
+/*
+ * Retire event: the pipes have displayed the given frame. Releases the
+ * buffers they stopped fetching.
+ */
+static void retirePipes(hwc_context_t* ctx, uint32_t pipes, uint32_t frame)
+{
+    hwc_release_queue_t& queue = ctx->releaseQueue;
+    for (int i = 0; i < queue.count; ) {
+        hwc_release_entry_t& entry = queue.entries[i];
+        if ((int32_t)(frame - entry.frame) >= queue.depth)
+            entry.pipes &= ~pipes;
+        if (!entry.pipes) {
+            releaseBuffer(queue, i);
+        } else {
+            i++;
         }
-        if (!ov.commit(dest)) {
-            LOGE("%s: commit fails", __FUNCTION__);
-            return -1;
+    }
+}
+
+/* Releases the buffers of the pipes closed by the current overlay state */
+static void releaseIdlePipes(hwc_context_t* ctx)
+{
+    overlay2::Overlay& ov = ctx->mOverlayLibObject->ov();
+    uint32_t idlePipes = ovutils::OV_PIPE_ALL & ~getStatePipes(ov.getState());
+    hwc_release_queue_t& queue = ctx->releaseQueue;
+    for (int i = 0; i < queue.count; ) {
+        hwc_release_entry_t& entry = queue.entries[i];
+        entry.pipes &= ~idlePipes;
+        if (!entry.pipes) {
+            releaseBuffer(queue, i);
+        } else {
+            i++;
         }
     }
-    return 0;
 }
 
-void unlockPreviousOverlayBuffer(hwc_context_t* ctx)
+/* Releases all the buffers, once the pipes are gone */
+static void flushReleaseQueue(hwc_context_t* ctx)
 {
-    private_handle_t *hnd = (private_handle_t*) ctx->previousOverlayHandle;
-    if (hnd) {
-        // Validate the handle before attempting to use it.
-        if (!private_handle_t::validate(hnd) && isBufferLocked(hnd)) {
-            if (GENLOCK_NO_ERROR == genlock_unlock_buffer(hnd)) {
-                //If previous is same as current, keep locked.
-                if(hnd != ctx->currentOverlayHandle) {
-                    hnd->flags &= ~private_handle_t::PRIV_FLAGS_HWC_LOCK;
-                }
-            } else {
-                LOGE("%s: genlock_unlock_buffer failed", __FUNCTION__);
-            }
+    while (ctx->releaseQueue.count) {
+        releaseBuffer(ctx->releaseQueue, 0);
+    }
+}
+
+/* Commit thread handler, waits for the pipes of a frame to be picked up */
+static bool commitFrameHandler(void *udata, const CommitFrame& frame)
+{
+    hwc_context_t* ctx = (hwc_context_t*)(udata);
+    overlay2::Overlay& ov = ctx->mOverlayLibObject->ov();
+    bool ret = true;
+    for (int i = 0; i < frame.numPipes; i++) {
+        if (!ov.waitForVsync(static_cast<ovutils::eDest>(frame.pipes[i]))) {
+            LOGE("%s: waitForVsync failed for pipe %d", __FUNCTION__,
+                 frame.pipes[i]);
+            ret = false;
         }
     }
-    ctx->previousOverlayHandle = ctx->currentOverlayHandle;
-    ctx->currentOverlayHandle = NULL;
+    return ret;
+}
+
+/*
+ * Hands the vsync waits of this frame to the commit thread. The pipes
+ * played in this frame are retired by finishCommit, once the display
+ * picked up this frame. hwc_prepare and hwc_set both finish the commit
+ * first, so the wait only overlaps the work SurfaceFlinger does between
+ * frames. Until then, the overlay is left alone: setOverlayState finishes
+ * the commit, and the idle pipes are released by finishCommit.
+ */
+static void queueCommit(hwc_context_t* ctx)
+{
+    hwc_release_queue_t& queue = ctx->releaseQueue;
+    if (ctx->commitThread != NULL) {
+        ctx->commitThread->queueFrame(ctx->commitFrame);
+        ctx->isCommitPending = true;
+        queue.pendingFrame = queue.frame;
+        queue.pendingPipes = queue.playedPipes;
+    } else {
+        commitFrameHandler(ctx, ctx->commitFrame);
+        retirePipes(ctx, queue.playedPipes, queue.frame);
+    }
+    ctx->commitFrame.numPipes = 0;
+}
+
+/* Waits for the commit thread to be done with the pipes */
+static void waitForCommit(hwc_context_t* ctx)
+{
+    if (ctx->commitThread != NULL) {
+        ctx->commitThread->waitForIdle();
+    }
+}
+
+/*
+ * Waits for the queued frame to be picked up, retires its pipes and
+ * releases the ones closed meanwhile. Must be called before the overlay
+ * is touched again.
+ */
+static void finishCommit(hwc_context_t* ctx)
+{
+    if (!ctx->isCommitPending)
+        return;
+
+    waitForCommit(ctx);
+    ctx->isCommitPending = false;
+    retirePipes(ctx, ctx->releaseQueue.pendingPipes,
+                ctx->releaseQueue.pendingFrame);
+    releaseIdlePipes(ctx);
 }
 
 bool canSkipComposition(hwc_context_t* ctx, int yuvBufferCount,
@@ -1025,19 +2393,20 @@ bool canSkipComposition(hwc_context_t* ctx, int yuvBufferCount,
     if (hwcModule->compositionType == COMPOSITION_TYPE_CPU)
         return false;
 
-    //Video / Camera case
-    if (ctx->yuvBufferCount == 1) {
+    //Video / Camera case, all the videos being drawn with overlay
+    if ((ctx->numVideoPipes > 0) &&
+        (ctx->yuvBufferCount == ctx->numVideoPipes)) {
         //If the previousLayerCount is anything other than the current count, it
         //means something changed and we need to compose atleast once to FB.
         if (currentLayerCount != ctx->previousLayerCount) {
             ctx->previousLayerCount = currentLayerCount;
             return false;
         }
-        // We either have only one overlay layer or we have
+        // We either have only overlay layers or we have
         // all non-updating UI layers.
         // We can skip the composition of the UI layers.
-        if ((currentLayerCount == 1) ||
-            ((currentLayerCount - 1) == numLayersNotUpdating)) {
+        if ((currentLayerCount == ctx->numVideoPipes) ||
+            ((currentLayerCount - ctx->numVideoPipes) == numLayersNotUpdating)) {
             return true;
         }
     } else {
@@ -1083,16 +2452,205 @@ static bool canUseCopybit(const framebuffer_device_t* fbDev, const hwc_layer_lis
     return (renderArea <= (2 * fb_w * fb_h));
 }
 
+static const char* const pathNames[COMP_PATH_MAX] = {
+    "copybit", "gpu", "overlay"
+};
+static const char* const layerClassNames[LAYER_CLASS_MAX] = { "rgb", "yuv" };
+
+static void resetPathPolicy(hwc_context_t* ctx)
+{
+    hwc_path_policy_t& policy = ctx->pathPolicy;
+    memset(&policy, 0, sizeof(policy));
+    for (int i = 0; i < LAYER_CLASS_MAX; i++) {
+        policy.path[i] = -1;
+    }
+}
+
+static inline int getLayerClass(const hwc_layer_t* layer)
+{
+    private_handle_t *hnd = (private_handle_t *)layer->handle;
+    return (hnd && isYuvBuffer(hnd)) ? LAYER_CLASS_YUV : LAYER_CLASS_RGB;
+}
+
+static inline int getLayerArea(const hwc_layer_t* layer)
+{
+    int w, h;
+    getLayerResolution(layer, w, h);
+    return max(w, 0) * max(h, 0);
+}
+
+static void addPathCost(hwc_path_cost_t& cost, int64_t sample)
+{
+    if (cost.samples++ == 0)
+        cost.cost = sample;
+    else
+        cost.cost += (sample - cost.cost) >> PATH_COST_SHIFT;
+}
+
+/*
+ * Returns true if the layer should be drawn with copybit rather than the
+ * GPU. useCopybit is the static heuristic, used until both paths of the
+ * layer class have been measured.
+ */
+static bool isCopybitCheaper(hwc_context_t* ctx, const hwc_layer_t* layer,
+                             bool useCopybit)
+{
+    const hwc_path_policy_t& policy = ctx->pathPolicy;
+    int layerClass = getLayerClass(layer);
+    int path = policy.path[layerClass];
+    if (path < 0)
+        path = useCopybit ? COMP_PATH_COPYBIT : COMP_PATH_GPU;
+
+    // Every so often, draw with the other path to measure it
+    if ((policy.frame % PATH_PROBE_FRAMES) == PATH_PROBE_FRAMES - 1)
+        path = (path == COMP_PATH_COPYBIT) ? COMP_PATH_GPU : COMP_PATH_COPYBIT;
+    return path == COMP_PATH_COPYBIT;
+}
+
+/* Accounts the time taken to draw a layer with a path in this frame */
+static inline void addLayerTime(hwc_context_t* ctx, const hwc_layer_t* layer,
+                                int path, nsecs_t time)
+{
+    int layerClass = getLayerClass(layer);
+    ctx->pathPolicy.frameTime[layerClass][path] += time;
+    ctx->pathPolicy.frameArea[layerClass][path] += getLayerArea(layer);
+}
+
+/* Shares the time spent waiting for copybit between its layers by area */
+static void addCopybitWaitTime(hwc_context_t* ctx, nsecs_t time)
+{
+    hwc_path_policy_t& policy = ctx->pathPolicy;
+    int64_t area = 0;
+    for (int c = 0; c < LAYER_CLASS_MAX; c++)
+        area += policy.frameArea[c][COMP_PATH_COPYBIT];
+    if (area <= 0)
+        return;
+    for (int c = 0; c < LAYER_CLASS_MAX; c++)
+        policy.frameTime[c][COMP_PATH_COPYBIT] += time *
+                policy.frameArea[c][COMP_PATH_COPYBIT] / area;
+}
+
+/*
+ * Turns the times measured in the frame into path costs and switches the
+ * path of a layer class once the other one has been clearly cheaper for a
+ * while. swapTime is the eglSwapBuffers duration, -1 if it was skipped.
+ */
+static void updatePathCosts(hwc_context_t* ctx, const hwc_layer_list_t* list,
+                            nsecs_t swapTime)
+{
+    hwc_path_policy_t& policy = ctx->pathPolicy;
+
+    // The GPU composes while eglSwapBuffers flushes and posts. Its fixed
+    // part, measured on frames without GPU composed layers, is not charged
+    // to the layers.
+    int64_t gpuArea = 0;
+    for (size_t i = 0; list && i < list->numHwLayers; i++) {
+        const hwc_layer_t* layer = &list->hwLayers[i];
+        if ((layer->compositionType == HWC_FRAMEBUFFER) &&
+            !(layer->flags & HWC_COMP_BYPASS)) {
+            policy.frameArea[getLayerClass(layer)][COMP_PATH_GPU] +=
+                                                    getLayerArea(layer);
+            gpuArea += getLayerArea(layer);
+        }
+    }
+    if (swapTime >= 0) {
+        if (!gpuArea) {
+            addPathCost(policy.swapBase, swapTime);
+        } else {
+            int64_t gpuTime = swapTime - policy.swapBase.cost;
+            if (gpuTime < 0)
+                gpuTime = 0;
+            for (int c = 0; c < LAYER_CLASS_MAX; c++) {
+                policy.frameTime[c][COMP_PATH_GPU] = gpuTime *
+                        policy.frameArea[c][COMP_PATH_GPU] / gpuArea;
+            }
+        }
+    }
+
+    for (int c = 0; c < LAYER_CLASS_MAX; c++) {
+        for (int p = 0; p < COMP_PATH_MAX; p++) {
+            int64_t area = policy.frameArea[c][p];
+            if ((area > 0) && ((p != COMP_PATH_GPU) || (swapTime >= 0)))
+                addPathCost(policy.costs[c][p],
+                            policy.frameTime[c][p] * 1024 / area);
+            policy.frameTime[c][p] = 0;
+            policy.frameArea[c][p] = 0;
+        }
+
+        const hwc_path_cost_t* costs = policy.costs[c];
+        if (!costs[COMP_PATH_COPYBIT].samples || !costs[COMP_PATH_GPU].samples)
+            continue;
+        int cheaper =
+            (costs[COMP_PATH_COPYBIT].cost <= costs[COMP_PATH_GPU].cost) ?
+            COMP_PATH_COPYBIT : COMP_PATH_GPU;
+        if (policy.path[c] < 0) {
+            policy.path[c] = cheaper;
+            continue;
+        }
+        int other = (policy.path[c] == COMP_PATH_COPYBIT) ?
+                    COMP_PATH_GPU : COMP_PATH_COPYBIT;
+        if (costs[other].cost * (100 + PATH_SWITCH_MARGIN) <
+                                costs[policy.path[c]].cost * 100) {
+            if (++policy.cheaperFrames[c] >= PATH_SWITCH_FRAMES) {
+                LOGD_IF(DEBUG_HWC, "%s: %s layers switch to %s", __FUNCTION__,
+                        layerClassNames[c], pathNames[other]);
+                policy.path[c] = other;
+                policy.cheaperFrames[c] = 0;
+                policy.switches++;
+            }
+        } else {
+            policy.cheaperFrames[c] = 0;
+        }
+    }
+    policy.frame++;
+}
+
+static void dumpPathCosts(const hwc_context_t* ctx)
+{
+    const hwc_path_policy_t& policy = ctx->pathPolicy;
+    LOGD("Composition path costs (ns/1024 pixels), frame %u, %u switches,"
+         " swap base %lld ns", policy.frame, policy.switches,
+         (long long)policy.swapBase.cost);
+    for (int c = 0; c < LAYER_CLASS_MAX; c++) {
+        const hwc_path_cost_t* costs = policy.costs[c];
+        LOGD("\t%s: path=%s copybit=%lld(%u) gpu=%lld(%u) overlay=%lld(%u)",
+             layerClassNames[c],
+             (policy.path[c] < 0) ? "static" : pathNames[policy.path[c]],
+             (long long)costs[COMP_PATH_COPYBIT].cost,
+             costs[COMP_PATH_COPYBIT].samples,
+             (long long)costs[COMP_PATH_GPU].cost, costs[COMP_PATH_GPU].samples,
+             (long long)costs[COMP_PATH_OVERLAY].cost,
+             costs[COMP_PATH_OVERLAY].samples);
+    }
+}
+
+static void dumpBandwidth(const hwc_context_t* ctx)
+{
+    const hwc_bandwidth_t& bw = ctx->bandwidth;
+    LOGD("MDP bandwidth (KB/s): budget=%d last=%d peak=%d average=%lld,"
+         " %u frames, %u configurations refused", bw.budget, bw.last, bw.peak,
+         bw.frames ? (long long)(bw.total / bw.frames) : 0LL, bw.frames,
+         bw.refused);
+}
+
 static void handleHDMIStateChange(hwc_composer_device_t *dev, int externaltype) {
 #if defined HDMI_DUAL_DISPLAY
     private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
                                                            dev->common.module);
     LOGE_IF(DEBUG_HWC, "%s: externaltype=%d", __FUNCTION__, externaltype);
 
+    // The framebuffer changes the pipes, let the commit thread finish first
+    waitForCommit((hwc_context_t*)(dev));
+    // The framebuffer and the next frames pick the overlay state from the
+    // TV type, which the config watcher would only see on its next poll
+    RuntimeConfig::getInstance()->refresh(true);
+
     framebuffer_device_t *fbDev = hwcModule->fbDevice;
     if (fbDev) {
             fbDev->perform(fbDev, EVENT_EXTERNAL_DISPLAY, externaltype);
     }
+    // The framebuffer may have changed the overlay state behind our back
+    invalidatePipeConfigs((hwc_context_t*)(dev));
 #endif
 }
 
@@ -1128,6 +2686,8 @@ static void hwc_enableHDMIOutput(hwc_composer_device_t *dev, int externaltype) {
     // Store the external display
     ctx->mHDMIEnabled = (external_display_type)externaltype;
     if(ctx->mHDMIEnabled) { //On connect, allow bypass to draw once to FB
+        // The next prepare picks the overlay state from the TV type
+        RuntimeConfig::getInstance()->refresh(true);
         ctx->pendingHDMI = true;
     } else { //On disconnect, close immediately (there will be no bypass)
         handleHDMIStateChange(dev, ctx->mHDMIEnabled);
@@ -1149,6 +2709,10 @@ static void hwc_perform(hwc_composer_device_t *dev, int event, int value) {
             hwc_enableHDMIOutput(dev, value);
             break;
 #endif
+        case EVENT_DUMP_HWC_STATS:
+            dumpPathCosts(ctx);
+            dumpBandwidth(ctx);
+            break;
         default:
             LOGE("In hwc:perform UNKNOWN EVENT = %d!!", event);
             break;
@@ -1240,6 +2804,61 @@ static void statCount(hwc_context_t *ctx, hwc_layer_list_t* list) {
     return;
  }
 
+/*
+ * Picks the video layers fetched by the VG pipes. The pipes are blended
+ * below the framebuffer, so they go to the bottom most videos and the
+ * videos above them fall back to copybit/GPU composition.
+ * Several videos are only supported for 2D content on the primary panel.
+ */
+static void assignVideoPipes(hwc_context_t *ctx, const hwc_layer_list_t* list)
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    ctx->numVideoPipes = 0;
+    for (int i = 0; i < ovutils::MAX_VG_PIPES; i++) {
+        ctx->videoLayerIndex[i] = -1;
+    }
+
+    bool isSingleVideo = (ctx->yuvBufferCount == 1);
+    if (!isSingleVideo && (isExternalConnected(ctx) || ctx->s3dLayerFormat
+#if defined HDMI_DUAL_DISPLAY
+        || ctx->pendingHDMI
+#endif
+        )) {
+        return;
+    }
+
+    for (size_t i = 0; i < list->numHwLayers; i++) {
+        const hwc_layer_t* layer = &list->hwLayers[i];
+        private_handle_t *hnd = (private_handle_t *)layer->handle;
+        if (!isYuvBuffer(hnd) || isSkipLayer(layer) ||
+            (layer->flags & HWC_DO_NOT_USE_OVERLAY)) {
+            continue;
+        }
+        // A lone video handles an invalid destination itself
+        if (!isSingleVideo &&
+            !isValidDestination(hwcModule->fbDevice, layer->displayFrame)) {
+            continue;
+        }
+        if (ctx->numVideoPipes == ovutils::MAX_VG_PIPES) {
+            LOGE_IF(DEBUG_HWC, "%s: no VG pipe left for layer %d",
+                    __FUNCTION__, (int)i);
+            break;
+        }
+        ctx->videoLayerIndex[ctx->numVideoPipes++] = i;
+    }
+}
+
+/* Returns the VG pipe of the layer, -1 if it is not drawn with overlay */
+static inline int getVideoPipeIndex(const hwc_context_t *ctx, int layerIndex)
+{
+    for (int i = 0; i < ctx->numVideoPipes; i++) {
+        if (ctx->videoLayerIndex[i] == layerIndex)
+            return i;
+    }
+    return -1;
+}
+
 static int prepareForReconfiguration(hwc_context_t *ctx, hwc_layer_t *layer)
 {
    LOGD("prepareForReconfiguration E");
@@ -1271,6 +2890,7 @@ static int prepareForReconfiguration(hwc_context_t *ctx, hwc_layer_t *layer)
    ovutils::Dim pos(displayFrame.left, displayFrame.top, //x,y
                     (displayFrame.right - displayFrame.left), //w
                     (displayFrame.bottom - displayFrame.top)); //h
+   scaleToPanel(ctx, pos);
 
    ovutils::PlayInfo playInfo;
    playInfo.fd = hnd->fd;
@@ -1294,22 +2914,18 @@ static int prepareForReconfiguration(hwc_context_t *ctx, hwc_layer_t *layer)
 static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
     ovutils::Timer t("hwc_prepare");
     hwc_context_t* ctx = (hwc_context_t*)(dev);
-    ctx->currentOverlayHandle = NULL;
 
     if(!ctx) {
         LOGE("hwc_prepare invalid context");
         return -1;
     }
+    finishCommit(ctx);
 
     private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
                                                            dev->common.module);
     if (!hwcModule) {
         LOGE("hwc_prepare invalid module");
-#ifdef COMPOSITION_BYPASS
-        unlockPreviousBypassBuffers(ctx);
-        unsetBypassBufferLockState(ctx);
-#endif
-        unlockPreviousOverlayBuffer(ctx);
+        releaseIdlePipes(ctx);
         return -1;
     }
 
@@ -1317,18 +2933,39 @@ static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
     bool isS3DCompositionNeeded = false;
     bool useCopybit = false;
     bool isSkipLayerPresent = false;
+    bool isOverlayWarmedUp = false;
 
     if (list) {
+        // Any geometry change invalidates the pipe configurations committed
+        // for the previous frame
+        if (list->flags & HWC_GEOMETRY_CHANGED) {
+            invalidatePipeConfigs(ctx);
+        }
+
+        trackLayers(ctx, list);
+        resetBandwidth(ctx);
+#ifdef COMPOSITION_BYPASS
+        // Leave the idle mode on the first change, bypassing it right away
+        if (ctx->isIdle && !ctx->forceComposition &&
+            hasLayerChanged(ctx, list)) {
+            LOGE_IF(BYPASS_DEBUG, "%s: leaving idle mode", __FUNCTION__);
+            ctx->isIdle = false;
+        }
+        updateStaticCacheState(ctx);
+#endif
+
         useCopybit = canUseCopybit(hwcModule->fbDevice, list);
         // cache the number of layer(like YUV, SecureBuffer, notupdating etc.,)
         statCount(ctx, list);
+        assignVideoPipes(ctx, list);
         ctx->skipComposition = canSkipComposition(ctx, ctx->yuvBufferCount,
                                 list->numHwLayers, ctx->numLayersNotUpdating);
 
-        /* If video is ending, unlock the previously locked buffer
-         * and close the overlay channels if opened
+        /* If video is ending, or no video can use the overlay anymore,
+         * unlock the previously locked buffer and close the overlay
+         * channels if opened
          */
-        if (ctx->yuvBufferCount == 0) {
+        if (ctx->numVideoPipes == 0) {
             if (ctx->hwcOverlayStatus == HWC_OVERLAY_OPEN)
                 ctx->hwcOverlayStatus = HWC_OVERLAY_PREPARE_TO_CLOSE;
         }
@@ -1355,7 +2992,8 @@ static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
                 if(isYuvBuffer(hnd)) {
                     if (ctx->hwcOverlayStatus == HWC_OVERLAY_OPEN)
                         ctx->hwcOverlayStatus = HWC_OVERLAY_PREPARE_TO_CLOSE;
-                    unlockPreviousOverlayBuffer(ctx);
+                    warmUpOverlay(ctx, &list->hwLayers[i]);
+                    isOverlayWarmedUp = ctx->overlayWarmUp.active;
                 }
                 // During the animaton UI layers are marked as SKIP
                 // need to still mark the layer for S3D composition
@@ -1365,7 +3003,14 @@ static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
                 list->hwLayers[i].compositionType = HWC_FRAMEBUFFER;
                 list->hwLayers[i].hints &= ~HWC_HINT_CLEAR_FB;
                 markForGPUComp(ctx, list, i);
-            } else if (hnd && (hnd->bufferType == BUFFER_TYPE_VIDEO) && (ctx->yuvBufferCount == 1)) {
+            } else if (isSolidColorLayer(&list->hwLayers[i]) &&
+                canFillSolidColor(hwcModule)) {
+                // Dim and color layers are filled by copybit, so they
+                // neither force the whole frame to the GPU nor prevent bypass
+                list->hwLayers[i].compositionType = HWC_USE_COPYBIT;
+                list->hwLayers[i].hints &= ~HWC_HINT_CLEAR_FB;
+            } else if (hnd && (hnd->bufferType == BUFFER_TYPE_VIDEO) &&
+                       (getVideoPipeIndex(ctx, i) >= 0)) {
                 int videoStarted = (ctx->s3dLayerFormat && ovutils::is3DTV()) ?
                             VIDEO_3D_OVERLAY_STARTED : VIDEO_2D_OVERLAY_STARTED;
                 setVideoOverlayStatusInGralloc(ctx, videoStarted);
@@ -1380,7 +3025,10 @@ static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
                     ctx->skipComposition = false;
                     if (ctx->hwcOverlayStatus == HWC_OVERLAY_OPEN)
                         ctx->hwcOverlayStatus = HWC_OVERLAY_PREPARE_TO_CLOSE;
-                } else if(prepareOverlay(ctx, &(list->hwLayers[i])) == 0) {
+                    warmUpOverlay(ctx, &list->hwLayers[i]);
+                    isOverlayWarmedUp = ctx->overlayWarmUp.active;
+                } else if(prepareOverlay(ctx, &(list->hwLayers[i]),
+                                         getVideoPipeIndex(ctx, i)) == 0) {
                     list->hwLayers[i].compositionType = HWC_USE_OVERLAY;
                     list->hwLayers[i].hints |= HWC_HINT_CLEAR_FB;
                     // We've opened the channel. Set the state to open.
@@ -1402,7 +3050,7 @@ static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
                 int videoStarted = ovutils::is3DTV() ? VIDEO_3D_OVERLAY_STARTED
                                                     : VIDEO_2D_OVERLAY_STARTED;
                 setVideoOverlayStatusInGralloc(ctx, videoStarted);
-                if(prepareOverlay(ctx, &(list->hwLayers[i])) == 0) {
+                if(prepareOverlay(ctx, &(list->hwLayers[i]), 0) == 0) {
                     list->hwLayers[i].compositionType = HWC_USE_OVERLAY;
                     list->hwLayers[i].hints |= HWC_HINT_CLEAR_FB;
                     // We've opened the channel. Set the state to open.
@@ -1414,11 +3062,17 @@ static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
                 list->hwLayers[i].compositionType = HWC_USE_OVERLAY;
                 list->hwLayers[i].hints |= HWC_HINT_CLEAR_FB;
                 layerType |= HWC_ORIG_RESOLUTION;
+            } else if (hnd && (hwcModule->compositionType &
+                    COMPOSITION_TYPE_DYN)) {
+                list->hwLayers[i].compositionType =
+                    isCopybitCheaper(ctx, &list->hwLayers[i], useCopybit) ?
+                    HWC_USE_COPYBIT : HWC_FRAMEBUFFER;
             } else if (hnd && (hwcModule->compositionType &
                     (COMPOSITION_TYPE_C2D|COMPOSITION_TYPE_MDP))) {
                 list->hwLayers[i].compositionType = HWC_USE_COPYBIT;
-            } else if ((hwcModule->compositionType & COMPOSITION_TYPE_DYN)
-                    && useCopybit) {
+            } else if (hnd && (hwcModule->compositionType &
+                    COMPOSITION_TYPE_CPU) && hwcModule->swCopybitEngine &&
+                    isCPUCopybitFormat(hnd->format)) {
                 list->hwLayers[i].compositionType = HWC_USE_COPYBIT;
             }
             else {
@@ -1426,6 +3080,10 @@ static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
             }
         }
 
+        // The warmed up pipe is either in use now or no longer needed
+        if (!isOverlayWarmedUp)
+            endOverlayWarmUp(ctx);
+
         if (ctx->skipComposition) {
             list->flags |= HWC_SKIP_COMPOSITION;
         } else {
@@ -1437,12 +3095,14 @@ static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
         bool isDoable = isBypassDoable(dev, ctx->yuvBufferCount, list);
         //Check if bypass is feasible
         if(isDoable && !isSkipLayerPresent) {
-            if(setupBypass(ctx, list)) {
+            int bandwidthUsed = ctx->bandwidth.used;
+            if(setupStaticCacheBypass(ctx, list) || setupBypass(ctx, list)) {
                 setBypassLayerFlags(ctx, list);
                 ctx->bypassState = BYPASS_ON;
             } else {
                 LOGE_IF(BYPASS_DEBUG,"%s: Bypass setup Failed",__FUNCTION__);
                 isBypassUsed = false;
+                ctx->bandwidth.used = bandwidthUsed;
 
                 // If failed to setup bypass, states may have already been set
                 // so reset here
@@ -1463,12 +3123,32 @@ static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
             }
         }
 #endif
-    } else {
+
+        // The framebuffer still holds what it would be composed to, so there
+        // is nothing to post. Needs the MDP pipes up, as they pace the frame.
+        ctx->isFBSkipped = false;
+        if (!(list->flags & HWC_SKIP_COMPOSITION) &&
 #ifdef COMPOSITION_BYPASS
-        unlockPreviousBypassBuffers(ctx);
-        unsetBypassBufferLockState(ctx);
+            (ctx->bypassState != BYPASS_OFF_PENDING) &&
 #endif
-        unlockPreviousOverlayBuffer(ctx);
+            (ctx->mOverlayLibObject->ov().getState() != ovutils::OV_CLOSED) &&
+            !ctx->overlayWarmUp.active &&
+            isFBContentUnchanged(ctx, list)) {
+            list->flags |= HWC_SKIP_COMPOSITION;
+            ctx->isFBSkipped = true;
+        }
+        if (!(list->flags & HWC_SKIP_COMPOSITION)) {
+            storeFBContent(ctx, list);
+            updateFBClears(ctx, list);
+        }
+        updateBandwidthStats(ctx);
+    } else {
+        releaseIdlePipes(ctx);
+        invalidatePipeConfigs(ctx);
+        endOverlayWarmUp(ctx);
+        ctx->numFBLayers = -1;
+        memset(ctx->fbClears, 0, sizeof(ctx->fbClears));
+        ctx->isFBSkipped = false;
     }
     ctx->forceComposition = false;
     return 0;
@@ -1479,7 +3159,15 @@ struct range {
     int end;
 };
 struct region_iterator : public copybit_region_t {
-    
+
+    region_iterator() {
+        mRegion.numRects = 0;
+        mRegion.rects = NULL;
+        r.end = 0;
+        r.current = 0;
+        this->next = iterate;
+    }
+
     region_iterator(hwc_region_t region) {
         mRegion = region;
         r.end = region.numRects;
@@ -1487,39 +3175,278 @@ struct region_iterator : public copybit_region_t {
         this->next = iterate;
     }
 
-private:
-    static int iterate(copybit_region_t const * self, copybit_rect_t* rect) {
-        if (!self || !rect) {
-            LOGE("iterate invalid parameters");
-            return 0;
-        }
+private:
+    static int iterate(copybit_region_t const * self, copybit_rect_t* rect) {
+        if (!self || !rect) {
+            LOGE("iterate invalid parameters");
+            return 0;
+        }
+
+        region_iterator const* me = static_cast<region_iterator const*>(self);
+        if (me->r.current != me->r.end) {
+            rect->l = me->mRegion.rects[me->r.current].left;
+            rect->t = me->mRegion.rects[me->r.current].top;
+            rect->r = me->mRegion.rects[me->r.current].right;
+            rect->b = me->mRegion.rects[me->r.current].bottom;
+            me->r.current++;
+            return 1;
+        }
+        return 0;
+    }
+    
+    hwc_region_t mRegion;
+    mutable range r; 
+};
+
+/* Returns the engine drawing the copybit layers of this frame */
+static inline copybit_device_t* getCopybitEngine(const hwc_context_t *ctx)
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    return ctx->copybit ? ctx->copybit : hwcModule->copybitEngine;
+}
+
+/*
+ * Blends the copybit layers of the frame on the CPU when they are all
+ * small and in formats the CPU engine blits: waking the copybit hardware
+ * for them costs more than the blending. Either engine is used for the
+ * whole frame so that the CPU never waits for the hardware.
+ */
+static void selectCopybitEngine(hwc_context_t *ctx, const hwc_layer_list_t *list)
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    ctx->copybit = NULL;
+    copybit_device_t *swCopybit = hwcModule->swCopybitEngine;
+    if (!swCopybit || (swCopybit == hwcModule->copybitEngine) ||
+        (ctx->cpuCopybitArea <= 0) || !hwcModule->fbDevice ||
+        !isCPUCopybitFormat(hwcModule->fbDevice->format))
+        return;
+#ifdef COMPOSITION_BYPASS
+    // The static cache is composed with the engine of the frame
+    if (ctx->staticCache.active && !ctx->staticCache.valid)
+        return;
+#endif
+
+    int64_t area = 0;
+    for (size_t i = 0; i < list->numHwLayers; i++) {
+        const hwc_layer_t *layer = &list->hwLayers[i];
+        if (layer->compositionType != HWC_USE_COPYBIT)
+            continue;
+        private_handle_t *hnd = (private_handle_t *)layer->handle;
+        if (!isSolidColorLayer(layer) && !isCPUCopybitFormat(hnd->format))
+            return;
+        area += getLayerArea(layer);
+    }
+    if (area > 0 && area <= ctx->cpuCopybitArea)
+        ctx->copybit = swCopybit;
+}
+
+/*
+ * Waits for the copybit blits issued so far and unlocks the buffers they
+ * read. Returns the time spent waiting.
+ */
+static nsecs_t finishCopybit(hwc_context_t *ctx)
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    copybit_device_t *copybit = hwcModule->copybitEngine;
+    nsecs_t start = systemTime();
+    if (copybit && copybit->finish && copybit->finish(copybit) < 0)
+        LOGE("%s: copybit finish failed", __FUNCTION__);
+    nsecs_t time = systemTime() - start;
+
+    for (int i = 0; i < ctx->numCopybitLocks; i++) {
+        if (GENLOCK_FAILURE == genlock_unlock_buffer(ctx->copybitLocks[i])) {
+            LOGE("%s: genlock_unlock_buffer failed", __FUNCTION__);
+        }
+    }
+    ctx->numCopybitLocks = 0;
+    return time;
+}
+
+/*
+ * Unlocks a buffer read by copybit, once the blit is done. With
+ * asynchronous copybit that is at the next finishCopybit().
+ */
+static void unlockAfterCopybit(hwc_context_t *ctx, private_handle_t *hnd)
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    copybit_device_t *copybit = hwcModule->copybitEngine;
+    if (copybit && copybit->finish) {
+        if (ctx->numCopybitLocks == MAX_COPYBIT_LOCKS)
+            finishCopybit(ctx);
+        ctx->copybitLocks[ctx->numCopybitLocks++] = hnd;
+        return;
+    }
+
+    if (GENLOCK_FAILURE == genlock_unlock_buffer(hnd)) {
+        LOGE("%s: genlock_unlock_buffer failed", __FUNCTION__);
+    }
+}
+
+/* Copybit layers of a frame waiting to be composed together */
+struct hwc_copybit_batch_t {
+    private_handle_t *fbHandle;
+    int fbWidth;
+    int fbHeight;
+    int count;
+    hwc_layer_t *hwLayers[MAX_COPYBIT_BATCH];
+    copybit_image_t srcs[MAX_COPYBIT_BATCH];
+    region_iterator regions[MAX_COPYBIT_BATCH];
+    copybit_layer_t layers[MAX_COPYBIT_BATCH];
+};
+
+/*
+ * Returns the color of a solid color layer as a RGBA_8888 pixel value,
+ * with the plane alpha folded into the color alpha. Dim layers are black.
+ */
+static int getSolidColor(const hwc_layer_t *layer, uint32_t& color)
+{
+    uint32_t planeAlpha = (layer->blending == HWC_BLENDING_NONE) ?
+                          0xFF : layer->alpha;
+    private_handle_t *hnd = (private_handle_t *)layer->handle;
+    if (!hnd) {
+        color = planeAlpha << 24;
+        return 0;
+    }
+
+    if (!hnd->base) {
+        LOGE("%s: buffer not mapped", __FUNCTION__);
+        return -1;
+    }
+
+    if (GENLOCK_FAILURE == genlock_lock_buffer(hnd, GENLOCK_READ_LOCK,
+                                               GENLOCK_MAX_TIMEOUT)) {
+        LOGE("%s: genlock_lock_buffer(READ) failed", __FUNCTION__);
+        return -1;
+    }
+
+    uint32_t r, g, b, a = 0xFF;
+    if (hnd->format == HAL_PIXEL_FORMAT_RGB_565) {
+        uint16_t pixel = *(uint16_t *)hnd->base;
+        r = (pixel >> 11) & 0x1F;
+        g = (pixel >> 5) & 0x3F;
+        b = pixel & 0x1F;
+        r = (r << 3) | (r >> 2);
+        g = (g << 2) | (g >> 4);
+        b = (b << 3) | (b >> 2);
+    } else {
+        uint32_t pixel = *(uint32_t *)hnd->base;
+        r = pixel & 0xFF;
+        g = (pixel >> 8) & 0xFF;
+        b = (pixel >> 16) & 0xFF;
+        if (hnd->format == HAL_PIXEL_FORMAT_BGRA_8888)
+            ovutils::swap(r, b);
+        if (hnd->format != HAL_PIXEL_FORMAT_RGBX_8888)
+            a = pixel >> 24;
+    }
+
+    if (GENLOCK_FAILURE == genlock_unlock_buffer(hnd)) {
+        LOGE("%s: genlock_unlock_buffer failed", __FUNCTION__);
+    }
+
+    if (layer->blending == HWC_BLENDING_NONE) {
+        a = 0xFF;
+    } else if ((layer->blending == HWC_BLENDING_PREMULT) && a && (a < 0xFF)) {
+        // The fill blends with the color alpha, undo the premultiplication
+        r = min(0xFF, (int)(r * 0xFF / a));
+        g = min(0xFF, (int)(g * 0xFF / a));
+        b = min(0xFF, (int)(b * 0xFF / a));
+    }
+    a = (a * planeAlpha) / 0xFF;
+    color = (a << 24) | (b << 16) | (g << 8) | r;
+    return 0;
+}
+
+/*
+ * Fills the visible region of a solid color layer in the buffer with
+ * copybit, blending the layer alpha in hardware.
+ */
+static int fillLayerToBuffer(hwc_context_t *ctx, hwc_layer_t *layer,
+                             private_handle_t *fbHandle)
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    if(!hwcModule || !canFillSolidColor(hwcModule)) {
+        LOGE("%s: copybit cannot fill", __FUNCTION__);
+        return -1;
+    }
+
+    uint32_t color;
+    if (getSolidColor(layer, color) < 0)
+        return -1;
 
-        region_iterator const* me = static_cast<region_iterator const*>(self);
-        if (me->r.current != me->r.end) {
-            rect->l = me->mRegion.rects[me->r.current].left;
-            rect->t = me->mRegion.rects[me->r.current].top;
-            rect->r = me->mRegion.rects[me->r.current].right;
-            rect->b = me->mRegion.rects[me->r.current].bottom;
-            me->r.current++;
-            return 1;
-        }
+    // Nothing to blend
+    if ((color >> 24) == 0)
         return 0;
+
+    copybit_image_t dst;
+    dst.w = ALIGN(fbHandle->width,32);
+    dst.h = fbHandle->height;
+    dst.format = fbHandle->format;
+    dst.base = (void *)fbHandle->base;
+    dst.handle = (native_handle_t *)fbHandle;
+    dst.horiz_padding = 0;
+    dst.vert_padding = 0;
+
+    copybit_device_t *copybit = getCopybitEngine(ctx);
+    const hwc_rect_t& frame = layer->displayFrame;
+    const hwc_region_t& region = layer->visibleRegionScreen;
+    int err = 0;
+    for (size_t i = 0; (i < region.numRects) && (err == 0); i++) {
+        const hwc_rect_t& rect = region.rects[i];
+        copybit_rect_t fillRect = {max(rect.left, frame.left),
+                                   max(rect.top, frame.top),
+                                   min(rect.right, frame.right),
+                                   min(rect.bottom, frame.bottom)};
+        if ((fillRect.r <= fillRect.l) || (fillRect.b <= fillRect.t))
+            continue;
+        err = copybit->fill_color(copybit, &dst, &fillRect, color);
     }
-    
-    hwc_region_t mRegion;
-    mutable range r; 
-};
 
-static int drawLayerUsingCopybit(hwc_composer_device_t *dev, hwc_layer_t *layer, EGLDisplay dpy,
-                                 EGLSurface surface)
+    if(err < 0)
+        LOGE("%s: copybit fill_color failed", __FUNCTION__);
+    return err;
+}
+
+/* Sets the parameters of a layer and stretches it into dst */
+static int stretchLayer(copybit_device_t *copybit, const hwc_layer_t *layer,
+                        copybit_image_t const *dst, copybit_image_t const *src,
+                        copybit_rect_t const *dstRect,
+                        copybit_rect_t const *srcRect,
+                        int fbWidth, int fbHeight, uint32_t generation)
 {
-    hwc_context_t* ctx = (hwc_context_t*)(dev);
-    if(!ctx) {
-         LOGE("%s: null context ", __FUNCTION__);
-         return -1;
+    region_iterator copybitRegion(layer->visibleRegionScreen);
+
+    copybit->set_parameter(copybit, COPYBIT_FRAMEBUFFER_WIDTH, fbWidth);
+    copybit->set_parameter(copybit, COPYBIT_FRAMEBUFFER_HEIGHT, fbHeight);
+    copybit->set_parameter(copybit, COPYBIT_TRANSFORM, layer->transform);
+    copybit->set_parameter(copybit, COPYBIT_PLANE_ALPHA,
+                           (layer->blending == HWC_BLENDING_NONE) ? -1 : layer->alpha);
+    copybit->set_parameter(copybit, COPYBIT_PREMULTIPLIED_ALPHA,
+                           (layer->blending == HWC_BLENDING_PREMULT)? COPYBIT_ENABLE : COPYBIT_DISABLE);
+    copybit->set_parameter(copybit, COPYBIT_DITHER,
+                            (dst->format == HAL_PIXEL_FORMAT_RGB_565)? COPYBIT_ENABLE : COPYBIT_DISABLE);
+    copybit->set_parameter(copybit, COPYBIT_SOURCE_GENERATION, generation);
+    return copybit->stretch(copybit, dst, src, dstRect, srcRect, &copybitRegion);
+}
+
+/*
+ * Blits a layer with copybit into the buffer fbHandle, of fbWidth x fbHeight
+ * pixels. Used for the render buffer as well as the static layer cache.
+ * Layers the engine rejects are blended on the CPU instead, when they can.
+ */
+static int drawLayerToBuffer(hwc_context_t *ctx, hwc_layer_t *layer,
+                             private_handle_t *fbHandle, int fbWidth, int fbHeight)
+{
+    if (isSolidColorLayer(layer)) {
+        return fillLayerToBuffer(ctx, layer, fbHandle);
     }
 
-    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(dev->common.module);
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
     if(!hwcModule) {
         LOGE("%s: null module ", __FUNCTION__);
         return -1;
@@ -1538,19 +3465,6 @@ static int drawLayerUsingCopybit(hwc_composer_device_t *dev, hwc_layer_t *layer,
         LOGE("%s: genlock_lock_buffer(READ) failed", __FUNCTION__);
         return -1;
     }
-    //render buffer
-    android_native_buffer_t *renderBuffer = (android_native_buffer_t *)eglGetRenderBufferANDROID(dpy, surface);
-    if (!renderBuffer) {
-        LOGE("%s: eglGetRenderBufferANDROID returned NULL buffer", __FUNCTION__);
-        genlock_unlock_buffer(hnd);
-        return -1;
-    }
-    private_handle_t *fbHandle = (private_handle_t *)renderBuffer->handle;
-    if(!fbHandle) {
-        LOGE("%s: Framebuffer handle is NULL", __FUNCTION__);
-        genlock_unlock_buffer(hnd);
-        return -1;
-    }
 
     // Set the copybit source:
     copybit_image_t src;
@@ -1585,27 +3499,21 @@ static int drawLayerUsingCopybit(hwc_composer_device_t *dev, hwc_layer_t *layer,
     dst.h = fbHandle->height;
     dst.format = fbHandle->format;
     dst.base = (void *)fbHandle->base;
-    dst.handle = (native_handle_t *)renderBuffer->handle;
+    dst.handle = (native_handle_t *)fbHandle;
+    dst.horiz_padding = 0;
+    dst.vert_padding = 0;
 
-    copybit_device_t *copybit = hwcModule->copybitEngine;
+    copybit_device_t *copybit = getCopybitEngine(ctx);
+    copybit_device_t *cpuCopybit = hwcModule->swCopybitEngine;
+    if ((cpuCopybit == copybit) || !isCPUCopybitFormat(src.format) ||
+        !isCPUCopybitFormat(dst.format))
+        cpuCopybit = NULL;
 
     int32_t screen_w        = displayFrame.right - displayFrame.left;
     int32_t screen_h        = displayFrame.bottom - displayFrame.top;
     int32_t src_crop_width  = sourceCrop.right - sourceCrop.left;
     int32_t src_crop_height = sourceCrop.bottom -sourceCrop.top;
 
-    float copybitsMaxScale = (float)copybit->get(copybit,COPYBIT_MAGNIFICATION_LIMIT);
-    float copybitsMinScale = (float)copybit->get(copybit,COPYBIT_MINIFICATION_LIMIT);
-
-    if((layer->transform == HWC_TRANSFORM_ROT_90) ||
-                           (layer->transform == HWC_TRANSFORM_ROT_270)) {
-        //swap screen width and height
-        int tmp = screen_w;
-        screen_w  = screen_h;
-        screen_h = tmp;
-    }
-    private_handle_t *tmpHnd = NULL;
-
     if(screen_w <=0 || screen_h<=0 ||src_crop_width<=0 || src_crop_height<=0 ) {
         LOGE("%s: wrong params for display screen_w=%d src_crop_width=%d screen_w=%d \
                                 src_crop_width=%d", __FUNCTION__, screen_w,
@@ -1614,111 +3522,248 @@ static int drawLayerUsingCopybit(hwc_composer_device_t *dev, hwc_layer_t *layer,
         return -1;
     }
 
-    float dsdx = (float)screen_w/src_crop_width;
-    float dtdy = (float)screen_h/src_crop_height;
+    // Scales beyond a single pass are split into passes by the engine
+    err = stretchLayer(copybit, layer, &dst, &src, &dstRect, &srcRect,
+                       fbWidth, fbHeight, getLayerGeneration(ctx, layer));
 
-    float scaleLimitMax = copybitsMaxScale * copybitsMaxScale;
-    float scaleLimitMin = copybitsMinScale * copybitsMinScale;
-    if(dsdx > scaleLimitMax || dtdy > scaleLimitMax || dsdx < 1/scaleLimitMin || dtdy < 1/scaleLimitMin) {
-        LOGE("%s: greater than max supported size dsdx=%f dtdy=%f scaleLimitMax=%f scaleLimitMin=%f", __FUNCTION__,dsdx,dtdy,scaleLimitMax,1/scaleLimitMin);
-        genlock_unlock_buffer(hnd);
-        return -1;
+    if(err < 0 && cpuCopybit) {
+        // Blend the layer on the CPU, once the blits already issued into
+        // the buffer are done
+        addCopybitWaitTime(ctx, finishCopybit(ctx));
+        err = stretchLayer(cpuCopybit, layer, &dst, &src, &dstRect,
+                           &srcRect, fbWidth, fbHeight, 0);
     }
-    if(dsdx > copybitsMaxScale || dtdy > copybitsMaxScale || dsdx < 1/copybitsMinScale || dtdy < 1/copybitsMinScale){
-        // The requested scale is out of the range the hardware
-        // can support.
-       LOGD("%s:%d::Need to scale twice dsdx=%f, dtdy=%f,copybitsMaxScale=%f,copybitsMinScale=%f,screen_w=%d,screen_h=%d \
-                  src_crop_width=%d src_crop_height=%d",__FUNCTION__,__LINE__,
-                  dsdx,dtdy,copybitsMaxScale,1/copybitsMinScale,screen_w,screen_h,src_crop_width,src_crop_height);
-
-       //Driver makes width and height as even
-       //that may cause wrong calculation of the ratio
-       //in display and crop.Hence we make
-       //crop width and height as even.
-       src_crop_width  = (src_crop_width/2)*2;
-       src_crop_height = (src_crop_height/2)*2;
-
-       int tmp_w =  src_crop_width;
-       int tmp_h =  src_crop_height;
-
-       if (dsdx > copybitsMaxScale || dtdy > copybitsMaxScale ){
-         tmp_w = src_crop_width*copybitsMaxScale;
-         tmp_h = src_crop_height*copybitsMaxScale;
-       }else if (dsdx < 1/copybitsMinScale ||dtdy < 1/copybitsMinScale ){
-         tmp_w = src_crop_width/copybitsMinScale;
-         tmp_h = src_crop_height/copybitsMinScale;
-         tmp_w  = (tmp_w/2)*2;
-         tmp_h = (tmp_h/2)*2;
-       }
-       LOGD("%s:%d::tmp_w = %d,tmp_h = %d",__FUNCTION__,__LINE__,tmp_w,tmp_h);
-
-       int usage = GRALLOC_USAGE_PRIVATE_ADSP_HEAP |
-                   GRALLOC_USAGE_PRIVATE_MM_HEAP;
-
-       if (0 == alloc_buffer(&tmpHnd, tmp_w, tmp_h, fbHandle->format, usage)){
-            copybit_image_t tmp_dst;
-            copybit_rect_t tmp_rect;
-            tmp_dst.w = tmp_w;
-            tmp_dst.h = tmp_h;
-            tmp_dst.format = tmpHnd->format;
-            tmp_dst.handle = tmpHnd;
-            tmp_dst.horiz_padding = src.horiz_padding;
-            tmp_dst.vert_padding = src.vert_padding;
-            tmp_rect.l = 0;
-            tmp_rect.t = 0;
-            tmp_rect.r = tmp_dst.w;
-            tmp_rect.b = tmp_dst.h;
-            //create one clip region
-            hwc_rect tmp_hwc_rect = {0,0,tmp_rect.r,tmp_rect.b};
-            hwc_region_t tmp_hwc_reg = {1,(hwc_rect_t const*)&tmp_hwc_rect};
-            region_iterator tmp_it(tmp_hwc_reg);
-            copybit->set_parameter(copybit,COPYBIT_TRANSFORM,0);
-            copybit->set_parameter(copybit, COPYBIT_PLANE_ALPHA,
-                        (layer->blending == HWC_BLENDING_NONE) ? -1 : layer->alpha);
-            err = copybit->stretch(copybit,&tmp_dst, &src, &tmp_rect, &srcRect, &tmp_it);
-            if(err < 0){
-                LOGE("%s:%d::tmp copybit stretch failed",__FUNCTION__,__LINE__);
-                if(tmpHnd)
-                    free_buffer(tmpHnd);
-                genlock_unlock_buffer(hnd);
-                return err;
-            }
-            // copy new src and src rect crop
-            src = tmp_dst;
-            srcRect = tmp_rect;
-      }
+
+    if(err < 0)
+        LOGE("%s: copybit stretch failed",__FUNCTION__);
+
+    // Unlock this buffer once copybit is done with it.
+    unlockAfterCopybit(ctx, hnd);
+
+    return err;
+}
+
+static private_handle_t* getRenderBuffer(EGLDisplay dpy, EGLSurface surface,
+                                         int& width, int& height)
+{
+    android_native_buffer_t *renderBuffer = (android_native_buffer_t *)eglGetRenderBufferANDROID(dpy, surface);
+    if (!renderBuffer) {
+        LOGE("%s: eglGetRenderBufferANDROID returned NULL buffer", __FUNCTION__);
+        return NULL;
+    }
+    private_handle_t *fbHandle = (private_handle_t *)renderBuffer->handle;
+    if(!fbHandle) {
+        LOGE("%s: Framebuffer handle is NULL", __FUNCTION__);
+        return NULL;
     }
-    // Copybit region
-    hwc_region_t region = layer->visibleRegionScreen;
-    region_iterator copybitRegion(region);
+    width = renderBuffer->width;
+    height = renderBuffer->height;
+    return fbHandle;
+}
 
-    copybit->set_parameter(copybit, COPYBIT_FRAMEBUFFER_WIDTH, renderBuffer->width);
-    copybit->set_parameter(copybit, COPYBIT_FRAMEBUFFER_HEIGHT, renderBuffer->height);
-    copybit->set_parameter(copybit, COPYBIT_TRANSFORM, layer->transform);
-    copybit->set_parameter(copybit, COPYBIT_PLANE_ALPHA,
-                           (layer->blending == HWC_BLENDING_NONE) ? -1 : layer->alpha);
-    copybit->set_parameter(copybit, COPYBIT_PREMULTIPLIED_ALPHA,
-                           (layer->blending == HWC_BLENDING_PREMULT)? COPYBIT_ENABLE : COPYBIT_DISABLE);
-    copybit->set_parameter(copybit, COPYBIT_DITHER,
-                            (dst.format == HAL_PIXEL_FORMAT_RGB_565)? COPYBIT_ENABLE : COPYBIT_DISABLE);
-    err = copybit->stretch(copybit, &dst, &src, &dstRect, &srcRect, &copybitRegion);
+static int drawLayerUsingCopybit(hwc_composer_device_t *dev, hwc_layer_t *layer, EGLDisplay dpy,
+                                 EGLSurface surface)
+{
+    hwc_context_t* ctx = (hwc_context_t*)(dev);
+    if(!ctx) {
+         LOGE("%s: null context ", __FUNCTION__);
+         return -1;
+    }
 
-    if(tmpHnd)
-        free_buffer(tmpHnd);
+    //render buffer
+    int fbWidth, fbHeight;
+    private_handle_t *fbHandle = getRenderBuffer(dpy, surface, fbWidth, fbHeight);
+    if(!fbHandle) {
+        return -1;
+    }
 
-    if(err < 0)
-        LOGE("%s: copybit stretch failed",__FUNCTION__);
+    return drawLayerToBuffer(ctx, layer, fbHandle, fbWidth, fbHeight);
+}
 
-    // Unlock this buffer since copybit is done with it.
-    err = genlock_unlock_buffer(hnd);
-    if (GENLOCK_FAILURE == err) {
-        LOGE("%s: genlock_unlock_buffer failed", __FUNCTION__);
+/*
+ * Composes the queued copybit layers into the render buffer, with a single
+ * compose() call unless the engine rejects some of them. Those are blended
+ * on the CPU in their place, as drawLayerToBuffer() does, and the layers
+ * above them composed with another call. The time of each call is shared
+ * out between its layers by area.
+ */
+static int flushCopybitBatch(hwc_context_t *ctx, hwc_copybit_batch_t& batch)
+{
+    if (!batch.count)
+        return 0;
+
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    copybit_device_t *copybit = getCopybitEngine(ctx);
+    private_handle_t *fbHandle = batch.fbHandle;
+
+    copybit_image_t dst;
+    dst.w = ALIGN(fbHandle->width,32);
+    dst.h = fbHandle->height;
+    dst.format = fbHandle->format;
+    dst.base = (void *)fbHandle->base;
+    dst.handle = (native_handle_t *)fbHandle;
+    dst.horiz_padding = 0;
+    dst.vert_padding = 0;
+
+    copybit_device_t *cpuCopybit = hwcModule->swCopybitEngine;
+    if ((cpuCopybit == copybit) || !isCPUCopybitFormat(dst.format))
+        cpuCopybit = NULL;
+
+    copybit->set_parameter(copybit, COPYBIT_FRAMEBUFFER_WIDTH, batch.fbWidth);
+    copybit->set_parameter(copybit, COPYBIT_FRAMEBUFFER_HEIGHT, batch.fbHeight);
+    copybit->set_parameter(copybit, COPYBIT_DITHER,
+                           (dst.format == HAL_PIXEL_FORMAT_RGB_565)? COPYBIT_ENABLE : COPYBIT_DISABLE);
+    int err = 0;
+    int first = 0;
+    while (first < batch.count) {
+        const int count = batch.count - first;
+        nsecs_t start = systemTime();
+        int composed = copybit->compose(copybit, &dst, &batch.layers[first],
+                                        count);
+        nsecs_t time = systemTime() - start;
+        if (composed < 0) {
+            LOGE("%s: copybit compose of %d layers failed", __FUNCTION__,
+                 count);
+            err = composed;
+            composed = count;
+        }
+
+        int64_t area = 0;
+        for (int i = first; i < first + composed; i++)
+            area += getLayerArea(batch.hwLayers[i]);
+        for (int i = first; i < first + composed; i++) {
+            hwc_layer_t *layer = batch.hwLayers[i];
+            addLayerTime(ctx, layer, COMP_PATH_COPYBIT, area ?
+                         time * getLayerArea(layer) / area : 0);
+        }
+        first += composed;
+        if (first == batch.count)
+            break;
+
+        // The engine rejected this layer, blend it on the CPU once the
+        // layers below it are done
+        hwc_layer_t *layer = batch.hwLayers[first];
+        const copybit_layer_t& cbLayer = batch.layers[first];
+        int cpuErr = -1;
+        if (cpuCopybit && isCPUCopybitFormat(cbLayer.src->format)) {
+            addCopybitWaitTime(ctx, finishCopybit(ctx));
+            start = systemTime();
+            cpuErr = stretchLayer(cpuCopybit, layer, &dst, cbLayer.src,
+                                  &cbLayer.dst_rect, &cbLayer.src_rect,
+                                  batch.fbWidth, batch.fbHeight, 0);
+            addLayerTime(ctx, layer, COMP_PATH_COPYBIT, systemTime() - start);
+        }
+        if (cpuErr < 0) {
+            LOGE("%s: copybit stretch of layer %d failed", __FUNCTION__,
+                 first);
+            err = cpuErr;
+        }
+        first++;
     }
 
+    for (int i = 0; i < batch.count; i++) {
+        unlockAfterCopybit(ctx, (private_handle_t *)batch.hwLayers[i]->handle);
+    }
+    batch.count = 0;
     return err;
 }
 
-static int drawLayerUsingOverlay(hwc_context_t *ctx, hwc_layer_t *layer)
+/*
+ * Draws a copybit layer into the render buffer. Layers are queued in the
+ * batch when the engine can compose, solid fills are drawn right away
+ * after the queued ones.
+ */
+static int queueLayerUsingCopybit(hwc_composer_device_t *dev,
+                                  hwc_copybit_batch_t& batch,
+                                  hwc_layer_t *layer, EGLDisplay dpy,
+                                  EGLSurface surface)
+{
+    hwc_context_t* ctx = (hwc_context_t*)(dev);
+    copybit_device_t *copybit = getCopybitEngine(ctx);
+    if (!copybit || !copybit->compose) {
+        if (isSolidColorLayer(layer)) {
+            // Solid fills are not accounted in the copybit path cost
+            return drawLayerUsingCopybit(dev, layer, dpy, surface);
+        }
+        nsecs_t start = systemTime();
+        int err = drawLayerUsingCopybit(dev, layer, dpy, surface);
+        addLayerTime(ctx, layer, COMP_PATH_COPYBIT, systemTime() - start);
+        return err;
+    }
+
+    if (!batch.fbHandle) {
+        batch.fbHandle = getRenderBuffer(dpy, surface, batch.fbWidth,
+                                         batch.fbHeight);
+        if (!batch.fbHandle)
+            return -1;
+    }
+
+    if (isSolidColorLayer(layer)) {
+        flushCopybitBatch(ctx, batch);
+        return fillLayerToBuffer(ctx, layer, batch.fbHandle);
+    }
+
+    private_handle_t *hnd = (private_handle_t *)layer->handle;
+    if (!hnd) {
+        flushCopybitBatch(ctx, batch);
+        nsecs_t start = systemTime();
+        int err = drawLayerToBuffer(ctx, layer, batch.fbHandle,
+                                    batch.fbWidth, batch.fbHeight);
+        addLayerTime(ctx, layer, COMP_PATH_COPYBIT, systemTime() - start);
+        return err;
+    }
+
+    if (batch.count == MAX_COPYBIT_BATCH)
+        flushCopybitBatch(ctx, batch);
+
+    // Lock this buffer for read until the batch is composed
+    if (GENLOCK_FAILURE == genlock_lock_buffer(hnd, GENLOCK_READ_LOCK,
+                                               GENLOCK_MAX_TIMEOUT)) {
+        LOGE("%s: genlock_lock_buffer(READ) failed", __FUNCTION__);
+        return -1;
+    }
+
+    // Remove the srcBufferTransform if any
+    layer->transform = (layer->transform & FINAL_TRANSFORM_MASK);
+
+    const int n = batch.count;
+    copybit_image_t& src = batch.srcs[n];
+    src.w = hnd->width;
+    src.h = hnd->height;
+    src.format = hnd->format;
+    src.base = (void *)hnd->base;
+    src.handle = (native_handle_t *)layer->handle;
+    src.horiz_padding = 0;
+    src.vert_padding = 0;
+    batch.regions[n] = region_iterator(layer->visibleRegionScreen);
+
+    copybit_layer_t& cbLayer = batch.layers[n];
+    const hwc_rect_t& sourceCrop = layer->sourceCrop;
+    const hwc_rect_t& displayFrame = layer->displayFrame;
+    cbLayer.src = &src;
+    cbLayer.src_rect.l = sourceCrop.left;
+    cbLayer.src_rect.t = sourceCrop.top;
+    cbLayer.src_rect.r = sourceCrop.right;
+    cbLayer.src_rect.b = sourceCrop.bottom;
+    cbLayer.dst_rect.l = displayFrame.left;
+    cbLayer.dst_rect.t = displayFrame.top;
+    cbLayer.dst_rect.r = displayFrame.right;
+    cbLayer.dst_rect.b = displayFrame.bottom;
+    cbLayer.region = &batch.regions[n];
+    cbLayer.plane_alpha = (layer->blending == HWC_BLENDING_NONE) ? -1 : layer->alpha;
+    cbLayer.transform = layer->transform;
+    cbLayer.premultiplied = (layer->blending == HWC_BLENDING_PREMULT) ?
+                             COPYBIT_ENABLE : COPYBIT_DISABLE;
+    cbLayer.generation = getLayerGeneration(ctx, layer);
+
+    batch.hwLayers[n] = layer;
+    batch.count++;
+    return 0;
+}
+
+static int drawLayerUsingOverlay(hwc_context_t *ctx, hwc_layer_t *layer,
+                                 int pipeIndex)
 {
     ovutils::Timer t("drawLayerUsingOverlay");
     if (ctx && ctx->mOverlayLibObject) {
@@ -1777,10 +3822,24 @@ static int drawLayerUsingOverlay(hwc_context_t *ctx, hwc_layer_t *layer)
                     ret = false;
                 }
 
-                // Wait for external vsync to be done
-                if (!ov.waitForVsync(ovutils::OV_PIPE1)) {
-                    LOGE("%s: waitForVsync failed for external", __FUNCTION__);
-                    ret = false;
+                // Wait for external vsync to be done. This is left to the
+                // commit thread, so hwc_set does not block on HDMI.
+                if (ret && (ctx->commitFrame.numPipes < MAX_COMMIT_PIPES)) {
+                    ctx->commitFrame.pipes[ctx->commitFrame.numPipes++] =
+                                                        ovutils::OV_PIPE1;
+                }
+                break;
+            case ovutils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+                {
+                    // Each video has its own VG pipe
+                    ovutils::eDest dest = (pipeIndex == 0) ?
+                            ovutils::OV_PIPE0 : ovutils::OV_PIPE1;
+                    ov.setMemoryId(hnd->fd, dest);
+                    if (!ov.queueBuffer(hnd->offset, dest)) {
+                        LOGE("%s: queueBuffer failed for pipe %d",
+                             __FUNCTION__, pipeIndex);
+                        ret = false;
+                    }
                 }
                 break;
             default:
@@ -1799,10 +3858,12 @@ static int drawLayerUsingOverlay(hwc_context_t *ctx, hwc_layer_t *layer)
             // Unlock the buffer handle
             genlock_unlock_buffer(hnd);
         } else {
-            // Store the current buffer handle as the one that is to be unlocked after
-            // the next overlay play call.
-            hnd->flags |= private_handle_t::PRIV_FLAGS_HWC_LOCK;
-            ctx->currentOverlayHandle = hnd;
+            // Keep the buffer locked until the pipes have replaced it
+            uint32_t pipes = getStatePipes(state);
+            if (state == ovutils::OV_2D_VIDEO_2_LAYERS_ON_PANEL)
+                pipes = (pipeIndex == 0) ? ovutils::OV_PIPE0 : ovutils::OV_PIPE1;
+            queueRelease(ctx, hnd, pipes);
+            ctx->releaseQueue.playedPipes |= pipes;
         }
 
         // Since ret is a bool and return value is an int
@@ -1831,15 +3892,14 @@ static int drawLayerUsingBypass(hwc_context_t *ctx, hwc_layer_t *layer, int laye
             return -1;
         }
 
-        ctx->bypassBufferLockState[index] = BYPASS_BUFFER_UNLOCKED;
-
+        bool isLocked = false;
         if (ctx->swapInterval > 0) {
             if (GENLOCK_FAILURE == genlock_lock_buffer(hnd, GENLOCK_READ_LOCK,
                                                         GENLOCK_MAX_TIMEOUT)) {
                 LOGE("%s: genlock_lock_buffer(READ) failed", __FUNCTION__);
                 return -1;
             }
-            ctx->bypassBufferLockState[index] = BYPASS_BUFFER_LOCKED;
+            isLocked = true;
         }
 
         LOGE_IF(BYPASS_DEBUG,"%s: Bypassing layer: %p using pipe: %d",__FUNCTION__, layer, index );
@@ -1858,14 +3918,136 @@ static int drawLayerUsingBypass(hwc_context_t *ctx, hwc_layer_t *layer, int laye
 
         if (!ret) {
             // Unlock the locked buffer
-            if (ctx->swapInterval > 0) {
+            if (isLocked) {
                 if (GENLOCK_FAILURE == genlock_unlock_buffer(hnd)) {
                     LOGE("%s: genlock_unlock_buffer failed", __FUNCTION__);
                 }
             }
-            ctx->bypassBufferLockState[index] = BYPASS_BUFFER_UNLOCKED;
             return -1;
         }
+
+        // Keep the buffer locked until the pipe has replaced it
+        if (isLocked)
+            queueRelease(ctx, hnd, dest);
+        ctx->releaseQueue.playedPipes |= dest;
+    }
+    return 0;
+}
+/*
+ * Clears a rectangle of a static cache buffer, with a copybit fill when the
+ * engine can, as the buffer is uncached.
+ */
+static void clearStaticCacheBuffer(hwc_context_t *ctx, private_handle_t *hnd,
+                                   int l, int t, int r, int b)
+{
+    if ((r <= l) || (b <= t))
+        return;
+
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    const int stride = ALIGN(hnd->width, 32);
+    if (canFillSolidColor(hwcModule)) {
+        copybit_image_t dst;
+        dst.w = stride;
+        dst.h = hnd->height;
+        dst.format = hnd->format;
+        dst.base = (void *)hnd->base;
+        dst.handle = (native_handle_t *)hnd;
+        dst.horiz_padding = 0;
+        dst.vert_padding = 0;
+        copybit_rect_t rect = {l, t, r, b};
+        copybit_device_t *copybit = getCopybitEngine(ctx);
+        if (copybit->fill_color(copybit, &dst, &rect, 0) == 0)
+            return;
+        LOGE("%s: copybit fill_color failed", __FUNCTION__);
+        finishCopybit(ctx);
+    }
+
+    const int bpp = getBytesPerPixel(hnd->format);
+    uint8_t *row = (uint8_t *)hnd->base + (t * stride + l) * bpp;
+    for (int y = t; y < b; y++) {
+        memset(row, 0, (r - l) * bpp);
+        row += stride * bpp;
+    }
+}
+
+/*
+ * Composes the cached layers of the list with copybit into the static cache
+ * buffer not being fetched by the MDP, which then becomes the current one.
+ */
+static int composeStaticCache(hwc_context_t *ctx, hwc_layer_list_t* list)
+{
+    private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
+                                                    ctx->device.common.module);
+    framebuffer_device_t *fbDev = hwcModule->fbDevice;
+    hwc_static_cache_t& cache = ctx->staticCache;
+
+    int next = (cache.current + 1) % NUM_STATIC_CACHE_BUFFERS;
+    private_handle_t *dstHnd = cache.buffer[next];
+    if (!dstHnd) {
+        LOGE("%s: static cache buffer not allocated", __FUNCTION__);
+        return -1;
+    }
+
+    // Clear what the bottom layer does not cover with opaque pixels
+    const hwc_layer_t& bottom = list->hwLayers[0];
+    const int width = fbDev->width;
+    const int height = fbDev->height;
+    if (bottom.blending != HWC_BLENDING_NONE) {
+        clearStaticCacheBuffer(ctx, dstHnd, 0, 0, width, height);
+    } else {
+        const hwc_rect_t& frame = bottom.displayFrame;
+        int top = min(max(frame.top, 0), height);
+        int bottomEdge = min(max(frame.bottom, top), height);
+        int left = min(max(frame.left, 0), width);
+        int right = min(max(frame.right, left), width);
+        clearStaticCacheBuffer(ctx, dstHnd, 0, 0, width, top);
+        clearStaticCacheBuffer(ctx, dstHnd, 0, bottomEdge, width, height);
+        clearStaticCacheBuffer(ctx, dstHnd, 0, top, left, bottomEdge);
+        clearStaticCacheBuffer(ctx, dstHnd, right, top, width, bottomEdge);
+    }
+
+    for (int i = 0; i < cache.numLayers; i++) {
+        if (drawLayerToBuffer(ctx, &(list->hwLayers[i]), dstHnd,
+                              fbDev->width, fbDev->height) < 0) {
+            LOGE("%s: failed to compose layer %d", __FUNCTION__, i);
+            return -1;
+        }
+        cache.handles[i] = (native_handle_t*)list->hwLayers[i].handle;
+    }
+    // The MDP fetches the buffer right away
+    finishCopybit(ctx);
+
+    cache.current = next;
+    cache.valid = true;
+    return 0;
+}
+
+/* Queues the static cache buffer on pipe 0, composing it first if needed */
+static int drawStaticCache(hwc_context_t *ctx, hwc_layer_list_t* list)
+{
+    hwc_static_cache_t& cache = ctx->staticCache;
+
+    if (!cache.valid && composeStaticCache(ctx, list) != 0) {
+        // Compose everything through the regular path on the next frame
+        hwc_procs* proc = (hwc_procs*)ctx->device.reserved_proc[0];
+        if (proc) {
+            ctx->forceComposition = true;
+            proc->invalidate(proc);
+        }
+        return -1;
+    }
+
+    overlay2::Overlay& ov = ctx->mOverlayLibObject->ov();
+    private_handle_t *hnd = cache.buffer[cache.current];
+
+    LOGE_IF(BYPASS_DEBUG, "%s: static cache of %d layers using pipe 0",
+            __FUNCTION__, cache.numLayers);
+
+    ov.setMemoryId(hnd->fd, ovutils::OV_PIPE0);
+    if (!ov.queueBuffer(hnd->offset, ovutils::OV_PIPE0)) {
+        LOGE("%s: queueBuffer failed", __FUNCTION__);
+        return -1;
     }
     return 0;
 }
@@ -1882,41 +4064,70 @@ static int hwc_set(hwc_composer_device_t *dev,
         LOGE("hwc_set invalid context");
         return -1;
     }
+    finishCommit(ctx);
+    ctx->releaseQueue.frame++;
 
     private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
                                                            dev->common.module);
     if (!hwcModule) {
         LOGE("hwc_set invalid module");
-#ifdef COMPOSITION_BYPASS
-        unlockPreviousBypassBuffers(ctx);
-        unsetBypassBufferLockState(ctx);
-#endif
-        unlockPreviousOverlayBuffer(ctx);
+        releaseIdlePipes(ctx);
         return -1;
     }
 
     int ret = 0;
     if (list) {
         bool bDumpLayers = needToDumpLayers(); // Check need for debugging dumps
+        hwc_copybit_batch_t copybitBatch;
+        copybitBatch.fbHandle = NULL;
+        copybitBatch.count = 0;
+        selectCopybitEngine(ctx, list);
+#ifdef COMPOSITION_BYPASS
+        if (ctx->staticCache.active) {
+            if(ctx->idleInvalidator)
+                ctx->idleInvalidator->markForSleep();
+            drawStaticCache(ctx, list);
+        }
+#endif
         for (size_t i=0; i<list->numHwLayers; i++) {
             if (bDumpLayers)
                 dumpLayer(hwcModule->compositionType, list->flags, i, list->hwLayers);
-            if (list->hwLayers[i].flags & HWC_SKIP_LAYER) {
+            if ((list->hwLayers[i].compositionType == HWC_USE_COPYBIT) &&
+                isSolidColorLayer(&list->hwLayers[i])) {
+                if (!(list->flags & HWC_SKIP_COMPOSITION))
+                    queueLayerUsingCopybit(dev, copybitBatch,
+                                           &(list->hwLayers[i]),
+                                           (EGLDisplay)dpy, (EGLSurface)sur);
+            } else if (list->hwLayers[i].flags & HWC_SKIP_LAYER) {
                 continue;
 #ifdef COMPOSITION_BYPASS
+            } else if (ctx->staticCache.active &&
+                       ((int)i < ctx->staticCache.numLayers)) {
+                // Already in the static cache buffer
+                continue;
             } else if (list->hwLayers[i].flags & HWC_COMP_BYPASS) {
                 if(ctx->idleInvalidator)
                     ctx->idleInvalidator->markForSleep();
+                nsecs_t start = systemTime();
                 drawLayerUsingBypass(ctx, &(list->hwLayers[i]), i);
+                addLayerTime(ctx, &(list->hwLayers[i]), COMP_PATH_OVERLAY,
+                             systemTime() - start);
 #endif
             } else if (list->hwLayers[i].compositionType == HWC_USE_OVERLAY) {
-                drawLayerUsingOverlay(ctx, &(list->hwLayers[i]));
+                nsecs_t start = systemTime();
+                drawLayerUsingOverlay(ctx, &(list->hwLayers[i]),
+                                      max(getVideoPipeIndex(ctx, i), 0));
+                addLayerTime(ctx, &(list->hwLayers[i]), COMP_PATH_OVERLAY,
+                             systemTime() - start);
             } else if (list->flags & HWC_SKIP_COMPOSITION) {
                 continue;
             } else if (list->hwLayers[i].compositionType == HWC_USE_COPYBIT) {
-                drawLayerUsingCopybit(dev, &(list->hwLayers[i]), (EGLDisplay)dpy, (EGLSurface)sur);
+                queueLayerUsingCopybit(dev, copybitBatch, &(list->hwLayers[i]),
+                                       (EGLDisplay)dpy, (EGLSurface)sur);
             }
         }
+        flushCopybitBatch(ctx, copybitBatch);
+        addCopybitWaitTime(ctx, finishCopybit(ctx));
     } else {
         //Device in suspended state. Close all the MDP pipes
 #ifdef COMPOSITION_BYPASS
@@ -1928,29 +4139,52 @@ static int hwc_set(hwc_composer_device_t *dev,
 
     bool canSkipComposition = list && list->flags & HWC_SKIP_COMPOSITION;
 
-#ifdef COMPOSITION_BYPASS
-    unlockPreviousBypassBuffers(ctx);
-    storeLockedBypassHandle(list, ctx);
-    // We have stored the handles, unset the current lock states in the context.
-    unsetBypassBufferLockState(ctx);
-    closeExtraPipes(ctx);
+    // Pipes were played without waiting for the framebuffer post, so
+    // wait here to keep the frame rate bound to the display
+    if (canSkipComposition && ctx->isFBSkipped) {
+        overlay2::Overlay& ov = ctx->mOverlayLibObject->ov();
+        if (!ov.waitForVsync(ovutils::OV_PIPE0)) {
+            LOGE("%s: waitForVsync failed", __FUNCTION__);
+        }
+    }
+
 #if BYPASS_DEBUG
     if(canSkipComposition)
         LOGE("%s: skipping eglSwapBuffer call", __FUNCTION__);
-#endif
 #endif
     // Do not call eglSwapBuffers if we the skip composition flag is set on the list.
+    nsecs_t swapTime = -1;
     if (dpy && sur && !canSkipComposition) {
+        nsecs_t start = systemTime();
         EGLBoolean sucess = eglSwapBuffers((EGLDisplay)dpy, (EGLSurface)sur);
+        swapTime = systemTime() - start;
         if (!sucess) {
             ret = HWC_EGL_ERROR;
         }
+#ifdef COMPOSITION_BYPASS
+        // The framebuffer now shows all the layers, close the bypass pipes
+        if (sucess && (ctx->bypassState == BYPASS_OFF_PENDING)) {
+            ovutils::eOverlayState state = ctx->mOverlayLibObject->ov().getState();
+            if ((state == ovutils::OV_BYPASS_1_LAYER) ||
+                (state == ovutils::OV_BYPASS_2_LAYER) ||
+                (state == ovutils::OV_BYPASS_3_LAYER)) {
+                setOverlayState(ctx, ovutils::OV_CLOSED);
+            }
+            ctx->bypassState = BYPASS_OFF;
+        }
+#endif
     } else {
         CALC_FPS();
     }
+    updatePathCosts(ctx, list, swapTime);
 
-    // Unlock the previously locked buffer, since the overlay has completed reading the buffer
-    unlockPreviousOverlayBuffer(ctx);
+    if (ctx->commitFrame.numPipes > 0) {
+        queueCommit(ctx);
+    } else {
+        // The pipes played in this frame have picked up their new buffers
+        retirePipes(ctx, ctx->releaseQueue.playedPipes, ctx->releaseQueue.frame);
+    }
+    ctx->releaseQueue.playedPipes = 0;
 
 #if defined HDMI_DUAL_DISPLAY
     if(ctx->pendingHDMI) {
@@ -1971,6 +4205,9 @@ static int hwc_set(hwc_composer_device_t *dev,
 #endif
 
     hwc_closeOverlayChannels(ctx);
+    // Left to finishCommit while the commit thread uses the overlay
+    if (!ctx->isCommitPending)
+        releaseIdlePipes(ctx);
     return ret;
 }
 
@@ -1986,6 +4223,12 @@ static int hwc_device_close(struct hw_device_t *dev)
     private_hwc_module_t* hwcModule = reinterpret_cast<private_hwc_module_t*>(
             ctx->device.common.module);
     // Close the overlay and copybit modules
+    finishCopybit(ctx);
+    if(hwcModule->swCopybitEngine &&
+       (hwcModule->swCopybitEngine != hwcModule->copybitEngine)) {
+        copybit_close(hwcModule->swCopybitEngine);
+    }
+    hwcModule->swCopybitEngine = NULL;
     if(hwcModule->copybitEngine) {
         copybit_close(hwcModule->copybitEngine);
         hwcModule->copybitEngine = NULL;
@@ -1995,7 +4238,12 @@ static int hwc_device_close(struct hw_device_t *dev)
         hwcModule->fbDevice = NULL;
     }
 
-    unlockPreviousOverlayBuffer(ctx);
+    finishCommit(ctx);
+    if (ctx->commitThread != NULL) {
+        ctx->commitThread->stop();
+        ctx->commitThread->decStrong(ctx);
+        ctx->commitThread = NULL;
+    }
 
     if (ctx) {
          if(!ctx->mOverlayLibObject->close()) {
@@ -2003,9 +4251,9 @@ static int hwc_device_close(struct hw_device_t *dev)
          }
          delete ctx->mOverlayLibObject;
          ctx->mOverlayLibObject = NULL;
+         flushReleaseQueue(ctx);
 #ifdef COMPOSITION_BYPASS
-            unlockPreviousBypassBuffers(ctx);
-            unsetBypassBufferLockState(ctx);
+            freeStaticCache(ctx);
 #endif
         free(ctx);
     }
@@ -2021,20 +4269,38 @@ static int hwc_module_initialize(struct private_hwc_module_t* hwcModule)
     if (hw_get_module(COPYBIT_HARDWARE_MODULE_ID, &module) == 0) {
         copybit_open(module, &(hwcModule->copybitEngine));
     }
+    if (hw_get_module(COPYBIT_SW_HARDWARE_MODULE_ID, &module) == 0) {
+        copybit_open(module, &(hwcModule->swCopybitEngine));
+    }
+    // Overlap the blits with the preparation of the next layers, hwc_set
+    // waits for them before the buffers are unlocked or posted
+    copybit_device_t *copybit = hwcModule->copybitEngine;
+    if (copybit && copybit->finish) {
+        copybit->set_parameter(copybit, COPYBIT_ASYNC_COMPLETION,
+                               COPYBIT_ENABLE);
+    }
     if (hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module) == 0) {
         framebuffer_open(module, &(hwcModule->fbDevice));
     }
 
+    RuntimeConfigSnapshot config;
+    RuntimeConfig::getInstance()->getSnapshot(config);
+
     // get the current composition type
-    hwcModule->compositionType = QCCompositionType::getInstance().getCompositionType();
+    hwcModule->compositionType = config.compositionType;
+
+    // CPU composition blits the layers with the CPU engine rather than the
+    // hardware one
+    if ((hwcModule->compositionType & COMPOSITION_TYPE_CPU) &&
+        hwcModule->swCopybitEngine) {
+        if (hwcModule->copybitEngine)
+            copybit_close(hwcModule->copybitEngine);
+        hwcModule->copybitEngine = hwcModule->swCopybitEngine;
+    }
 
     //Check if composition bypass is enabled
-    char property[PROPERTY_VALUE_MAX];
-    if(property_get("debug.compbypass.enable", property, NULL) > 0) {
-        if(atoi(property) == 1) {
-            hwcModule->isBypassEnabled = true;
-        }
-    }
+    hwcModule->isBypassEnabled = config.bypassEnabled;
+    hwcModule->isBypassRotatorEnabled = config.bypassRotator;
 
     CALC_INIT();
 
@@ -2063,14 +4329,21 @@ static int hwc_device_open(const struct hw_module_t* module, const char* name,
             return -1;
         }
 
-#ifdef COMPOSITION_BYPASS
-        for(int i = 0; i < MAX_BYPASS_LAYERS; i++) {
-            dev->previousBypassHandle[i] = NULL;
+        char property[PROPERTY_VALUE_MAX];
+        dev->releaseQueue.depth = DEFAULT_RELEASE_DEPTH;
+        if (property_get("debug.hwc.release_depth", property, NULL) > 0) {
+            int depth = atoi(property);
+            if (depth > 0)
+                dev->releaseQueue.depth = min(depth, MAX_RELEASE_DEPTH);
         }
-        unsetBypassBufferLockState(dev);
+        dev->cpuCopybitArea = DEFAULT_CPU_COPYBIT_AREA;
+        if (property_get("debug.hwc.cpu_copybit_area", property, NULL) > 0) {
+            dev->cpuCopybitArea = atoi(property);
+        }
+
+#ifdef COMPOSITION_BYPASS
         dev->bypassState = BYPASS_OFF;
 
-        char property[PROPERTY_VALUE_MAX];
         unsigned long idle_timeout = DEFAULT_IDLE_TIME;
         if (property_get("debug.bypass.idletime", property, NULL) > 0) {
             if(atoi(property) != 0)
@@ -2090,14 +4363,22 @@ static int hwc_device_open(const struct hw_module_t* module, const char* name,
         dev->mHDMIEnabled = EXT_TYPE_NONE;
         dev->pendingHDMI = false;
 #endif
-        dev->previousOverlayHandle = NULL;
-        dev->currentOverlayHandle = NULL;
         dev->hwcOverlayStatus = HWC_OVERLAY_CLOSED;
-        dev->previousLayerCount = -1;
-        char value[PROPERTY_VALUE_MAX];
-        if (property_get("debug.egl.swapinterval", value, "1") > 0) {
-            dev->swapInterval = atoi(value);
+        dev->commitThread = new CommitThread("HWCCommit", commitFrameHandler,
+                                             dev);
+        dev->commitThread->incStrong(dev);
+        if (!dev->commitThread->start()) {
+            LOGE("%s: failed to start the commit thread", __FUNCTION__);
+            dev->commitThread->decStrong(dev);
+            dev->commitThread = NULL;
         }
+        dev->previousLayerCount = -1;
+        dev->numFBLayers = -1;
+        invalidatePipeConfigs(dev);
+        resetPathPolicy(dev);
+        RuntimeConfigSnapshot config;
+        RuntimeConfig::getInstance()->getSnapshot(config);
+        dev->swapInterval = config.swapInterval;
 
 
         /* initialize the procs */
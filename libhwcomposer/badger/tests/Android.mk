@@ -0,0 +1 @@
+include $(call all-subdir-makefiles)
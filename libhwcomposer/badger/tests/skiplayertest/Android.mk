@@ -0,0 +1,11 @@
+LOCAL_PATH := $(my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := skipLayerTest
+LOCAL_C_INCLUDES += $(TARGET_OUT_HEADERS)/qcom/display
+LOCAL_C_INCLUDES += hardware/qcom/display/libgralloc
+LOCAL_SRC_FILES := skipLayerTest.cpp
+LOCAL_MODULE_TAGS := optional eng
+LOCAL_SHARED_LIBRARIES := libhardware libcutils
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA)/skipLayerTest
+include $(BUILD_EXECUTABLE)
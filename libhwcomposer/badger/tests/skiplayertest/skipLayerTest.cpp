@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name of Code Aurora Forum, Inc. nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks that hwc_prepare leaves SKIP layers without a buffer to
+ * SurfaceFlinger, instead of filling them as dim layers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/Log.h>
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer.h>
+#include "qcom_ui.h"
+
+#undef LOG_TAG
+#define LOG_TAG "SkipLayerTest"
+
+#define NUM_LAYERS 2
+
+static void setLayer(hwc_layer_t& layer, uint32_t flags,
+                     const hwc_rect_t& frame)
+{
+    memset(&layer, 0, sizeof(layer));
+    layer.compositionType = HWC_FRAMEBUFFER;
+    layer.flags = flags;
+    layer.handle = NULL;
+    layer.blending = HWC_BLENDING_PREMULT;
+    layer.sourceCrop = frame;
+    layer.displayFrame = frame;
+    layer.visibleRegionScreen.numRects = 1;
+    layer.visibleRegionScreen.rects = &layer.displayFrame;
+}
+
+int main(int, char**)
+{
+    LOGE("SkipLayerTest start");
+
+    hw_module_t const* module;
+    if (hw_get_module(HWC_HARDWARE_MODULE_ID, &module) != 0) {
+        printf("SkipLayerTest: cannot load the hwc module\n");
+        return 1;
+    }
+    hwc_composer_device_t *hwc;
+    if (hwc_open(module, &hwc) != 0) {
+        printf("SkipLayerTest: cannot open the hwc device\n");
+        return 1;
+    }
+
+    hwc_layer_list_t *list = (hwc_layer_list_t *)malloc(
+            sizeof(hwc_layer_list_t) + NUM_LAYERS * sizeof(hwc_layer_t));
+    list->flags = HWC_GEOMETRY_CHANGED;
+    list->numHwLayers = NUM_LAYERS;
+    const hwc_rect_t frame = { 0, 0, 64, 64 };
+    // A SKIP layer with no buffer yet, and one SurfaceFlinger also
+    // flagged as a dim layer
+    setLayer(list->hwLayers[0], HWC_SKIP_LAYER, frame);
+    setLayer(list->hwLayers[1], HWC_SKIP_LAYER | HWC_COLOR_FILL, frame);
+
+    int failures = 0;
+    if (hwc->prepare(hwc, list) != 0) {
+        printf("SkipLayerTest: prepare failed\n");
+        failures++;
+    }
+    for (size_t i = 0; i < list->numHwLayers; i++) {
+        if (list->hwLayers[i].compositionType != HWC_FRAMEBUFFER) {
+            printf("SkipLayerTest: layer %d composition %d, "
+                   "expected HWC_FRAMEBUFFER\n", (int)i,
+                   list->hwLayers[i].compositionType);
+            failures++;
+        }
+    }
+
+    free(list);
+    hwc->common.close(&hwc->common);
+
+    printf("SkipLayerTest: %s\n", failures ? "FAILED" : "ok");
+    LOGE("SkipLayerTest end");
+    return failures ? 1 : 0;
+}
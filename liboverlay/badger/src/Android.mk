@@ -5,6 +5,7 @@ LOCAL_SHARED_LIBRARIES := liblog
 LOCAL_SHARED_LIBRARIES += libcutils
 LOCAL_SHARED_LIBRARIES += libutils
 LOCAL_SHARED_LIBRARIES += libmemalloc
+LOCAL_SHARED_LIBRARIES += libQcomUI
 LOCAL_C_INCLUDES := $(TARGET_OUT_HEADERS)/qcom/display
 LOCAL_C_INCLUDES += $(TARGET_OUT_INTERMEDIATES)/KERNEL_OBJ/usr/include
 LOCAL_ADDITIONAL_DEPENDENCIES := $(TARGET_OUT_INTERMEDIATES)/KERNEL_OBJ/usr
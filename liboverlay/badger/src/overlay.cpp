@@ -75,6 +75,7 @@ bool Overlay::close()
       break;
    case utils::OV_2D_VIDEO_ON_PANEL:
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_TV:
@@ -104,6 +105,7 @@ bool Overlay::commit(utils::eDest dest)
    switch (st) {
    case utils::OV_2D_VIDEO_ON_PANEL:
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_TV:
@@ -136,6 +138,7 @@ bool Overlay::queueBuffer(uint32_t offset,
    switch (st) {
    case utils::OV_2D_VIDEO_ON_PANEL:
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_TV:
@@ -168,6 +171,7 @@ bool Overlay::dequeueBuffer(void*& buf,
    switch (st) {
    case utils::OV_2D_VIDEO_ON_PANEL:
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_TV:
@@ -199,6 +203,7 @@ bool Overlay::waitForVsync(utils::eDest dest)
    switch (st) {
    case utils::OV_2D_VIDEO_ON_PANEL:
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_TV:
@@ -231,6 +236,7 @@ bool Overlay::setCrop(const utils::Dim& d,
    switch (st) {
    case utils::OV_2D_VIDEO_ON_PANEL:
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_TV:
@@ -262,6 +268,7 @@ bool Overlay::setPosition(const utils::Dim& d,
    switch (st) {
    case utils::OV_2D_VIDEO_ON_PANEL:
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_TV:
@@ -293,6 +300,7 @@ bool Overlay::setParameter(const utils::Params& param,
    switch (st) {
    case utils::OV_2D_VIDEO_ON_PANEL:
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_TV:
@@ -345,6 +353,11 @@ bool Overlay::setSource(const utils::PipeArgs args[utils::MAX_PIPES],
       case utils::OV_3D_VIDEO_ON_3D_TV:
          margs[utils::CHANNEL_1].zorder = utils::ZORDER_1;
          break;
+      case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+         // Second video is stacked above the first one
+         margs[utils::CHANNEL_0].zorder = utils::ZORDER_0;
+         margs[utils::CHANNEL_1].zorder = utils::ZORDER_1;
+         break;
       case utils::OV_2D_VIDEO_ON_PANEL_TV:
       case utils::OV_3D_VIDEO_ON_2D_PANEL_2D_TV:
          // If displaying on both, external VG pipe set to be no wait
@@ -381,6 +394,7 @@ void Overlay::setMemoryId(int id, utils::eDest dest)
    switch (st) {
    case utils::OV_2D_VIDEO_ON_PANEL:
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_TV:
@@ -407,6 +421,7 @@ bool Overlay::reconfigure(const utils::ReconfArgs& args)
    switch (st) {
    case utils::OV_2D_VIDEO_ON_PANEL:
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_PANEL:
    case utils::OV_3D_VIDEO_ON_3D_TV:
@@ -68,6 +68,16 @@ namespace utils {
 
    bool MdpRot::open()
    {
+      // The device is opened by the first start() that rotates, so that
+      // pipes which never rotate cost as much as with a NullRotator
+      return true;
+   }
+
+   bool MdpRot::openDevice()
+   {
+      if(mFd.valid()) {
+         return true;
+      }
       if(!mFd.open(Res::rotPath, O_RDWR)){
          LOGE("MdpRot failed to open %s", Res::rotPath);
          return false;
@@ -182,6 +192,13 @@ namespace utils {
    }
 
    bool MdpRot::start() {
+      // Nothing to start before the first rotation
+      if(!mFd.valid() && !enabled()) {
+         return true;
+      }
+      if(!openDevice()) {
+         return false;
+      }
       if(!overlay2::mdp_wrapper::startRotator(mFd.getFD(), mRotImgInfo)) {
          LOGE("MdpRot start failed");
          this->dump();
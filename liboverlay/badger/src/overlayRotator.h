@@ -50,7 +50,7 @@ public:
    /* ctor */
    explicit MdpRot();
 
-   /* open fd for rotator. map bufs is defered */
+   /* open fd for rotator on the first start. map bufs is defered */
    bool open();
 
    /* remap rot buffers */
@@ -121,6 +121,9 @@ public:
    void dump() const;
 
 private:
+   /* open the rotator device, if not already */
+   bool openDevice();
+
    /* open pmem with specific src */
    bool open_i(uint32_t numbufs, uint32_t bufsz, utils::ePmemSource p);
 
@@ -78,6 +78,8 @@ public:
                                       OverlayImplBase* ov);
    OverlayImplBase* handle_2D_2DTV(utils::eOverlayState s,
                                    OverlayImplBase* ov);
+   OverlayImplBase* handle_2D_2Layers_2DPanel(utils::eOverlayState s,
+                                              OverlayImplBase* ov);
    OverlayImplBase* handle_3D_2DPanel(utils::eOverlayState s,
                                       OverlayImplBase* ov);
    OverlayImplBase* handle_3D_3DPanel(utils::eOverlayState s,
@@ -99,6 +101,9 @@ public:
    /* Transition from any state to 2D video on 2D panel and 2D TV */
    OverlayImplBase* handle_xxx_to_2D_2DTV(OverlayImplBase* ov);
 
+   /* Transition from any state to two 2D videos on 2D panel */
+   OverlayImplBase* handle_xxx_to_2D_2Layers_2DPanel(OverlayImplBase* ov);
+
    /* Transition from any state to 3D video on 2D panel */
    OverlayImplBase* handle_xxx_to_3D_2DPanel(OverlayImplBase* ov);
 
@@ -112,6 +112,9 @@ inline OverlayImplBase* OverlayState::handleEvent(utils::eOverlayState newState,
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
       newov = handle_2D_2DTV(newState, ov);
       break;
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+      newov = handle_2D_2Layers_2DPanel(newState, ov);
+      break;
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
       newov = handle_3D_2DPanel(newState, ov);
       break;
@@ -160,6 +163,9 @@ inline OverlayImplBase* OverlayState::handle_closed(utils::eOverlayState s)
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
       ov = handle_closed_to_xxx<utils::OV_2D_VIDEO_ON_PANEL_TV>();
       break;
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+      ov = handle_closed_to_xxx<utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL>();
+      break;
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
       ov = handle_closed_to_xxx<utils::OV_3D_VIDEO_ON_2D_PANEL>();
       break;
@@ -211,6 +217,9 @@ inline OverlayImplBase* OverlayState::handle_2D_2DPanel(
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
       newov = handle_xxx_to_2D_2DTV(ov);
       break;
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+      newov = handle_xxx_to_2D_2Layers_2DPanel(ov);
+      break;
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
       newov = handle_xxx_to_xxx<utils::OV_3D_VIDEO_ON_2D_PANEL>(ov);
       break;
@@ -262,6 +271,63 @@ inline OverlayImplBase* OverlayState::handle_2D_2DTV(
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
       // no state change
       break;
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+      newov = handle_xxx_to_2D_2Layers_2DPanel(ov);
+      break;
+   case utils::OV_3D_VIDEO_ON_2D_PANEL:
+      newov = handle_xxx_to_xxx<utils::OV_3D_VIDEO_ON_2D_PANEL>(ov);
+      break;
+   case utils::OV_3D_VIDEO_ON_3D_PANEL:
+      newov = handle_xxx_to_xxx<utils::OV_3D_VIDEO_ON_3D_PANEL>(ov);
+      break;
+   case utils::OV_3D_VIDEO_ON_3D_TV:
+      newov = handle_xxx_to_xxx<utils::OV_3D_VIDEO_ON_3D_TV>(ov);
+      break;
+   case utils::OV_3D_VIDEO_ON_2D_PANEL_2D_TV:
+      newov = handle_xxx_to_xxx<utils::OV_3D_VIDEO_ON_2D_PANEL_2D_TV>(ov);
+      break;
+   case utils::OV_UI_MIRROR:
+      newov = handle_xxx_to_xxx<utils::OV_UI_MIRROR>(ov);
+      break;
+   case utils::OV_2D_TRUE_UI_MIRROR:
+      newov = handle_xxx_to_2D_trueUI_Mirror(ov);
+      break;
+   case utils::OV_BYPASS_1_LAYER:
+      newov = handle_xxx_to_xxx<utils::OV_BYPASS_1_LAYER>(ov);
+      break;
+   case utils::OV_BYPASS_2_LAYER:
+      newov = handle_xxx_to_xxx<utils::OV_BYPASS_2_LAYER>(ov);
+      break;
+   case utils::OV_BYPASS_3_LAYER:
+      newov = handle_xxx_to_xxx<utils::OV_BYPASS_3_LAYER>(ov);
+      break;
+   default:
+      LOGE("%s: unknown state=%d", __FUNCTION__, s);
+   }
+   mState = s;
+   return newov;
+}
+
+// Transitions from two 2D videos on 2D panel to XXX
+inline OverlayImplBase* OverlayState::handle_2D_2Layers_2DPanel(
+   utils::eOverlayState s,
+   OverlayImplBase* ov)
+{
+   OverlayImplBase* newov = ov;
+   switch(s)
+   {
+   case utils::OV_CLOSED:
+      newov = handle_xxx_to_closed(ov);
+      break;
+   case utils::OV_2D_VIDEO_ON_PANEL:
+      newov = handle_xxx_to_2D_2DPanel(ov);
+      break;
+   case utils::OV_2D_VIDEO_ON_PANEL_TV:
+      newov = handle_xxx_to_2D_2DTV(ov);
+      break;
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+      // no state change
+      break;
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
       newov = handle_xxx_to_xxx<utils::OV_3D_VIDEO_ON_2D_PANEL>(ov);
       break;
@@ -313,6 +379,9 @@ inline OverlayImplBase* OverlayState::handle_3D_2DPanel(
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
       newov = handle_xxx_to_xxx<utils::OV_2D_VIDEO_ON_PANEL_TV>(ov);
       break;
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+      newov = handle_xxx_to_xxx<utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL>(ov);
+      break;
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
       // no state change
       break;
@@ -364,6 +433,9 @@ inline OverlayImplBase* OverlayState::handle_3D_3DPanel(
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
       newov = handle_xxx_to_xxx<utils::OV_2D_VIDEO_ON_PANEL_TV>(ov);
       break;
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+      newov = handle_xxx_to_xxx<utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL>(ov);
+      break;
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
       newov = handle_xxx_to_xxx<utils::OV_3D_VIDEO_ON_2D_PANEL>(ov);
       break;
@@ -415,6 +487,9 @@ inline OverlayImplBase* OverlayState::handle_3D_3DTV(
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
       newov = handle_xxx_to_xxx<utils::OV_2D_VIDEO_ON_PANEL_TV>(ov);
       break;
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+      newov = handle_xxx_to_xxx<utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL>(ov);
+      break;
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
       newov = handle_xxx_to_xxx<utils::OV_3D_VIDEO_ON_2D_PANEL>(ov);
       break;
@@ -466,6 +541,9 @@ inline OverlayImplBase* OverlayState::handle_3D_2DTV(
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
       newov = handle_xxx_to_xxx<utils::OV_2D_VIDEO_ON_PANEL_TV>(ov);
       break;
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+      newov = handle_xxx_to_xxx<utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL>(ov);
+      break;
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
       newov = handle_xxx_to_3D_2DPanel(ov);
       break;
@@ -516,6 +594,9 @@ inline OverlayImplBase* OverlayState::handle_UI_Mirror(utils::eOverlayState s,
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
       newov = handle_xxx_to_xxx<utils::OV_2D_VIDEO_ON_PANEL_TV>(ov);
       break;
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+      newov = handle_xxx_to_xxx<utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL>(ov);
+      break;
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
       newov = handle_xxx_to_xxx<utils::OV_3D_VIDEO_ON_2D_PANEL>(ov);
       break;
@@ -566,6 +647,9 @@ inline OverlayImplBase* OverlayState::handle_2D_trueUI_Mirror(utils::eOverlaySta
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
       newov = handle_xxx_to_2D_2DTV(ov);
       break;
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+      newov = handle_xxx_to_2D_2Layers_2DPanel(ov);
+      break;
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
       newov = handle_xxx_to_xxx<utils::OV_3D_VIDEO_ON_2D_PANEL>(ov);
       break;
@@ -616,6 +700,9 @@ inline OverlayImplBase* OverlayState::handle_bypass(utils::eOverlayState s,
    case utils::OV_2D_VIDEO_ON_PANEL_TV:
       newov = handle_xxx_to_xxx<utils::OV_2D_VIDEO_ON_PANEL_TV>(ov);
       break;
+   case utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+      newov = handle_xxx_to_xxx<utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL>(ov);
+      break;
    case utils::OV_3D_VIDEO_ON_2D_PANEL:
       newov = handle_xxx_to_xxx<utils::OV_3D_VIDEO_ON_2D_PANEL>(ov);
       break;
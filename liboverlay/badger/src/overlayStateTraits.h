@@ -79,6 +79,19 @@ template <> struct StateTraits<utils::OV_2D_VIDEO_ON_PANEL_TV>
    typedef overlay2::OverlayImpl<pipe0, pipe1> ovimpl;
 };
 
+template <> struct StateTraits<utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL>
+{
+   typedef overlay2::GenericPipe<utils::FB0> pipe0;
+   typedef overlay2::GenericPipe<utils::FB0> pipe1;
+   typedef overlay2::NullPipe pipe2;   // place holder
+
+   typedef Rotator rot0;
+   typedef Rotator rot1;
+   typedef NullRotator rot2;
+
+   typedef overlay2::OverlayImpl<pipe0, pipe1> ovimpl;
+};
+
 template <> struct StateTraits<utils::OV_3D_VIDEO_ON_2D_PANEL>
 {
    typedef overlay2::M3DPrimaryPipe<utils::OV_PIPE0> pipe0;
@@ -163,7 +176,7 @@ template <> struct StateTraits<utils::OV_BYPASS_1_LAYER>
    typedef overlay2::NullPipe pipe1;   // place holder
    typedef overlay2::NullPipe pipe2;   // place holder
 
-   typedef NullRotator rot0;
+   typedef Rotator rot0;
    typedef NullRotator rot1;
    typedef NullRotator rot2;
 
@@ -176,8 +189,8 @@ template <> struct StateTraits<utils::OV_BYPASS_2_LAYER>
    typedef overlay2::BypassPipe<utils::OV_MDP_PIPE_VG, utils::IS_FG_OFF, utils::WAIT, utils::ZORDER_1> pipe1;
    typedef overlay2::NullPipe pipe2;   // place holder
 
-   typedef NullRotator rot0;
-   typedef NullRotator rot1;
+   typedef Rotator rot0;
+   typedef Rotator rot1;
    typedef NullRotator rot2;
 
    typedef overlay2::OverlayImpl<pipe0, pipe1> ovimpl;
@@ -189,9 +202,9 @@ template <> struct StateTraits<utils::OV_BYPASS_3_LAYER>
    typedef overlay2::BypassPipe<utils::OV_MDP_PIPE_VG, utils::IS_FG_OFF, utils::NO_WAIT, utils::ZORDER_1> pipe1;
    typedef overlay2::BypassPipe<utils::OV_MDP_PIPE_RGB, utils::IS_FG_OFF, utils::WAIT, utils::ZORDER_2> pipe2;
 
-   typedef NullRotator rot0;
-   typedef NullRotator rot1;
-   typedef NullRotator rot2;
+   typedef Rotator rot0;
+   typedef Rotator rot1;
+   typedef Rotator rot2;
 
    typedef overlay2::OverlayImpl<pipe0, pipe1, pipe2> ovimpl;
 };
@@ -91,6 +91,65 @@ OverlayImplBase* OverlayState::handle_xxx_to_2D_2DPanel(
    return newov;
 }
 
+/*
+ * Transition from any state to two 2D videos on 2D panel
+ */
+OverlayImplBase* OverlayState::handle_xxx_to_2D_2Layers_2DPanel(
+   OverlayImplBase* ov)
+{
+   OVASSERT(ov, "%s: ov is null", __FUNCTION__);
+   LOGE("%s", __FUNCTION__);
+
+   // Create new ovimpl based on new state
+   typedef StateTraits<utils::OV_2D_VIDEO_2_LAYERS_ON_PANEL> NewState;
+   OverlayImplBase* newov = new NewState::ovimpl;
+
+   //===========================================================
+   // For each pipe:
+   //    - If pipe matches, copy from previous into new ovimpl
+   //    - Otherwise open for new and delete from previous ovimpl
+   //===========================================================
+
+   // pipe0/rot0 (GenericPipe)
+   if (ov->getOvPipeType(utils::OV_PIPE0) == utils::OV_PIPE_TYPE_GENERIC) {
+      LOGE_IF(DEBUG_OVERLAY, "%s: Copy pipe0 (GenericPipe)", __FUNCTION__);
+      newov->copyOvPipe(ov, utils::OV_PIPE0);
+   } else {
+      LOGE_IF(DEBUG_OVERLAY, "%s: Open pipe0 (GenericPipe)", __FUNCTION__);
+      RotatorBase* rot0 = new NewState::rot0;
+      ov->closePipe(utils::OV_PIPE0);
+      newov->openPipe(rot0, utils::OV_PIPE0);
+   }
+
+   // pipe1/rot1 (GenericPipe)
+   if (ov->getOvPipeType(utils::OV_PIPE1) == utils::OV_PIPE_TYPE_GENERIC) {
+      LOGE_IF(DEBUG_OVERLAY, "%s: Copy pipe1 (GenericPipe)", __FUNCTION__);
+      newov->copyOvPipe(ov, utils::OV_PIPE1);
+   } else {
+      LOGE_IF(DEBUG_OVERLAY, "%s: Open pipe1 (GenericPipe)", __FUNCTION__);
+      RotatorBase* rot1 = new NewState::rot1;
+      ov->closePipe(utils::OV_PIPE1);
+      newov->openPipe(rot1, utils::OV_PIPE1);
+   }
+
+   // pipe2/rot2 (NullPipe)
+   if (ov->getOvPipeType(utils::OV_PIPE2) == utils::OV_PIPE_TYPE_NULL) {
+      LOGE_IF(DEBUG_OVERLAY, "%s: Copy pipe2 (NullPipe)", __FUNCTION__);
+      newov->copyOvPipe(ov, utils::OV_PIPE2);
+   } else {
+      LOGE_IF(DEBUG_OVERLAY, "%s: Open pipe2 (NullPipe)", __FUNCTION__);
+      RotatorBase* rot2 = new NewState::rot2;
+      ov->closePipe(utils::OV_PIPE2);
+      newov->openPipe(rot2, utils::OV_PIPE2);
+   }
+
+   // All pipes are copied or deleted so no more need for previous ovimpl
+   delete ov;
+   ov = 0;
+
+   return newov;
+}
+
 /*
  * Transition from any state to 2D video on 2D panel and 2D TV
  */
@@ -36,6 +36,7 @@
 #include "overlayFD.h"
 #include "overlayRes.h"
 #include "mdpWrapper.h"
+#include <utils/RuntimeConfig.h>
 
 // just a helper static thingy
 namespace {
@@ -198,42 +199,31 @@ namespace utils {
       return -1;
    }
 
+   /* Runtime config is refreshed by a watcher thread, so that the
+    * following are free of system calls */
    bool isHDMIConnected () {
-      char value[PROPERTY_VALUE_MAX] = {0};
-      property_get("hw.hdmiON", value, "0");
-      int isHDMI = atoi(value);
-      return isHDMI ? true : false;
+      RuntimeConfigSnapshot config;
+      RuntimeConfig::getInstance()->getSnapshot(config);
+      return config.hdmiConnected;
    }
 
    bool is3DTV() {
-      char is3DTV = '0';
-      IOFile fp(Res::edid3dInfoFile, "r");
-      (void)fp.read(is3DTV, 1);
-      LOGI("3DTV EDID flag: %d", is3DTV);
-      return (is3DTV == '0') ? false : true;
+      RuntimeConfigSnapshot config;
+      RuntimeConfig::getInstance()->getSnapshot(config);
+      LOGE_IF(DEBUG_OVERLAY, "3DTV EDID flag: %d", config.tv3D);
+      return config.tv3D;
    }
 
    bool isPanel3D() {
-      OvFD fd;
-      if(!overlay2::open(fd, 0 /*fb*/, Res::devTemplate)){
-         LOGE("isPanel3D Can't open framebuffer 0");
-         return false;
-      }
-      fb_fix_screeninfo finfo;
-      if(!mdp_wrapper::getFScreenInfo(fd.getFD(), finfo)) {
-         LOGE("isPanel3D read fb0 failed");
-      }
-      fd.close();
-      return (FB_TYPE_3D_PANEL == finfo.type) ? true : false;
+      RuntimeConfigSnapshot config;
+      RuntimeConfig::getInstance()->getSnapshot(config);
+      return config.panel3D;
    }
 
    bool usePanel3D() {
-      if(!isPanel3D())
-         return false;
-      char value[PROPERTY_VALUE_MAX];
-      property_get("persist.user.panel3D", value, "0");
-      int usePanel3D = atoi(value);
-      return usePanel3D ? true : false;
+      RuntimeConfigSnapshot config;
+      RuntimeConfig::getInstance()->getSnapshot(config);
+      return config.usePanel3D;
    }
 
    bool send3DInfoPacket (uint32_t format3D) {
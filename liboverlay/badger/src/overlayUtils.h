@@ -361,6 +361,9 @@ namespace utils {
    // Max pipes via overlay (VG0, VG1, RGB1)
    enum { MAX_PIPES = 3 };
 
+   // number of VG pipes, the only MDP pipes able to fetch YUV
+   enum { MAX_VG_PIPES = 2 };
+
    /* Used to identify destination channels and
     * also 3D channels e.g. when in 3D mode with 2
     * pipes opened and it is used in get crop/pos 3D
@@ -513,6 +516,9 @@ namespace utils {
       OV_2D_VIDEO_ON_PANEL,
       OV_2D_VIDEO_ON_PANEL_TV,
 
+      /* Two 2D videos on the primary panel, one per VG pipe */
+      OV_2D_VIDEO_2_LAYERS_ON_PANEL,
+
       /* 3D Video on one display (panel or TV) */
       OV_3D_VIDEO_ON_2D_PANEL,
       OV_3D_VIDEO_ON_3D_PANEL,
@@ -126,6 +126,8 @@ namespace utils {
             return "OV_2D_VIDEO_ON_PANEL";
          case OV_2D_VIDEO_ON_PANEL_TV:
             return "OV_2D_VIDEO_ON_PANEL_TV";
+         case OV_2D_VIDEO_2_LAYERS_ON_PANEL:
+            return "OV_2D_VIDEO_2_LAYERS_ON_PANEL";
          case OV_3D_VIDEO_ON_2D_PANEL:
             return "OV_3D_VIDEO_ON_2D_PANEL";
          case OV_3D_VIDEO_ON_3D_PANEL:
@@ -111,11 +111,13 @@ namespace overlay2 {
          setMdpFlags(arg.mdpFlags, utils::OV_MDP_PIPE_SHARE);
       }
 
-      // Set is_fg flag
-      arg.isFg = IsFg;
+      // Set is_fg flag. The caller clears it when the framebuffer is
+      // still composed underneath the bypass pipes.
+      arg.isFg = (args.isFg == utils::IS_FG_SET) ? IsFg : utils::IS_FG_OFF;
 
-      // Wait or no wait
-      arg.wait = Wait;
+      // Wait or no wait. The caller clears it when the framebuffer post
+      // already waits for vsync.
+      arg.wait = (args.wait == utils::WAIT) ? Wait : utils::NO_WAIT;
 
       // Z-order
       arg.zorder = Zorder;
@@ -11,6 +11,8 @@ LOCAL_COPY_HEADERS_TO := qcom/display/utils
 LOCAL_COPY_HEADERS := utils/IdleInvalidator.h
 LOCAL_COPY_HEADERS += utils/profiler.h
 LOCAL_COPY_HEADERS += utils/comptype.h
+LOCAL_COPY_HEADERS += utils/RuntimeConfig.h
+LOCAL_COPY_HEADERS += utils/CommitThread.h
 include $(BUILD_COPY_HEADERS)
 
 include $(CLEAR_VARS)
@@ -18,16 +20,20 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := \
         qcom_ui.cpp \
         utils/profiler.cpp \
-        utils/IdleInvalidator.cpp
+        utils/IdleInvalidator.cpp \
+        utils/RuntimeConfig.cpp \
+        utils/CommitThread.cpp
 
 LOCAL_SHARED_LIBRARIES := \
         libutils \
         libcutils \
         libui \
         libEGL \
+        libhardware \
         libskia
 
 LOCAL_C_INCLUDES := $(TOP)/hardware/qcom/display/libgralloc \
+                    $(TOP)/hardware/qcom/display/libcopybit \
                     $(TOP)/frameworks/base/services/surfaceflinger \
                     $(TOP)/external/skia/include/core \
                     $(TOP)/external/skia/include/images
@@ -38,6 +44,8 @@ ifneq ($(call is-vendor-board-platform,QCOM),true)
     LOCAL_CFLAGS += -DNON_QCOM_TARGET
 else
     LOCAL_SHARED_LIBRARIES += libmemalloc
+    LOCAL_C_INCLUDES += $(TARGET_OUT_INTERMEDIATES)/KERNEL_OBJ/usr/include
+    LOCAL_ADDITIONAL_DEPENDENCIES := $(TARGET_OUT_INTERMEDIATES)/KERNEL_OBJ/usr
 endif
 
 ifeq ($(TARGET_USES_MDP3), true)
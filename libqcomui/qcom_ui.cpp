@@ -30,11 +30,13 @@
 #include <cutils/log.h>
 #include <cutils/memory.h>
 #include <qcom_ui.h>
-#include <utils/comptype.h>
+#include <utils/RuntimeConfig.h>
 #include <gralloc_priv.h>
+#include <copybit.h>
 #include <alloc_controller.h>
 #include <memalloc.h>
 #include <errno.h>
+#include <pthread.h>
 #include <EGL/eglext.h>
 #include <sys/stat.h>
 #include <SkBitmap.h>
@@ -102,6 +104,34 @@ namespace {
 #endif
         return ret;
     }
+
+    // Copybit engine used to clear the framebuffer. It is opened once, by
+    // the first clear, and lives as long as the process, like sAlloc: the
+    // hardware composer has its own device, which is not reachable from
+    // here. The device is not thread safe, SurfaceFlinger only clears from
+    // its composition thread.
+    static copybit_device_t *sCopybit = 0;
+    static pthread_once_t sCopybitOnce = PTHREAD_ONCE_INIT;
+
+    void openFillEngine()
+    {
+        hw_module_t const *module;
+        if (hw_get_module(COPYBIT_HARDWARE_MODULE_ID, &module) == 0) {
+            copybit_open(module, &sCopybit);
+        }
+        if (sCopybit && !sCopybit->fill_color) {
+            copybit_close(sCopybit);
+            sCopybit = 0;
+        }
+        LOGD_IF(!sCopybit, "%s: framebuffer cleared by the CPU",
+                __FUNCTION__);
+    }
+
+    copybit_device_t* getFillEngine()
+    {
+        pthread_once(&sCopybitOnce, openFillEngine);
+        return sCopybit;
+    }
 }; // ANONYNMOUS NAMESPACE
 
 /*
@@ -364,7 +394,9 @@ bool isUpdatingFB(HWCCompositionType compositionType)
 int qcomuiClearRegion(Region region, EGLDisplay dpy, EGLSurface sur)
 {
     int ret = 0;
-    int compositionType = QCCompositionType::getInstance().getCompositionType();
+    RuntimeConfigSnapshot config;
+    RuntimeConfig::getInstance()->getSnapshot(config);
+    int compositionType = config.compositionType;
 
     if (( compositionType == COMPOSITION_TYPE_GPU) ||
         (compositionType == (COMPOSITION_TYPE_DYN|COMPOSITION_TYPE_C2D)))
@@ -387,13 +419,39 @@ int qcomuiClearRegion(Region region, EGLDisplay dpy, EGLSurface sur)
         return -1;
     }
 
+    Region::const_iterator it = region.begin();
+    Region::const_iterator const end = region.end();
+
+    // Clear with the hardware rather than writing the whole area with the
+    // CPU, the framebuffer may be uncached
+    copybit_device_t *copybit = getFillEngine();
+    if (copybit) {
+        copybit_image_t dst;
+        dst.w = renderBuffer->stride;
+        dst.h = renderBuffer->height;
+        dst.format = fbHandle->format;
+        dst.base = (void *)fbHandle->base;
+        dst.handle = (native_handle_t *)fbHandle;
+        dst.horiz_padding = 0;
+        dst.vert_padding = 0;
+        while (it != end) {
+            const Rect& r = *it;
+            copybit_rect_t rect = {r.left, r.top, r.right, r.bottom};
+            if (copybit->fill_color(copybit, &dst, &rect, 0) < 0) {
+                LOGE("%s: fill_color failed", __FUNCTION__);
+                break;
+            }
+            it++;
+        }
+        if (it == end)
+            return 0;
+    }
+
     int bytesPerPixel = 4;
     if (HAL_PIXEL_FORMAT_RGB_565 == fbHandle->format) {
         bytesPerPixel = 2;
     }
 
-    Region::const_iterator it = region.begin();
-    Region::const_iterator const end = region.end();
     const int32_t stride = renderBuffer->stride*bytesPerPixel;
     while (it != end) {
         const Rect& r = *it++;
@@ -454,70 +512,56 @@ external_display_type handleEventHDMI(external_display_type disp, int value,
 // property)" does not work.
 int sfdump_countlimit_raw = 0;
 int sfdump_counter_raw = 1;
-char sfdump_propstr_persist_raw[PROPERTY_VALUE_MAX] = "";
+uint32_t sfdump_generation_raw = 0;
 char sfdumpdir_raw[256] = "";
 int sfdump_countlimit_png = 0;
 int sfdump_counter_png = 1;
-char sfdump_propstr_persist_png[PROPERTY_VALUE_MAX] = "";
+uint32_t sfdump_generation_png = 0;
 char sfdumpdir_png[256] = "";
 
-bool needToDumpLayers()
+/* Creates the directory for a new dump session.
+ * Returns true if the directory could be created */
+static bool createDumpDir(char *dumpdir, const char *type)
 {
-    bool bDumpLayer = false;
-    char sfdump_propstr[PROPERTY_VALUE_MAX];
     time_t timenow;
     tm sfdump_time;
 
     time(&timenow);
     localtime_r(&timenow, &sfdump_time);
-
-    if ((property_get("debug.sf.dump.png", sfdump_propstr, NULL) > 0) &&
-            (strncmp(sfdump_propstr, sfdump_propstr_persist_png,
-                                                    PROPERTY_VALUE_MAX - 1))) {
-        // Strings exist & not equal implies it has changed, so trigger a dump
-        strncpy(sfdump_propstr_persist_png, sfdump_propstr,
-                                                    PROPERTY_VALUE_MAX - 1);
-        sfdump_countlimit_png = atoi(sfdump_propstr);
-        sfdump_countlimit_png = (sfdump_countlimit_png < 0) ? 0:
-                        (sfdump_countlimit_png >= LONG_MAX) ? (LONG_MAX - 1):
-                                                        sfdump_countlimit_png;
-        if (sfdump_countlimit_png) {
-            sprintf(sfdumpdir_png,"/data/sfdump.png%04d%02d%02d.%02d%02d%02d",
+    sprintf(dumpdir, "/data/sfdump.%s%04d%02d%02d.%02d%02d%02d", type,
             sfdump_time.tm_year + 1900, sfdump_time.tm_mon + 1,
             sfdump_time.tm_mday, sfdump_time.tm_hour,
             sfdump_time.tm_min, sfdump_time.tm_sec);
-            if (0 == mkdir(sfdumpdir_png, 0777))
-                sfdump_counter_png = 0;
-            else
-                LOGE("sfdump: Error: %s. Failed to create sfdump directory"
-                ": %s", strerror(errno), sfdumpdir_png);
-        }
+    if (0 == mkdir(dumpdir, 0777))
+        return true;
+    LOGE("sfdump: Error: %s. Failed to create sfdump directory"
+         ": %s", strerror(errno), dumpdir);
+    return false;
+}
+
+bool needToDumpLayers()
+{
+    bool bDumpLayer = false;
+    RuntimeConfigSnapshot config;
+    RuntimeConfig::getInstance()->getSnapshot(config);
+
+    // The dump properties are watched by RuntimeConfig, a new generation
+    // means the property has changed, so trigger a dump
+    if (config.dumpGenerationPng != sfdump_generation_png) {
+        sfdump_generation_png = config.dumpGenerationPng;
+        sfdump_countlimit_png = config.dumpCountPng;
+        if (sfdump_countlimit_png && createDumpDir(sfdumpdir_png, "png"))
+            sfdump_counter_png = 0;
     }
 
     if (sfdump_counter_png <= sfdump_countlimit_png)
         sfdump_counter_png++;
 
-    if ((property_get("debug.sf.dump", sfdump_propstr, NULL) > 0) &&
-            (strncmp(sfdump_propstr, sfdump_propstr_persist_raw,
-                                                    PROPERTY_VALUE_MAX - 1))) {
-        // Strings exist & not equal implies it has changed, so trigger a dump
-        strncpy(sfdump_propstr_persist_raw, sfdump_propstr,
-                                                    PROPERTY_VALUE_MAX - 1);
-        sfdump_countlimit_raw = atoi(sfdump_propstr);
-        sfdump_countlimit_raw = (sfdump_countlimit_raw < 0) ? 0:
-                        (sfdump_countlimit_raw >= LONG_MAX) ? (LONG_MAX - 1):
-                                                        sfdump_countlimit_raw;
-        if (sfdump_countlimit_raw) {
-            sprintf(sfdumpdir_raw,"/data/sfdump.raw%04d%02d%02d.%02d%02d%02d",
-            sfdump_time.tm_year + 1900, sfdump_time.tm_mon + 1,
-            sfdump_time.tm_mday, sfdump_time.tm_hour,
-            sfdump_time.tm_min, sfdump_time.tm_sec);
-            if (0 == mkdir(sfdumpdir_raw, 0777))
-                sfdump_counter_raw = 0;
-            else
-                LOGE("sfdump: Error: %s. Failed to create sfdump directory"
-                ": %s", strerror(errno), sfdumpdir_raw);
-        }
+    if (config.dumpGenerationRaw != sfdump_generation_raw) {
+        sfdump_generation_raw = config.dumpGenerationRaw;
+        sfdump_countlimit_raw = config.dumpCountRaw;
+        if (sfdump_countlimit_raw && createDumpDir(sfdumpdir_raw, "raw"))
+            sfdump_counter_raw = 0;
     }
 
     if (sfdump_counter_raw <= sfdump_countlimit_raw)
@@ -134,6 +134,7 @@ enum {
     EVENT_CLOSE_SECURE_END,     // End of secure session teardown config
     EVENT_RESET_POSTBUFFER,     // Reset post framebuffer mutex
     EVENT_WAIT_POSTBUFFER,      // Wait until post framebuffer returns
+    EVENT_DUMP_HWC_STATS,       // Log the composition statistics of the HWC
 };
 
 // Video information sent to framebuffer HAl
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of Code Aurora Forum, Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CommitThread.h"
+
+#define CT_DEBUG 0
+
+CommitThread::CommitThread(const char *name, CommitHandler handler,
+    void *userData): Thread(false), mHandler(handler), mUserData(userData),
+    mName(name), mHead(0), mCount(0), mBusy(false), mFailed(false) {
+    LOGE_IF(CT_DEBUG, "%s: %s", __func__, mName);
+}
+
+bool CommitThread::start() {
+    return (run(mName, android::PRIORITY_URGENT_DISPLAY) == android::NO_ERROR);
+}
+
+void CommitThread::queueFrame(const CommitFrame& frame) {
+    android::Mutex::Autolock lock(mLock);
+    while (mCount == COMMIT_QUEUE_SIZE) {
+        LOGE_IF(CT_DEBUG, "%s: %s queue full", __func__, mName);
+        mIdleCond.wait(mLock);
+    }
+    mQueue[(mHead + mCount) % COMMIT_QUEUE_SIZE] = frame;
+    mCount++;
+    mQueueCond.signal();
+}
+
+bool CommitThread::waitForIdle() {
+    android::Mutex::Autolock lock(mLock);
+    while (mCount || mBusy) {
+        mIdleCond.wait(mLock);
+    }
+    bool success = !mFailed;
+    mFailed = false;
+    return success;
+}
+
+void CommitThread::stop() {
+    waitForIdle();
+    requestExit();
+    {
+        android::Mutex::Autolock lock(mLock);
+        mQueueCond.signal();
+    }
+    requestExitAndWait();
+}
+
+bool CommitThread::threadLoop() {
+    CommitFrame frame;
+    {
+        android::Mutex::Autolock lock(mLock);
+        while (!mCount) {
+            if (exitPending())
+                return false;
+            mQueueCond.wait(mLock);
+        }
+        frame = mQueue[mHead];
+        mHead = (mHead + 1) % COMMIT_QUEUE_SIZE;
+        mCount--;
+        mBusy = true;
+    }
+
+    //The handler is not a part of this class as the pipes are owned by
+    //the display HAL
+    bool success = mHandler(mUserData, frame);
+    LOGE_IF(CT_DEBUG && !success, "%s: %s frame failed", __func__, mName);
+
+    android::Mutex::Autolock lock(mLock);
+    mBusy = false;
+    if (!success)
+        mFailed = true;
+    mIdleCond.broadcast();
+    return true;
+}
+
+int CommitThread::readyToRun() {
+    LOGE_IF(CT_DEBUG, "%s: %s", __func__, mName);
+    return 0; /*NO_ERROR*/
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of Code Aurora Forum, Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDE_LIBQCOM_COMMITTHREAD
+#define INCLUDE_LIBQCOM_COMMITTHREAD
+
+#include <stdint.h>
+#include <cutils/log.h>
+#include <utils/threads.h>
+
+#define MAX_COMMIT_PIPES 3
+#define COMMIT_QUEUE_SIZE 2
+
+/* A frame played on the MDP pipes of a display, that still has to be
+ * picked up by the display before its buffers can be released.
+ */
+struct CommitFrame {
+    int numPipes;
+    int pipes[MAX_COMMIT_PIPES]; // Pipes to wait for, in order
+};
+
+//Does the blocking ioctls of a frame, returns false on failure
+typedef bool (*CommitHandler)(void*, const CommitFrame&);
+
+/* Per display commit worker.
+ * The composition thread queues the frames it played, and the worker waits
+ * for the display to pick them up, so the composition thread does not stall
+ * for a display refresh. The composition thread must call waitForIdle before
+ * it touches the pipes again, and release the buffers of the frames only
+ * once waitForIdle returned.
+ */
+class CommitThread : public android::Thread {
+    CommitHandler mHandler;
+    void *mUserData;
+    const char *mName;
+    android::Mutex mLock;
+    android::Condition mQueueCond; //Signaled when a frame is queued
+    android::Condition mIdleCond;  //Signaled when a frame is done
+    CommitFrame mQueue[COMMIT_QUEUE_SIZE];
+    int mHead;
+    int mCount;
+    bool mBusy;       //A frame is being waited for, out of the queue
+    bool mFailed;     //A frame failed since the last waitForIdle
+public:
+    CommitThread(const char *name, CommitHandler handler, void *userData);
+    virtual ~CommitThread(){}
+    //Starts the worker
+    bool start();
+    //Queues a frame, blocks while the queue is full
+    void queueFrame(const CommitFrame& frame);
+    //Blocks until all the queued frames are done, returns false if any
+    //of them failed
+    bool waitForIdle();
+    //Finishes the queued frames and stops the worker
+    void stop();
+    //Overrides
+    virtual bool        threadLoop();
+    virtual int         readyToRun();
+};
+
+#endif // INCLUDE_LIBQCOM_COMMITTHREAD
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of Code Aurora Forum, Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "RuntimeConfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fb.h>
+#include <cutils/log.h>
+#include <cutils/atomic.h>
+#include <cutils/atomic-inline.h>
+#include <qcom_ui.h>
+#include <utils/comptype.h>
+
+#define RC_DEBUG 0
+
+// How often the watcher re-reads the configuration
+#define REFRESH_PERIOD_MS 500
+
+static const char *threadName = "RuntimeConfig";
+static const char *fbPath = "/dev/graphics/fb0";
+static const char *edid3dInfoFile = "/sys/class/graphics/fb1/3d_present";
+
+android::Mutex RuntimeConfig::sLock;
+android::sp<RuntimeConfig> RuntimeConfig::sInstance(0);
+RuntimeConfig* volatile RuntimeConfig::sInstancePtr = NULL;
+
+static int getIntProperty(const char *name, const char *def) {
+    char value[PROPERTY_VALUE_MAX];
+    property_get(name, value, def);
+    return atoi(value);
+}
+
+static bool readPanel3D() {
+#ifdef FB_TYPE_3D_PANEL
+    int fd = open(fbPath, O_RDONLY);
+    if (fd < 0) {
+        LOGE("%s: Can't open %s", __FUNCTION__, fbPath);
+        return false;
+    }
+    fb_fix_screeninfo finfo;
+    bool ret = false;
+    if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo) < 0) {
+        LOGE("%s: FBIOGET_FSCREENINFO failed", __FUNCTION__);
+    } else {
+        ret = (FB_TYPE_3D_PANEL == finfo.type);
+    }
+    close(fd);
+    return ret;
+#else
+    return false;
+#endif
+}
+
+static bool readTV3D() {
+    char is3DTV = '0';
+    FILE *fp = fopen(edid3dInfoFile, "r");
+    if (fp) {
+        if (fread(&is3DTV, 1, 1, fp) != 1)
+            is3DTV = '0';
+        fclose(fp);
+    }
+    LOGE_IF(RC_DEBUG, "3DTV EDID flag: %c", is3DTV);
+    return (is3DTV != '0');
+}
+
+static bool isSameConfig(const RuntimeConfigSnapshot& a,
+                         const RuntimeConfigSnapshot& b) {
+    return (a.compositionType == b.compositionType) &&
+           (a.bypassEnabled == b.bypassEnabled) &&
+           (a.bypassRotator == b.bypassRotator) &&
+           (a.swapInterval == b.swapInterval) &&
+           (a.mdpBandwidthBudget == b.mdpBandwidthBudget) &&
+           (a.hdmiConnected == b.hdmiConnected) &&
+           (a.panel3D == b.panel3D) &&
+           (a.usePanel3D == b.usePanel3D) &&
+           (a.tv3D == b.tv3D) &&
+           (a.dumpCountPng == b.dumpCountPng) &&
+           (a.dumpGenerationPng == b.dumpGenerationPng) &&
+           (a.dumpCountRaw == b.dumpCountRaw) &&
+           (a.dumpGenerationRaw == b.dumpGenerationRaw);
+}
+
+/* Reads a layer dump property, bumping the generation when it changed.
+ * The last seen value is kept in persist. */
+static void readDumpProperty(const char *name, char *persist, int& count,
+                             uint32_t& generation) {
+    char value[PROPERTY_VALUE_MAX];
+    if ((property_get(name, value, NULL) > 0) &&
+            strncmp(value, persist, PROPERTY_VALUE_MAX - 1)) {
+        // Strings exist & not equal implies it has changed
+        strncpy(persist, value, PROPERTY_VALUE_MAX - 1);
+        long limit = atol(value);
+        count = (limit < 0) ? 0 :
+                (limit >= LONG_MAX) ? (LONG_MAX - 1) : limit;
+        generation++;
+    }
+}
+
+RuntimeConfig::RuntimeConfig(): Thread(false), mSequence(0),
+    mProbedPanel(false) {
+    LOGE_IF(RC_DEBUG, "%s", __func__);
+    memset(&mSnapshot, 0, sizeof(mSnapshot));
+    memset(mDumpPropPng, 0, sizeof(mDumpPropPng));
+    memset(mDumpPropRaw, 0, sizeof(mDumpPropRaw));
+    mSnapshot.compositionType =
+                QCCompositionType::getInstance().getCompositionType();
+    mSnapshot.swapInterval = 1;
+}
+
+void RuntimeConfig::probe(RuntimeConfigSnapshot& snapshot, bool hotplug) {
+    snapshot.bypassEnabled = (getIntProperty("debug.compbypass.enable",
+                                             "0") == 1);
+    snapshot.bypassRotator = (getIntProperty("debug.compbypass.rotator",
+                                             "0") == 1);
+    snapshot.swapInterval = getIntProperty("debug.egl.swapinterval", "1");
+
+    // The target sets the budget the MDP sustains in ro.hwc.mdp_bw_budget
+    char budget[PROPERTY_VALUE_MAX];
+    property_get("ro.hwc.mdp_bw_budget", budget, "0");
+    snapshot.mdpBandwidthBudget = getIntProperty("debug.hwc.mdp_bw_budget",
+                                                 budget);
+    if (snapshot.mdpBandwidthBudget < 0)
+        snapshot.mdpBandwidthBudget = 0;
+
+    // The panel type cannot change at runtime
+    if (!mProbedPanel) {
+        snapshot.panel3D = readPanel3D();
+        mProbedPanel = true;
+    }
+    snapshot.usePanel3D = snapshot.panel3D &&
+                          getIntProperty("persist.user.panel3D", "0");
+
+    // The EDID only changes on a HDMI hotplug, which may be reported
+    // before hw.hdmiON is set
+    bool hdmiConnected = getIntProperty("hw.hdmiON", "0");
+    if (hotplug || hdmiConnected != snapshot.hdmiConnected ||
+        !snapshot.version) {
+        snapshot.tv3D = readTV3D();
+    }
+    snapshot.hdmiConnected = hdmiConnected;
+
+    readDumpProperty("debug.sf.dump.png", mDumpPropPng,
+                     snapshot.dumpCountPng, snapshot.dumpGenerationPng);
+    readDumpProperty("debug.sf.dump", mDumpPropRaw,
+                     snapshot.dumpCountRaw, snapshot.dumpGenerationRaw);
+}
+
+void RuntimeConfig::publish(const RuntimeConfigSnapshot& snapshot) {
+    android_atomic_inc(&mSequence);
+    ANDROID_MEMBAR_FULL();
+    mSnapshot = snapshot;
+    ANDROID_MEMBAR_FULL();
+    android_atomic_inc(&mSequence);
+}
+
+void RuntimeConfig::refresh(bool hotplug) {
+    android::Mutex::Autolock lock(mRefreshLock);
+    RuntimeConfigSnapshot snapshot = mSnapshot;
+    probe(snapshot, hotplug);
+    if (!snapshot.version || !isSameConfig(snapshot, mSnapshot)) {
+        snapshot.version++;
+        LOGE_IF(RC_DEBUG, "%s: new config version %d", __func__,
+                snapshot.version);
+        publish(snapshot);
+    }
+}
+
+void RuntimeConfig::getSnapshot(RuntimeConfigSnapshot& snapshot) const {
+    int32_t seq;
+    do {
+        seq = android_atomic_acquire_load(&mSequence);
+        snapshot = mSnapshot;
+        ANDROID_MEMBAR_FULL();
+    } while ((seq & 1) || (seq != android_atomic_acquire_load(&mSequence)));
+}
+
+uint32_t RuntimeConfig::getVersion() const {
+    RuntimeConfigSnapshot snapshot;
+    getSnapshot(snapshot);
+    return snapshot.version;
+}
+
+bool RuntimeConfig::threadLoop() {
+    usleep(REFRESH_PERIOD_MS * 1000);
+    refresh();
+    return true;
+}
+
+int RuntimeConfig::readyToRun() {
+    LOGE_IF(RC_DEBUG, "%s", __func__);
+    return 0; /*NO_ERROR*/
+}
+
+RuntimeConfig *RuntimeConfig::getInstance() {
+    // Lock only the first time, this is called on every frame
+    RuntimeConfig *instance = sInstancePtr;
+    ANDROID_MEMBAR_FULL();
+    if (instance)
+        return instance;
+
+    android::Mutex::Autolock lock(sLock);
+    if(sInstance.get() == NULL) {
+        sInstance = new RuntimeConfig();
+        // Publish a first snapshot before anyone can read it
+        sInstance->refresh();
+        sInstance->run(threadName, android::PRIORITY_BACKGROUND);
+        ANDROID_MEMBAR_FULL();
+        sInstancePtr = sInstance.get();
+    }
+    return sInstance.get();
+}
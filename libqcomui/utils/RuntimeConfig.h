@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of Code Aurora Forum, Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDE_LIBQCOM_RUNTIMECONFIG
+#define INCLUDE_LIBQCOM_RUNTIMECONFIG
+
+#include <stdint.h>
+#include <cutils/properties.h>
+#include <utils/threads.h>
+
+/* Copy of the runtime configuration, as seen by the watcher at some point.
+ * The version is bumped every time one of the values changes.
+ */
+struct RuntimeConfigSnapshot {
+    uint32_t version;
+    int compositionType;        // COMPOSITION_TYPE_* of this device
+    bool bypassEnabled;         // debug.compbypass.enable
+    bool bypassRotator;         // debug.compbypass.rotator
+    int swapInterval;           // debug.egl.swapinterval
+    int mdpBandwidthBudget;     // debug.hwc.mdp_bw_budget in MB/s, 0 if none
+    bool hdmiConnected;         // hw.hdmiON
+    bool panel3D;               // Primary panel is a 3D panel
+    bool usePanel3D;            // 3D panel and persist.user.panel3D set
+    bool tv3D;                  // HDMI sink reports 3D support in its EDID
+    int dumpCountPng;           // debug.sf.dump.png
+    uint32_t dumpGenerationPng; // Bumped every time debug.sf.dump.png changes
+    int dumpCountRaw;           // debug.sf.dump
+    uint32_t dumpGenerationRaw; // Bumped every time debug.sf.dump changes
+};
+
+/* Process wide runtime configuration.
+ * A background thread polls the properties, sysfs and framebuffer info that
+ * the display HALs depend on and publishes them as a snapshot. Reading the
+ * snapshot never makes a system call and never blocks, so it can be used on
+ * every frame.
+ */
+class RuntimeConfig : public android::Thread {
+    // Sequence count of mSnapshot, odd while an update is in progress
+    volatile int32_t mSequence;
+    RuntimeConfigSnapshot mSnapshot;
+    //Serializes the watcher with explicit refresh calls
+    android::Mutex mRefreshLock;
+    char mDumpPropPng[PROPERTY_VALUE_MAX];
+    char mDumpPropRaw[PROPERTY_VALUE_MAX];
+    bool mProbedPanel;
+    static android::Mutex sLock;
+    //This is a strong pointer just because this class derives indirectly from
+    //RefBase. The instance having a process-lifetime, there is no need for ref
+    //counting, so will never be exposed to clients.
+    static android::sp<RuntimeConfig> sInstance;
+    //Published once sInstance is fully initialized
+    static RuntimeConfig* volatile sInstancePtr;
+    RuntimeConfig();
+    void probe(RuntimeConfigSnapshot& snapshot, bool hotplug);
+    void publish(const RuntimeConfigSnapshot& snapshot);
+public:
+    virtual ~RuntimeConfig(){}
+    //Copies the latest snapshot
+    void getSnapshot(RuntimeConfigSnapshot& snapshot) const;
+    //Version of the latest snapshot
+    uint32_t getVersion() const;
+    //Re-read the configuration now, instead of waiting for the watcher.
+    //On an external display hotplug, the EDID is read again as well.
+    void refresh(bool hotplug = false);
+    //Overrides
+    virtual bool        threadLoop();
+    virtual int         readyToRun();
+    static RuntimeConfig *getInstance();
+};
+
+#endif // INCLUDE_LIBQCOM_RUNTIMECONFIG